@@ -0,0 +1,266 @@
+#include "AlphaDisplay.h"
+
+// HT16K33 commands
+#define HT16K33_RAM       0x00    // | RAM address, then data
+#define HT16K33_OSC_ON    0x21    // system setup: oscillator on
+#define HT16K33_DISPLAY   0x81    // display setup: on, no blinking
+#define HT16K33_DIMMING   0xE0    // | brightness 0 to 15
+
+// Segments of each glyph, bit 0 for segment A to bit 13 for segment N:
+//
+//    ---A---
+//   |\  |  /|
+//   F H I J B
+//   |  \|/  |
+//    -G- -K-
+//   |  /|\  |
+//   E N M L C
+//   |/  |  \|
+//    ---D---
+static const uint16_t DIGITS[10] PROGMEM = {
+  0x223F, 0x0206, 0x045B, 0x040F, 0x0466,   // 0-4
+  0x046D, 0x047D, 0x0007, 0x047F, 0x046F    // 5-9
+};
+static const uint16_t LETTERS[26] PROGMEM = {
+  0x0477, 0x150F, 0x0039, 0x110F, 0x0079, 0x0071,   // A-F
+  0x043D, 0x0476, 0x1109, 0x001E, 0x0A70, 0x0038,   // G-L
+  0x02B6, 0x08B6, 0x003F, 0x0473, 0x083F, 0x0C73,   // M-R
+  0x046D, 0x1101, 0x003E, 0x2230, 0x2836, 0x2A80,   // S-X
+  0x1280, 0x2209                                    // Y-Z
+};
+#define GLYPH_MINUS 0x0440
+
+// Where each segment of a character lies in display RAM, as wired on the
+// SparkFun board: segment s of character d (0-3) of a chip is bit
+// (d + ROW[s]) of RAM byte 2 * COM[s].
+static const uint8_t COM[14] = { 0, 1, 2, 3, 4, 5, 6, 1, 0, 2, 3, 4, 5, 6 };
+static const uint8_t ROW[14] = { 0, 0, 0, 0, 0, 0, 0, 4, 4, 4, 4, 4, 4, 4 };
+
+#if SRAM_REPORT
+// Report SRAM taken by the display at build time (SramReport.h).
+static void __attribute__((unused)) sram_report() {
+  SRAM_REPORT_TYPE(AlphaDisplay);
+}
+#endif
+
+// Constructor
+AlphaDisplay::AlphaDisplay(const uint8_t addr0, const uint8_t addr1, I2CQueue* bus) :
+  m_bus(bus),
+  m_chip(0),
+  m_len(0),
+  m_changed(false),
+  m_refreshing(false),
+  m_refresh_msec(0L),
+  m_written(0L)
+{
+  m_addr[0] = addr0;
+  m_addr[1] = addr1;
+  memset(m_ram, 0, sizeof m_ram);
+  memset(m_shadow, 0, sizeof m_shadow);
+  m_xfer.status = I2CTransfer::eIdle;
+}
+
+// Private method
+// Post a write of len bytes from m_tx, whose first byte is the RAM address.
+bool AlphaDisplay::send(const uint8_t chip, const uint8_t len) {
+  m_xfer.tx = m_tx;
+  m_xfer.rx = NULL;
+  m_xfer.addr = m_addr[chip];
+  m_xfer.ntx = len + 1;
+  m_xfer.nrx = 0;
+  if (!m_bus->post(&m_xfer)) {
+    return false;
+  }
+  m_chip = chip;
+  m_len = len;
+  return true;
+}
+
+// Private method
+// Send one command byte to a chip and wait for it.
+bool AlphaDisplay::command(const uint8_t chip, const uint8_t cmd) {
+  m_tx[0] = cmd;
+  if (!send(chip, 0)) {
+    return false;
+  }
+  m_len = 0;
+  while (!m_xfer.done()) {
+    m_bus->poll();
+  }
+  return m_xfer.ok();
+}
+
+// Start the chips and blank them, waiting on the bus.  Call from setup().
+// Brightness is 0 to 15.
+bool AlphaDisplay::begin(const uint8_t brightness) {
+  m_bus->begin();
+  m_bus->flush();
+  bool ok = true;
+  for (uint8_t c = 0; c < DISPLAY_CHIPS; ++c) {
+    ok = ok && command(c, HT16K33_OSC_ON);
+    ok = ok && command(c, HT16K33_DISPLAY);
+    ok = ok && command(c, HT16K33_DIMMING | (brightness & 0x0F));
+    // Blank all of display RAM, whatever the shadow says.
+    memset(m_ram[c], 0, DISPLAY_RAM);
+    memset(m_shadow[c], 0xFF, DISPLAY_RAM);
+  }
+  m_changed = true;
+  m_refresh_msec = millis() - DISPLAY_PERIOD_MSEC;
+  if (ok) {
+    flush();
+  }
+  return ok;
+}
+
+// Blank every character.
+void AlphaDisplay::clear() {
+  for (uint8_t i = 0; i < DISPLAY_CHARS; ++i) {
+    putChar(i, ' ');
+  }
+}
+
+// Get segments of a character: digits, letters (either case), '-' and
+// space; anything else is blank.
+uint16_t AlphaDisplay::glyph(const char c) {
+  if (c >= '0' && c <= '9') {
+    return pgm_read_word(&DIGITS[c - '0']);
+  } else if (c >= 'A' && c <= 'Z') {
+    return pgm_read_word(&LETTERS[c - 'A']);
+  } else if (c >= 'a' && c <= 'z') {
+    return pgm_read_word(&LETTERS[c - 'a']);
+  } else if (c == '-') {
+    return GLYPH_MINUS;
+  }
+  return 0;
+}
+
+// Draw one character, counting positions from 0 at the left.
+void AlphaDisplay::putChar(const uint8_t pos, const char c) {
+  if (pos >= DISPLAY_CHARS) {
+    return;
+  }
+  uint8_t* ram = m_ram[pos >> 2];
+  uint8_t d = pos & 0x03;
+  uint16_t segs = glyph(c);
+  for (uint8_t s = 0; s < 14; ++s) {
+    uint8_t& b = ram[2 * COM[s]];
+    uint8_t bit = 1 << (d + ROW[s]);
+    uint8_t was = b;
+    b = (segs & (1 << s)) ? (b | bit) : (b & ~bit);
+    m_changed = m_changed || (b != was);
+  }
+}
+
+// Draw a string from the left, blanking characters past its end.
+void AlphaDisplay::print(const char* s) {
+  uint8_t i = 0;
+  for ( ; i < DISPLAY_CHARS && s[i] != '\0'; ++i) {
+    putChar(i, s[i]);
+  }
+  for ( ; i < DISPLAY_CHARS; ++i) {
+    putChar(i, ' ');
+  }
+}
+
+// Draw a string starting at a position, leaving other characters alone.
+void AlphaDisplay::printText(const uint8_t pos, const char* s) {
+  for (uint8_t i = pos; i < DISPLAY_CHARS && *s != '\0'; ++i, ++s) {
+    putChar(i, *s);
+  }
+}
+
+// Draw a number right-aligned in width characters from pos, blank-filled
+// on the left, digit by digit without any formatting library.  Numbers
+// too wide for the field show as dashes.
+void AlphaDisplay::printNumber(const uint8_t pos, const uint8_t width, uint16_t value) {
+  uint8_t i = width;
+  do {
+    --i;
+    putChar(pos + i, '0' + value % 10);
+    value /= 10;
+  } while (i > 0 && value != 0);
+  if (value != 0) {
+    for (i = 0; i < width; ++i) {
+      putChar(pos + i, '-');
+    }
+    return;
+  }
+  while (i > 0) {
+    putChar(pos + --i, ' ');
+  }
+}
+
+// Move the display on by at most one short write, without waiting.  Call
+// when loop() has nothing else to do.  Returns true if a write was posted.
+bool AlphaDisplay::update() {
+
+  m_bus->poll();
+  if (!m_xfer.done()) {
+    return false;
+  }
+  if (m_len > 0) {
+    if (m_xfer.ok()) {
+      memcpy(&m_shadow[m_chip][m_tx[0]], &m_tx[1], m_len);
+      m_written += m_len;
+    } else {
+      // Leave the bytes to the next refresh rather than retry at once.
+      m_refreshing = false;
+    }
+    m_len = 0;
+  }
+
+  if (!m_refreshing) {
+    if (!m_changed || millis() - m_refresh_msec < DISPLAY_PERIOD_MSEC) {
+      return false;
+    }
+    m_refresh_msec = millis();
+    m_refreshing = true;
+  }
+  // Sensor transfers go first; a display write only starts on a quiet bus.
+  if (!m_bus->idle()) {
+    return false;
+  }
+
+  // Write the first differing byte and any more differing bytes within
+  // DISPLAY_CHUNK of it, with those between.
+  for (uint8_t c = 0; c < DISPLAY_CHIPS; ++c) {
+    const uint8_t* ram = m_ram[c];
+    const uint8_t* shadow = m_shadow[c];
+    for (uint8_t i = 0; i < DISPLAY_RAM; ++i) {
+      if (ram[i] != shadow[i]) {
+        uint8_t len = 1;
+        for (uint8_t j = i + 1; j < DISPLAY_RAM && j < i + DISPLAY_CHUNK; ++j) {
+          if (ram[j] != shadow[j]) {
+            len = j - i + 1;
+          }
+        }
+        m_tx[0] = HT16K33_RAM | i;
+        memcpy(&m_tx[1], &ram[i], len);
+        return send(c, len);
+      }
+    }
+  }
+  m_changed = false;
+  m_refreshing = false;
+  return false;
+
+}
+
+// Return true if the chips show what was last drawn.
+bool AlphaDisplay::idle() const {
+  return !m_changed && m_xfer.done();
+}
+
+// Wait until the chips show what was last drawn, ignoring the refresh
+// rate limit, or until a write fails.  Call from setup(), not from loop().
+void AlphaDisplay::flush() {
+  while (!idle() && m_xfer.status != I2CTransfer::eFailed) {
+    m_refresh_msec = millis() - DISPLAY_PERIOD_MSEC;
+    update();
+  }
+}
+
+// Get number of display RAM bytes written since start-up.
+uint32_t AlphaDisplay::written() const {
+  return m_written;
+}
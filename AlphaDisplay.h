@@ -0,0 +1,70 @@
+#ifndef _ALPHA_DISPLAY__H_
+#define _ALPHA_DISPLAY__H_
+
+#include <Arduino.h>
+
+#include "I2CQueue.h"
+#include "SramReport.h"
+
+// HT16K33 driver chips, 4 characters each
+#define DISPLAY_CHIPS 2
+
+// Characters across all chips
+#define DISPLAY_CHARS (4 * DISPLAY_CHIPS)
+
+// Bytes of display RAM in each HT16K33
+#define DISPLAY_RAM 16
+
+// Most display RAM bytes written by one I2C transfer, so that a sensor
+// transfer never waits long behind one
+#define DISPLAY_CHUNK 4
+
+// Shortest time from the start of one refresh to the start of the next (msec)
+#define DISPLAY_PERIOD_MSEC 100
+
+// 14-segment alphanumeric display of DISPLAY_CHIPS HT16K33s, wired as
+// SparkFun's Qwiic Alphanumeric Display, driven through the I2C transfer
+// queue without ever blocking.
+//
+// Characters are drawn into a copy of each chip's display RAM, and a
+// shadow holds what the chip was last sent.  update(), called when loop()
+// has nothing else to do, writes one short run of differing bytes at a
+// time, only while the bus is otherwise idle, and starts a refresh no more
+// often than every DISPLAY_PERIOD_MSEC.  Unchanged characters cost nothing.
+class AlphaDisplay {
+
+  private:
+    I2CQueue* m_bus;                          // (pointer to) transfer queue
+    uint8_t m_addr[DISPLAY_CHIPS];            // I2C address of each chip
+    uint8_t m_ram[DISPLAY_CHIPS][DISPLAY_RAM];    // display RAM wanted
+    uint8_t m_shadow[DISPLAY_CHIPS][DISPLAY_RAM]; // display RAM as last sent
+    uint8_t m_tx[DISPLAY_CHUNK + 1];          // RAM address, then data
+    I2CTransfer m_xfer;                       // transfer writing m_tx
+    uint8_t m_chip;                           // chip m_xfer is writing
+    uint8_t m_len;                            // RAM bytes m_xfer is writing
+    bool m_changed;                           // m_ram may differ from m_shadow
+    bool m_refreshing;                        // refresh under way
+    uint32_t m_refresh_msec;                  // time last refresh started (msec)
+    uint32_t m_written;                       // RAM bytes written
+
+    bool send(const uint8_t chip, const uint8_t len);
+    bool command(const uint8_t chip, const uint8_t cmd);
+
+  public:
+    AlphaDisplay(const uint8_t addr0 = 0x70, const uint8_t addr1 = 0x71,
+                 I2CQueue* bus = &i2c_queue);
+    bool begin(const uint8_t brightness = 0);
+    void clear();
+    void putChar(const uint8_t pos, const char c);
+    void print(const char* s);
+    void printText(const uint8_t pos, const char* s);
+    void printNumber(const uint8_t pos, const uint8_t width, uint16_t value);
+    bool update();
+    bool idle() const;
+    void flush();
+    uint32_t written() const;
+    static uint16_t glyph(const char c);
+
+};
+
+#endif
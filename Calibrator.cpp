@@ -0,0 +1,341 @@
+#include "Calibrator.h"
+
+#include <EEPROM.h>
+
+#include "Sensor.h"
+#include "Speedometer.h"
+
+// Bytes of the EEPROM record: marker, number of windows, each window,
+// then a checksum
+#define CAL_MARKER 0xCA
+#define CAL_RECORD (3 * CAL_WINDOWS + 3)
+
+// Constructor
+Calibrator::Calibrator(const uint8_t track) :
+  m_track(track),
+  m_nsens(0),
+  m_last(0),
+  m_near(0),
+  m_target(CAL_PASSES),
+  m_background(0xFF),
+  m_nwin(0),
+  m_step(eIdle),
+  m_next(0)
+{
+  memset(m_hist, 0, sizeof m_hist);
+  memset(m_visits, 0, sizeof m_visits);
+  memset(m_npeaks, 0, sizeof m_npeaks);
+  memset(m_win, 0, sizeof m_win);
+}
+
+// Start calibrating afresh, with the track's number of sensors.  With
+// more than CAL_SENSORS, the histograms are kept for the first ones and
+// the last, so a train is counted where it arrives and where it leaves.
+// Windows found or loaded before stay available until new ones are found.
+void Calibrator::begin(const uint8_t sensors) {
+  m_nsens = sensors < CAL_SENSORS ? sensors : CAL_SENSORS;
+  m_last = sensors ? sensors - 1 : 0;
+  memset(m_hist, 0, sizeof m_hist);
+  memset(m_visits, 0, sizeof m_visits);
+  m_near = 0;
+  m_target = CAL_PASSES;
+  m_step = eCollect;
+}
+
+// Count one filtered distance from a track's sensor j.  Called by the
+// Speedometer for every sample; other tracks' samples are ignored.
+void Calibrator::add(const uint8_t t, const uint8_t j, const uint32_t dist) {
+  if (m_step == eIdle || t != m_track || m_nsens == 0 || dist == NO_READING) {
+    return;
+  }
+  // Histogram kept for sensor j, if any
+  uint8_t k;
+  if (j < m_nsens - 1) {
+    k = j;
+  } else if (j == m_last) {
+    k = m_nsens - 1;
+  } else {
+    return;
+  }
+  uint16_t* hist = m_hist[k];
+  uint8_t b = (dist >= CAL_BINS * CAL_BIN_MM) ? CAL_BINS - 1 : (uint8_t) (dist / CAL_BIN_MM);
+  if (++hist[b] == UINT16_MAX) {
+    // Halve every bin, so old counts fade rather than overflow.
+    for (uint8_t i = 0; i < CAL_BINS; ++i) {
+      hist[i] >>= 1;
+    }
+  }
+  // A pass starts when the sensor first sees something.
+  uint8_t bit = 1 << k;
+  if (dist < ARM_MM) {
+    if (!(m_near & bit)) {
+      m_near |= bit;
+      ++m_visits[k];
+    }
+  } else {
+    m_near &= ~bit;
+  }
+}
+
+// Private method
+// Find the background and the peaks nearer than it in sensor j's
+// histogram.  A peak is a local maximum of at least CAL_MIN_PEAK samples
+// and an eighth of all those nearer than the background, which leaves
+// out the distances a filtered range sweeps through as a train arrives
+// or leaves.  It extends either side while the counts keep falling and
+// stay above an eighth of its own.
+void Calibrator::analyse(const uint8_t j) {
+
+  const uint16_t* hist = m_hist[j];
+  uint8_t bg = 0;
+  for (uint8_t b = 1; b < CAL_BINS; ++b) {
+    if (hist[b] > hist[bg]) {
+      bg = b;
+    }
+  }
+  if (bg * CAL_BIN_MM < m_background) {
+    m_background = bg * CAL_BIN_MM;
+  }
+  m_npeaks[j] = 0;
+  if (bg < 2) {
+    return;
+  }
+  uint8_t end = bg - 1;         // first bin too close to background
+  uint32_t near = 0;
+  for (uint8_t b = 0; b < end; ++b) {
+    near += hist[b];
+  }
+
+  // Highest peaks, highest first.
+  uint8_t top[CAL_WINDOWS];
+  uint8_t ntop = 0;
+  for (uint8_t b = 0; b < end; ++b) {
+    uint16_t h = hist[b];
+    if (h < CAL_MIN_PEAK || h < near / 8
+        || (b > 0 && hist[b - 1] > h) || (b + 1 < end && hist[b + 1] >= h)) {
+      continue;
+    }
+    uint8_t i = ntop < CAL_WINDOWS ? ntop++ : CAL_WINDOWS;
+    while (i > 0 && hist[top[i - 1]] < h) {
+      if (i < CAL_WINDOWS) {
+        top[i] = top[i - 1];
+      }
+      --i;
+    }
+    if (i < CAL_WINDOWS) {
+      top[i] = b;
+    }
+  }
+  // Nearest first.
+  for (uint8_t p = 1; p < ntop; ++p) {
+    for (uint8_t q = p; q > 0 && top[q] < top[q - 1]; --q) {
+      uint8_t b = top[q];
+      top[q] = top[q - 1];
+      top[q - 1] = b;
+    }
+  }
+
+  for (uint8_t p = 0; p < ntop; ++p) {
+    uint8_t b = top[p];
+    uint16_t floor = hist[b] / 8;
+    uint8_t lo = b;
+    while (lo > 0 && hist[lo - 1] > floor && hist[lo - 1] <= hist[lo]) {
+      --lo;
+    }
+    uint8_t hi = b;
+    while (hi + 1 < end && hist[hi + 1] > floor && hist[hi + 1] <= hist[hi]) {
+      ++hi;
+    }
+    float sum = 0.0;
+    float sum_mm = 0.0;
+    for (uint8_t i = lo; i <= hi; ++i) {
+      sum += hist[i];
+      sum_mm += (float) hist[i] * (i * CAL_BIN_MM + CAL_BIN_MM / 2);
+    }
+    Peak& pk = m_peak[j][p];
+    pk.center = sum_mm / sum;
+    float below = pk.center - lo * CAL_BIN_MM;
+    float above = (hi + 1) * CAL_BIN_MM - pk.center;
+    pk.spread = below > above ? below : above;
+  }
+  m_npeaks[j] = ntop;
+
+}
+
+// Private method
+// Make a window from each peak that every sensor found: centered on the
+// sensors' mean distance, and wide enough for all of their spreads plus
+// CAL_MARGIN_MM, with hysteresis half the half-width.  A window too wide
+// for the room before the next peak or the background is shrunk to fit.
+// Returns false if no sensor found a peak, or the sensors disagree.
+bool Calibrator::combine() {
+
+  uint8_t n = CAL_WINDOWS;
+  for (uint8_t j = 0; j < m_nsens; ++j) {
+    if (m_npeaks[j] < n) {
+      n = m_npeaks[j];
+    }
+  }
+  if (n == 0) {
+    return false;
+  }
+
+  float center[CAL_WINDOWS];
+  for (uint8_t i = 0; i < n; ++i) {
+    center[i] = 0.0;
+    for (uint8_t j = 0; j < m_nsens; ++j) {
+      center[i] += m_peak[j][i].center;
+    }
+    center[i] /= m_nsens;
+  }
+  CalWindow win[CAL_WINDOWS];
+  for (uint8_t i = 0; i < n; ++i) {
+    float spread = 0.0;
+    for (uint8_t j = 0; j < m_nsens; ++j) {
+      float off = fabs(m_peak[j][i].center - center[i]);
+      if (off > 4 * CAL_MARGIN_MM) {
+        return false;
+      }
+      if (off + m_peak[j][i].spread > spread) {
+        spread = off + m_peak[j][i].spread;
+      }
+    }
+    float hwidth = spread + CAL_MARGIN_MM;
+    if (hwidth < CAL_MIN_HWIDTH) {
+      hwidth = CAL_MIN_HWIDTH;
+    }
+    float hy = hwidth / 2;
+    float below = (i == 0) ? center[i] : (center[i] - center[i - 1]) / 2;
+    float above = ((i + 1 < n) ? center[i + 1] : (float) m_background) - center[i];
+    above = (i + 1 < n) ? above / 2 : above;
+    float room = below < above ? below : above;
+    if (hwidth + hy > room) {
+      hwidth = room * 2 / 3;
+      hy = room / 3;
+    }
+    if (hwidth < 2 || hy < 1) {
+      return false;
+    }
+    win[i].center = (uint8_t) (center[i] + 0.5);
+    win[i].hwidth = (uint8_t) hwidth;
+    win[i].hysteresis = (uint8_t) hy;
+  }
+  memcpy(m_win, win, sizeof win);
+  m_nwin = n;
+  return true;
+
+}
+
+// Private method
+// Get byte i of the EEPROM record of the windows.
+uint8_t Calibrator::recordByte(const uint8_t i) const {
+  if (i == 0) {
+    return CAL_MARKER;
+  } else if (i == 1) {
+    return m_nwin;
+  } else if (i < CAL_RECORD - 1) {
+    const CalWindow& w = m_win[(i - 2) / 3];
+    return ((i - 2) % 3 == 0) ? w.center : (((i - 2) % 3 == 1) ? w.hwidth : w.hysteresis);
+  }
+  uint8_t sum = 0;
+  for (uint8_t k = 0; k < CAL_RECORD - 1; ++k) {
+    sum += recordByte(k);
+  }
+  return ~sum;
+}
+
+// Move calibration on by one step, without waiting.  Call when loop()
+// has nothing else to do.  Returns true when new windows have been found;
+// they are then saved over the following calls.
+bool Calibrator::update() {
+
+  switch (m_step) {
+    case eCollect:
+      for (uint8_t j = 0; j < m_nsens; ++j) {
+        if (m_visits[j] < m_target) {
+          return false;
+        }
+      }
+      m_background = 0xFF;
+      m_next = 0;
+      m_step = eAnalyse;
+      break;
+    case eAnalyse:
+      analyse(m_next);
+      if (++m_next == m_nsens) {
+        m_step = eCombine;
+      }
+      break;
+    case eCombine:
+      if (!combine()) {
+        // Wait for more passes and try again.
+        m_target += CAL_PASSES;
+        m_step = eCollect;
+        break;
+      }
+      m_next = 0;
+      m_step = eSave;
+      return true;
+    case eSave:
+      // Never wait on the EEPROM; a byte takes 3.3 msec to write.
+      if (eeprom_is_ready()) {
+        EEPROM.update(CAL_EEPROM_ADDR + m_next, recordByte(m_next));
+        if (++m_next == CAL_RECORD) {
+          m_step = eIdle;
+        }
+      }
+      break;
+    default:
+      break;
+  }
+  return false;
+
+}
+
+// Load windows saved by an earlier calibration.  Returns false, leaving
+// no windows, if there are none or the record is damaged.
+bool Calibrator::load() {
+  uint8_t rec[CAL_RECORD];
+  uint8_t sum = 0;
+  for (uint8_t i = 0; i < CAL_RECORD; ++i) {
+    rec[i] = EEPROM.read(CAL_EEPROM_ADDR + i);
+    sum += rec[i];
+  }
+  if (rec[0] != CAL_MARKER || rec[1] == 0 || rec[1] > CAL_WINDOWS || sum != 0xFF) {
+    m_nwin = 0;
+    return false;
+  }
+  m_nwin = rec[1];
+  for (uint8_t i = 0; i < m_nwin; ++i) {
+    m_win[i].center = rec[3 * i + 2];
+    m_win[i].hwidth = rec[3 * i + 3];
+    m_win[i].hysteresis = rec[3 * i + 4];
+  }
+  return true;
+}
+
+// Return true while calibrating or saving.
+bool Calibrator::active() const {
+  return m_step != eIdle;
+}
+
+// Get fewest passes seen by any sensor while calibrating.
+uint16_t Calibrator::passes() const {
+  uint16_t n = UINT16_MAX;
+  for (uint8_t j = 0; j < m_nsens; ++j) {
+    if (m_visits[j] < n) {
+      n = m_visits[j];
+    }
+  }
+  return m_nsens ? n : 0;
+}
+
+// Get number of windows found or loaded, nearest track first.
+uint8_t Calibrator::windows() const {
+  return m_nwin;
+}
+
+// Get window i, nearest track first.
+CalWindow Calibrator::window(const uint8_t i) const {
+  return m_win[i];
+}
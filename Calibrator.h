@@ -0,0 +1,100 @@
+#ifndef _CALIBRATOR__H_
+#define _CALIBRATOR__H_
+
+#include <Arduino.h>
+
+// Sensors of the calibrated track with a histogram each, 128 bytes apiece;
+// with more sensors than this, the first ones and the last
+#ifndef CAL_SENSORS
+#define CAL_SENSORS 2
+#endif
+
+// Histogram bins, each CAL_BIN_MM wide, covering ranges 0 to 255 mm
+#define CAL_BINS 64
+#define CAL_BIN_MM 4
+
+// Windows found, one per track seen by the sensors, nearest first
+#define CAL_WINDOWS 2
+
+// Passes each sensor must see before the histograms are analysed, and
+// again after any analysis which finds no track
+#define CAL_PASSES 8
+
+// Fewest samples in a bin for it to be taken as a track
+#define CAL_MIN_PEAK 32
+
+// Window margin beyond the spread of a track's distances (mm), and
+// narrowest half-width allowed (mm)
+#define CAL_MARGIN_MM 6
+#define CAL_MIN_HWIDTH 8
+
+// EEPROM address of the saved windows (3 bytes each, plus 3 more)
+#define CAL_EEPROM_ADDR 0
+
+// Detection window found by calibration (mm)
+struct CalWindow {
+  uint8_t center;
+  uint8_t hwidth;
+  uint8_t hysteresis;
+};
+
+// Finds RangeWindows for a track from the filtered distances its sensors
+// report, and keeps them in EEPROM.
+//
+// The Speedometer passes each sample to add(), which counts it in a
+// fixed histogram of the sensor's distances.  Once every sensor has seen
+// CAL_PASSES passes, update() looks for the background, the commonest
+// distance, and for peaks nearer than it, one per track in view.  Each
+// peak's centre and spread give a window's centre, half-width and
+// hysteresis, kept short of the next peak and the background.  update()
+// does at most one sensor's analysis or one EEPROM byte per call, so it
+// can run from loop() between samples.
+class Calibrator {
+
+  private:
+    enum E_Step {
+      eIdle,            // not calibrating
+      eCollect,         // counting distances
+      eAnalyse,         // finding peaks, one sensor per update()
+      eCombine,         // making windows from all sensors' peaks
+      eSave             // writing windows to EEPROM, a byte per update()
+    };
+    // Track distances seen by one sensor
+    struct Peak {
+      float center;     // mean distance (mm)
+      float spread;     // furthest distance from center (mm)
+    };
+
+    const uint8_t m_track;                    // track calibrated
+    uint8_t m_nsens;                          // sensors with histograms
+    uint8_t m_last;                           // track's last sensor, last histogram's
+    uint16_t m_hist[CAL_SENSORS][CAL_BINS];   // distances seen by each sensor
+    uint16_t m_visits[CAL_SENSORS];           // passes seen by each sensor
+    uint8_t m_near;                           // bit k: histogram k's sensor sees something
+    uint16_t m_target;                        // passes wanted before analysis
+    Peak m_peak[CAL_SENSORS][CAL_WINDOWS];    // peaks found in each histogram
+    uint8_t m_npeaks[CAL_SENSORS];            // peaks found in each histogram
+    uint8_t m_background;                     // commonest distance of any sensor (mm)
+    CalWindow m_win[CAL_WINDOWS];             // windows found or loaded
+    uint8_t m_nwin;                           // number of m_win valid
+    uint8_t m_step;                           // E_Step
+    uint8_t m_next;                           // sensor or byte next in m_step
+
+    void analyse(const uint8_t j);
+    bool combine();
+    uint8_t recordByte(const uint8_t i) const;
+
+  public:
+    Calibrator(const uint8_t track = 0);
+    void begin(const uint8_t sensors);
+    void add(const uint8_t t, const uint8_t j, const uint32_t dist);
+    bool update();
+    bool load();
+    bool active() const;
+    uint16_t passes() const;
+    uint8_t windows() const;
+    CalWindow window(const uint8_t i) const;
+
+};
+
+#endif
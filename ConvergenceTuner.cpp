@@ -0,0 +1,118 @@
+#include "ConvergenceTuner.h"
+
+// Constructor
+ConvergenceTuner::ConvergenceTuner() {
+  begin();
+}
+
+// Private method
+// Start measuring targets with a max convergence time of msec.
+void ConvergenceTuner::measure(const uint8_t msec) {
+  m_state = eMeasuring;
+  m_msec = msec;
+  m_targets = 0;
+  m_lost = 0;
+  m_worst_usec = 0L;
+}
+
+// Start tuning again from a max convergence time of msec, forgetting any
+// time found too short.
+void ConvergenceTuner::begin(const uint8_t msec) {
+  measure(msec);
+  m_floor = TUNE_MIN_MSEC;
+  m_near = false;
+  m_seen = false;
+  m_run = 0;
+  m_dark = 0;
+  m_tunes = 0;
+  m_lost_total = 0;
+}
+
+// Add a sample's range (mm), error code (status, 0 if valid, 0xFF if it
+// could not be read) and convergence time (usec, 0 if not read), targets
+// being valid ranges no farther than limit_mm.
+// Returns true if the max convergence time has changed.
+bool ConvergenceTuner::add(const uint8_t status, const uint32_t range,
+                           const uint32_t conv_usec, const uint8_t limit_mm) {
+  uint8_t lost = 0;
+  if (status == TUNE_ERR_MAX_CONV) {
+    if (m_run < UINT8_MAX) {
+      ++m_run;
+    }
+    if (!m_seen && m_dark < UINT8_MAX) {
+      ++m_dark;
+    }
+  } else if (status == 0) {
+    bool target = (range <= limit_mm);
+    if (target) {
+      ++m_targets;
+      if (conv_usec > m_worst_usec) {
+        m_worst_usec = conv_usec;
+      }
+      if (m_near) {
+        // Errors between two targets
+        lost = m_run;
+      }
+      m_seen = true;
+      m_dark = 0;
+    }
+    m_near = target;
+    m_run = 0;
+  } else if (status != 0xFF) {
+    // Nothing in range: the end of whatever was passing
+    if (m_dark >= TUNE_DARK_RUN) {
+      lost = m_dark;
+    }
+    m_near = false;
+    m_seen = false;
+    m_run = 0;
+    m_dark = 0;
+  }
+  m_lost += lost;
+  m_lost_total = (m_lost_total > UINT16_MAX - lost) ? UINT16_MAX : m_lost_total + lost;
+  if (m_targets < (m_state == eMeasuring ? TUNE_SAMPLES : TUNE_BLOCK)
+      && m_lost < TUNE_LOST_MAX) {
+    return false;
+  }
+  uint8_t old = m_msec;
+  if ((uint32_t) m_lost * TUNE_ERR_DIV > m_targets) {
+    // Too short: never come back this low, and measure again.
+    if (m_floor <= m_msec && m_msec < TUNE_MAX_MSEC) {
+      m_floor = m_msec + 1;
+    }
+    measure(m_msec < TUNE_MAX_MSEC / 2 ? 2 * m_msec : TUNE_MAX_MSEC);
+    return m_msec != old;
+  }
+  if (m_state == eMeasuring) {
+    // Longest convergence seen, half as much again, rounded up to msec
+    uint32_t msec = ((m_worst_usec + (m_worst_usec >> 1)) + 999) / 1000;
+    msec = msec < m_floor ? m_floor : (msec > TUNE_MAX_MSEC ? TUNE_MAX_MSEC : msec);
+    m_msec = (uint8_t) msec;
+    m_state = eTuned;
+    ++m_tunes;
+  }
+  m_targets = 0;
+  m_lost = 0;
+  m_worst_usec = 0L;
+  return m_msec != old;
+}
+
+// Get max convergence time the sensor should use (msec).
+uint8_t ConvergenceTuner::msec() const {
+  return m_msec;
+}
+
+// Return true if targets' convergence times are wanted.
+bool ConvergenceTuner::measuring() const {
+  return m_state == eMeasuring;
+}
+
+// Get number of times tuned since begin().
+uint16_t ConvergenceTuner::tunes() const {
+  return m_tunes;
+}
+
+// Get number of targets lost to convergence errors since begin().
+uint16_t ConvergenceTuner::lost() const {
+  return m_lost_total;
+}
@@ -0,0 +1,89 @@
+#ifndef _CONVERGENCETUNER__H_
+#define _CONVERGENCETUNER__H_
+
+#include <Arduino.h>
+
+// Max convergence time set up before any tuning (msec)
+#define TUNE_START_MSEC 8
+
+// Shortest and longest max convergence times the VL6180X takes (msec)
+#define TUNE_MIN_MSEC 1
+#define TUNE_MAX_MSEC 63
+
+// Targets read to measure their convergence times, and read between
+// checks of the error rate once tuned
+#define TUNE_SAMPLES 64
+#define TUNE_BLOCK 512
+
+// Error rate above which the time is raised and measured again: one
+// target lost to a convergence error for every TUNE_ERR_DIV read, or
+// TUNE_LOST_MAX lost before that many are read
+#define TUNE_ERR_DIV 32
+#define TUNE_LOST_MAX 16
+
+// Convergence errors, with no target between two readings of nothing in
+// range, taken as stock too dark to range at all
+#define TUNE_DARK_RUN 8
+
+// VL6180X range error code of a measurement whose return signal had not
+// converged by the max convergence time
+#define TUNE_ERR_MAX_CONV 7
+
+// Tunes a VL6180X's max convergence time to the targets it has to see.
+// A measurement takes a fixed readout time plus the time the return
+// signal takes to converge, which is short for a bright target close by
+// and long for a dark or distant one; with no target at all it runs to
+// the max convergence time.  So that time bounds how often the sensor can
+// be sampled, and the shortest which still converges on the rolling stock
+// in the window is the best.
+//
+// add() takes each sample's range, error code and convergence time.  A
+// target is a valid range no farther than the window's outer edge.  While
+// measuring, the longest convergence of TUNE_SAMPLES targets, half as
+// much again, becomes the max convergence time.  A max convergence error
+// is a return signal too weak to range in time.  Between two targets,
+// with no other reading, it is a target lost, as when darker stock comes
+// into the window; elsewhere it is more likely a beam partly across a gap
+// or the end of a train, well outside the window.  Stock too dark to give
+// any target at all reads as TUNE_DARK_RUN or more errors, and no target,
+// between two readings of nothing in range; those are all lost too.  If
+// more are lost than the error rate allows, measuring or once tuned, the
+// time is doubled and measured again, and never again tuned down to one
+// which lost targets.
+class ConvergenceTuner {
+
+  private:
+    enum E_State {
+      eMeasuring,                 // measuring targets' convergence times
+      eTuned                      // watching the error rate
+    };
+
+    uint8_t m_state;              // E_State
+    uint8_t m_msec;               // max convergence time in use (msec)
+    uint8_t m_floor;              // shortest time which lost no targets (msec)
+    bool m_near;                  // last reading but convergence errors was a target
+    bool m_seen;                  // target read since nothing was in range
+    uint8_t m_run;                // convergence errors in a row
+    uint8_t m_dark;               // convergence errors since nothing was in range,
+                                  //   while no target has been read
+    uint16_t m_targets;           // targets read this round
+    uint16_t m_lost;              // targets lost this round
+    uint32_t m_worst_usec;        // longest convergence of a target this round (usec)
+    uint16_t m_tunes;             // times tuned
+    uint16_t m_lost_total;        // targets lost since begin()
+
+    void measure(const uint8_t msec);
+
+  public:
+    ConvergenceTuner();
+    void begin(const uint8_t msec = TUNE_START_MSEC);
+    bool add(const uint8_t status, const uint32_t range, const uint32_t conv_usec,
+             const uint8_t limit_mm);
+    uint8_t msec() const;
+    bool measuring() const;
+    uint16_t tunes() const;
+    uint16_t lost() const;
+
+};
+
+#endif
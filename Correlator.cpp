@@ -0,0 +1,136 @@
+#include "Correlator.h"
+
+// Capture::post of a sensor which has not crossed
+#define XC_IDLE 0xFF
+
+// Constructor
+Correlator::Correlator() {
+  memset(m_cap, 0, sizeof m_cap);
+  m_cap[0].post = XC_IDLE;
+  m_cap[1].post = XC_IDLE;
+}
+
+// Private method
+// Get sample i of a frozen capture, 0 being the oldest.
+uint8_t Correlator::at(const Capture& c, const uint8_t i) const {
+  uint8_t s = c.next + i;
+  return c.dist[s < XC_SAMPLES ? s : s - XC_SAMPLES];
+}
+
+// Add a raw distance taken at time when (usec) from the first
+// sensor (k = 0) or the last (k = 1).  Ignored once the capture is
+// frozen.
+void Correlator::add(const uint8_t k, const uint32_t dist, const uint32_t when) {
+  Capture& c = m_cap[k];
+  if (c.post != XC_IDLE && c.post >= XC_POST) {
+    return;
+  }
+  // Count the samples taken at the same rate as the one before, within
+  // 1/8, allowing for the loop's jitter.
+  uint32_t interval = when - c.last_when;
+  if (c.count > 0 && interval + (interval >> 3) >= c.interval
+      && interval <= c.interval + (c.interval >> 3)) {
+    if (c.steady < XC_SAMPLES) {
+      ++c.steady;
+    }
+  } else {
+    c.steady = c.count > 0 ? 2 : 1;
+  }
+  c.interval = interval;
+  c.dist[c.next] = dist > 0xFF ? 0xFF : (uint8_t) dist;
+  if (++c.next == XC_SAMPLES) {
+    c.next = 0;
+  }
+  if (c.count < XC_SAMPLES) {
+    ++c.count;
+  }
+  c.last_when = when;
+  if (c.post != XC_IDLE) {
+    ++c.post;
+  }
+}
+
+// Note that the newest sample from a sensor entered the window.  Only
+// the first crossing of a pass counts.
+void Correlator::crossed(const uint8_t k) {
+  Capture& c = m_cap[k];
+  if (c.post == XC_IDLE) {
+    c.post = 0;
+    c.cross_when = c.last_when;
+  }
+}
+
+// Return true once both sensors have crossed and kept their samples.
+bool Correlator::ready() const {
+  return m_cap[0].post != XC_IDLE && m_cap[0].post >= XC_POST
+    && m_cap[1].post != XC_IDLE && m_cap[1].post >= XC_POST;
+}
+
+// Estimate the time taken from the sensor crossed first to the other,
+// given the pass's direction (+1 if sensor 0 was crossed first).
+// Returns false if either capture is short or unevenly spaced, the
+// profiles have no edge to match, or the best match lies at the end of
+// the search.
+bool Correlator::estimate(const int8_t direction, uint32_t& dt_usec) const {
+  if (!ready()) {
+    return false;
+  }
+  const Capture& a = m_cap[direction > 0 ? 0 : 1];
+  const Capture& b = m_cap[direction > 0 ? 1 : 0];
+  // Oldest sample of both captures' steady runs
+  uint8_t first = XC_SAMPLES - (a.steady < b.steady ? a.steady : b.steady);
+  if (XC_SAMPLES - first < XC_STEADY) {
+    return false;
+  }
+  // Mean squared difference of b[i] from a[i - k], times 256, for each k.
+  uint32_t msd[2 * XC_SHIFT + 1];
+  uint8_t best = 0;
+  for (uint8_t m = 0; m <= 2 * XC_SHIFT; ++m) {
+    int8_t k = (int8_t) m - XC_SHIFT;
+    uint8_t i0 = first + (k > 0 ? k : 0);
+    uint8_t i1 = k < 0 ? XC_SAMPLES + k : XC_SAMPLES;
+    uint32_t sum = 0;
+    for (uint8_t i = i0; i < i1; ++i) {
+      int16_t d = (int16_t) at(b, i) - (int16_t) at(a, i - k);
+      sum += (uint32_t) ((int32_t) d * d);
+    }
+    msd[m] = (sum << 8) / (i1 - i0);
+    if (msd[m] < msd[best]) {
+      best = m;
+    }
+  }
+  if (best == 0 || best == 2 * XC_SHIFT) {
+    return false;
+  }
+  // Vertex of the parabola through the best shift and its neighbours
+  float lo = (float) msd[best - 1];
+  float mid = (float) msd[best];
+  float hi = (float) msd[best + 1];
+  float curve = lo - 2.0 * mid + hi;
+  if (curve <= 0.0) {
+    return false;
+  }
+  float shift = (float) ((int8_t) best - XC_SHIFT) + 0.5 * (lo - hi) / curve;
+  // Both crossings are the same number of samples from the end of their
+  // captures, so the crossing samples' times line the profiles up.
+  float period = 0.5 * (float) ((a.last_when - a.cross_when) + (b.last_when - b.cross_when))
+    / XC_POST;
+  float dt = (float) (int32_t) (b.cross_when - a.cross_when) + shift * period;
+  if (dt < 1.0) {
+    return false;
+  }
+  dt_usec = (uint32_t) (dt + 0.5);
+  return true;
+}
+
+// Start keeping samples again, for the next pass.  A capture frozen
+// since an earlier pass is stale, and is emptied.
+void Correlator::rearm() {
+  for (uint8_t k = 0; k < 2; ++k) {
+    Capture& c = m_cap[k];
+    if (c.post != XC_IDLE && c.post >= XC_POST) {
+      c.count = 0;
+    }
+    c.post = XC_IDLE;
+  }
+}
@@ -0,0 +1,64 @@
+#ifndef _CORRELATOR__H_
+#define _CORRELATOR__H_
+
+#include <Arduino.h>
+
+// Raw distances kept from each of a track's first and last sensors,
+// ending XC_POST samples after the one which entered the window
+#define XC_SAMPLES 32
+#define XC_POST 8
+
+// Largest correction to the crossing times searched either way (samples)
+#define XC_SHIFT 6
+
+// Fewest of the newest samples which must be evenly spaced, taking in
+// the whole of a profile's edge
+#define XC_STEADY 26
+
+// Estimates the time a train took from a track's first sensor to its
+// last by matching the whole of each sensor's distance profile around
+// its window crossing, rather than the one sample where each crossed.
+// An irregular front, such as a snowplow or pilot, makes the crossing
+// point jitter from sensor to sensor; the shape of the profile does not.
+//
+// Each sensor's raw distances go into a ring of XC_SAMPLES bytes; the
+// filter's output would carry older samples, and any change of sampling
+// rate, into its edge.  When the sensor enters the window, the ring keeps
+// XC_POST more samples and is then frozen.  Once both are, estimate()
+// slides the second sensor's profile over the first's by up to XC_SHIFT
+// samples either side of where the crossings put it, takes the shift
+// with the least mean squared difference, and refines it to a fraction
+// of a sample by fitting a parabola through the differences at that
+// shift and its neighbours.  Only evenly spaced samples are compared;
+// the adaptive sampling policy speeds up as a train comes near, and if
+// that leaves too few, the profiles are not matched.
+class Correlator {
+
+  private:
+    // Recent distances from one sensor
+    struct Capture {
+      uint8_t dist[XC_SAMPLES];   // ring of raw distances (mm)
+      uint8_t next;               // slot of next sample
+      uint8_t count;              // samples held, up to XC_SAMPLES
+      uint8_t post;               // samples since crossing, or XC_IDLE
+      uint8_t steady;             // newest samples evenly spaced
+      uint32_t interval;          // time between newest two samples (usec)
+      uint32_t cross_when;        // time of sample which crossed (usec)
+      uint32_t last_when;         // time of newest sample (usec)
+    };
+
+    Capture m_cap[2];             // first and last sensors of the track
+
+    uint8_t at(const Capture& c, const uint8_t i) const;
+
+  public:
+    Correlator();
+    void add(const uint8_t k, const uint32_t dist, const uint32_t when);
+    void crossed(const uint8_t k);
+    bool ready() const;
+    bool estimate(const int8_t direction, uint32_t& dt_usec) const;
+    void rearm();
+
+};
+
+#endif
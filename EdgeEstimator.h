@@ -0,0 +1,75 @@
+#ifndef _EDGE_ESTIMATOR__H_
+#define _EDGE_ESTIMATOR__H_
+
+// Estimate when a sampled value crossed a threshold, to a fraction of
+// the sample period.
+//
+// The N most recent samples and their times are kept in a circular
+// buffer.  When a value is found to have entered a band, the samples
+// are searched from newest to oldest for the pair which brackets the
+// band's edge, and the crossing time is found by linear interpolation
+// between them.
+template<typename T, size_t N = 4>
+class EdgeEstimator {
+
+  private:
+    // Longest time between samples which will be interpolated (usec)
+    static const uint32_t MAX_GAP_USEC = 1000000L;
+
+    T m_val[N];             // recent samples
+    uint32_t m_when[N];     // times of recent samples (usec)
+    size_t m_newest;        // index of newest sample
+
+  public:
+    // Constructor
+    EdgeEstimator() : m_newest(0) {
+      for (size_t i = 0; i < N; ++i) {
+        m_val[i] = (T) 0;
+        m_when[i] = 0L;
+      }
+    }
+
+    // Add newest sample and its time (usec).
+    void add(const T val, const uint32_t when) {
+      if (++m_newest == N) {
+        m_newest = 0;
+      }
+      m_val[m_newest] = val;
+      m_when[m_newest] = when;
+    }
+
+    // Estimate time at which samples crossed into a band of values.
+    // Arguments:
+    //   lo: level crossed when entering band from below
+    //   hi: level crossed when entering band from above
+    // Returns:
+    //   interpolated crossing time (usec), or time of newest sample
+    //   if no pair of recent samples brackets the crossing
+    uint32_t crossing(const T lo, const T hi) const {
+      size_t i = m_newest;
+      for (size_t n = 1; n < N; ++n) {
+        size_t j = (i == 0) ? (N - 1) : (i - 1);
+        // Sample j is older, sample i is newer.
+        long level;
+        if (m_val[j] > hi && m_val[i] <= hi) {
+          level = (long) hi;
+        } else if (m_val[j] < lo && m_val[i] >= lo) {
+          level = (long) lo;
+        } else {
+          i = j;
+          continue;
+        }
+        long span = (long) m_val[j] - (long) m_val[i];
+        long part = (long) m_val[j] - level;
+        uint32_t dt = m_when[i] - m_when[j];
+        if (dt > MAX_GAP_USEC) {
+          break;
+        }
+        return m_when[j] + (uint32_t) ((long) dt * part / span);
+      }
+      return m_when[m_newest];
+    }
+
+};
+
+#endif
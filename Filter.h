@@ -1,44 +1,210 @@
 #ifndef _FILTER__H_
 #define _FILTER__H_
 
+#include <assert.h>
+
 // First-order low-pass filter to smooth data values from range sensors
+//
+// Moving average over the most recent samples.  Samples are kept in a
+// circular buffer along with their running sum, so each new sample costs
+// one subtract and one add regardless of window length.
+//
+// FixedFilter, EmaFilter and MedianFilter share one interface, filter()
+// and fill(), and any of them can be a Sensor's filter policy.
 
-template<typename T>
+// Window length set at run time, up to MAXN samples.  The buffer is part
+// of the object, so a Filter can be placed by value, and its size is
+// given wherever one is declared.
+template<typename T, size_t MAXN>
 class Filter {
 
   private:
     const size_t m_nsamps;  // number of samples to average over
-    T* m_buffer;            // (pointer to) buffer of samples
+    T m_buffer[MAXN];       // buffer of samples
+    size_t m_index;         // position of oldest sample in buffer
+    T m_sum;                // sum of samples in buffer
 
   public:
     // Constructor
-    Filter(const size_t nsamps) : m_nsamps(nsamps), m_buffer(new T[nsamps]) {
-      // Allocate and clear samples buffer.
-      T* ptr = m_buffer;
-      size_t n = m_nsamps;
-      while (n--) {
-        *ptr++ = (T) 0;
+    // A window longer than MAXN is a mistake in the caller, caught by the
+    // assert; built without asserts, it is cut to MAXN rather than
+    // overrunning the buffer.
+    Filter(const size_t nsamps) :
+      m_nsamps(nsamps < 1 ? 1 : (nsamps > MAXN ? MAXN : nsamps)), m_index(0), m_sum((T) 0) {
+      static_assert(MAXN >= 1, "Filter needs room for a sample");
+      assert(nsamps <= MAXN);
+      // Clear samples buffer.
+      for (size_t i = 0; i < m_nsamps; ++i) {
+        m_buffer[i] = (T) 0;
       }
     }
 
     // Add new sample to filter and calculate new filtered output.
     T filter(const T samp) {
-      // Going to move current samples down one position,
-      // discarding oldest sample and appending newest sample.
-      T* sptr = m_buffer + 1;   // source pointer
-      T* dptr = m_buffer;       // destination pointer
-      size_t n = m_nsamps;      // number of samples
-      T sum = (T) 0;            // running sum
-      while (n--) {
-        // Either move sample down, or append new one.
-        *dptr = (n == 0) ? samp : *sptr++;
-        // Add sample to running sum.
-        sum += *dptr++;
+      // Replace oldest sample with newest one, adjusting running sum.
+      m_sum -= m_buffer[m_index];
+      m_sum += samp;
+      m_buffer[m_index] = samp;
+      if (++m_index == m_nsamps) {
+        m_index = 0;
       }
       // Return average of stored samples.
-      return (sum / m_nsamps);
+      return (m_sum / m_nsamps);
+    }
+
+    // Fill every sample with one value, as if it had been steady forever.
+    void fill(const T samp) {
+      for (size_t i = 0; i < m_nsamps; ++i) {
+        m_buffer[i] = samp;
+      }
+      m_sum = samp * (T) m_nsamps;
     }
   
 };
 
+// Same filter with window length fixed at compile time.
+// The buffer is sized statically, and when N is a power of two the
+// compiler reduces the divide by N to a shift.
+template<typename T, size_t N>
+class FixedFilter {
+
+  private:
+    T m_buffer[N];          // buffer of samples
+    size_t m_index;         // position of oldest sample in buffer
+    T m_sum;                // sum of samples in buffer
+
+  public:
+    // Constructor
+    FixedFilter() : m_index(0), m_sum((T) 0) {
+      for (size_t i = 0; i < N; ++i) {
+        m_buffer[i] = (T) 0;
+      }
+    }
+
+    // Add new sample to filter and calculate new filtered output.
+    T filter(const T samp) {
+      m_sum -= m_buffer[m_index];
+      m_sum += samp;
+      m_buffer[m_index] = samp;
+      if (++m_index == N) {
+        m_index = 0;
+      }
+      return (m_sum / (T) N);
+    }
+
+    // Fill every sample with one value, as if it had been steady forever.
+    void fill(const T samp) {
+      for (size_t i = 0; i < N; ++i) {
+        m_buffer[i] = samp;
+      }
+      m_sum = samp * (T) N;
+    }
+
+};
+
+// Exponential moving average, each output moving 1/2^SHIFT of the way
+// to the new sample, in shifts and adds.  The average is held SHIFT bits
+// finer than the samples, so it settles exactly on a steady input, and T
+// must hold a sample shifted left by SHIFT.  It follows a step faster
+// than a mean of comparable smoothing, but an outlier still moves it by
+// 1/2^SHIFT of its error.
+template<typename T, unsigned SHIFT>
+class EmaFilter {
+
+  private:
+    T m_acc;                // average times 2^SHIFT
+
+  public:
+    // Constructor
+    EmaFilter() : m_acc((T) 0) {}
+
+    // Add new sample to filter and calculate new filtered output.
+    T filter(const T samp) {
+      m_acc = m_acc - (m_acc >> SHIFT) + samp;
+      return m_acc >> SHIFT;
+    }
+
+    // Fill every sample with one value, as if it had been steady forever.
+    void fill(const T samp) {
+      m_acc = samp << SHIFT;
+    }
+
+};
+
+// Median of the last N samples, lower median if N is even.  A lone
+// outlier, or any run shorter than half the window, is ignored outright,
+// and a step passes through unsmeared, (N - 1) / 2 samples late.
+//
+// Samples are counted in a Fenwick tree indexed by value, so one sample
+// in and one out is a pair of O(VBITS) updates, and the median is found
+// by walking down the tree in O(VBITS), whatever N.  Values from 0 to
+// 2^VBITS - 1 are kept; larger ones count as 2^VBITS - 1, which for the
+// default is the VL6180X's "no target".  The tree takes 2^VBITS bytes.
+template<typename T, size_t N, unsigned VBITS = 8>
+class MedianFilter {
+
+  private:
+    static const size_t VALUES = (size_t) 1 << VBITS;
+
+    T m_buffer[N];            // buffer of samples, clamped
+    size_t m_index;           // position of oldest sample in buffer
+    uint8_t m_tree[VALUES];   // node k - 1: samples in its range of values
+
+    // Clamp a sample to the values counted.
+    static T clamp(const T samp) {
+      return (samp < (T) (VALUES - 1)) ? samp : (T) (VALUES - 1);
+    }
+
+    // Add delta (mod 256) to the count of value v.
+    void count(const T v, const uint8_t delta) {
+      for (size_t k = (size_t) v + 1; k <= VALUES; k += k & (~k + 1)) {
+        m_tree[k - 1] += delta;
+      }
+    }
+
+    // Smallest value with at least rank samples at or below it.
+    T select(uint8_t rank) const {
+      size_t pos = 0;
+      for (size_t step = VALUES; step > 0; step >>= 1) {
+        if (pos + step <= VALUES && m_tree[pos + step - 1] < rank) {
+          pos += step;
+          rank -= m_tree[pos - 1];
+        }
+      }
+      return (T) pos;
+    }
+
+  public:
+    // Constructor
+    MedianFilter() : m_index(0) {
+      static_assert(N >= 1 && N < 256, "MedianFilter counts samples in bytes");
+      fill((T) 0);
+    }
+
+    // Add new sample to filter and calculate new filtered output.
+    T filter(const T samp) {
+      T v = clamp(samp);
+      count(m_buffer[m_index], 0xFF);
+      count(v, 1);
+      m_buffer[m_index] = v;
+      if (++m_index == N) {
+        m_index = 0;
+      }
+      return select((uint8_t) ((N + 1) / 2));
+    }
+
+    // Fill every sample with one value, as if it had been steady forever.
+    void fill(const T samp) {
+      T v = clamp(samp);
+      for (size_t i = 0; i < N; ++i) {
+        m_buffer[i] = v;
+      }
+      for (size_t k = 0; k < VALUES; ++k) {
+        m_tree[k] = 0;
+      }
+      count(v, (uint8_t) N);
+    }
+
+};
+
 #endif
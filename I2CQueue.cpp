@@ -0,0 +1,228 @@
+#include "I2CQueue.h"
+
+#include <util/twi.h>
+
+// The Wire library owns the TWI interrupt vector, so the queue drives the
+// TWI hardware by polling TWINT instead.  Every register write below
+// leaves TWIE clear, so Wire's interrupt handler stays out of the way;
+// Wire itself may be used between transfers, once idle() is true.
+
+// Steps of a transfer on the bus
+enum E_Phase {
+  eWaitStop,        // waiting for previous STOP to finish
+  eStart,           // START sent
+  eAddrWrite,       // address sent for writing
+  eWrite,           // data byte sent
+  eRestart,         // repeated START sent
+  eAddrRead,        // address sent for reading
+  eRead             // data byte being received
+};
+
+#define TWI_GO   (_BV(TWINT) | _BV(TWEN))
+
+// Most reads of TWCR spent waiting for a START or STOP, which takes a bit
+// time or two (about 20 usec at 100 kHz on a 16 MHz AVR)
+#define TWI_SPIN 64
+
+I2CQueue i2c_queue;
+
+// Wait, for no more than TWI_SPIN reads, until the TWCR bits in mask
+// equal want.  Returns true if they do.
+static bool spin(const uint8_t mask, const uint8_t want) {
+  for (uint8_t n = 0; n < TWI_SPIN; ++n) {
+    if ((TWCR & mask) == want) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Constructor
+I2CQueue::I2CQueue() :
+  m_head(0),
+  m_count(0),
+  m_phase(eWaitStop),
+  m_index(0),
+  m_max_count(0),
+  m_completed(0L),
+  m_failed(0L)
+{
+}
+
+// Private method
+// Send STOP and retire the transfer on the bus.
+void I2CQueue::finish(const uint8_t status) {
+  TWCR = TWI_GO | _BV(TWSTO);
+  m_queue[m_head]->status = status;
+  if (status == I2CTransfer::eDone) {
+    ++m_completed;
+  } else {
+    ++m_failed;
+  }
+  m_head = (m_head + 1) % I2C_QUEUE_DEPTH;
+  --m_count;
+  m_phase = eWaitStop;
+}
+
+// Set bit rate and enable TWI.
+void I2CQueue::begin(const uint32_t clock_hz) {
+  TWSR &= ~(_BV(0) | _BV(1));             // prescaler 1
+  TWBR = ((F_CPU / clock_hz) - 16) / 2;
+  TWCR = _BV(TWEN);
+}
+
+// Queue a transfer.
+// Returns false, leaving the transfer untouched, if the queue is full.
+bool I2CQueue::post(I2CTransfer* xfer) {
+  if (m_count >= I2C_QUEUE_DEPTH) {
+    return false;
+  }
+  xfer->status = I2CTransfer::eQueued;
+  m_queue[(m_head + m_count) % I2C_QUEUE_DEPTH] = xfer;
+  ++m_count;
+  if (m_count > m_max_count) {
+    m_max_count = m_count;
+  }
+  return true;
+}
+
+// Move transfers on as far as the hardware allows.  A START, repeated
+// START or STOP is waited for, since it is over long before the next pass
+// of loop() and would otherwise cost a whole pass of bus time; a byte,
+// which takes 9 bit times, is left to the next call.
+// Returns true if transfers remain queued or on the bus.
+bool I2CQueue::poll() {
+
+  while (m_count > 0) {
+
+    I2CTransfer* x = m_queue[m_head];
+
+    if (m_phase == eWaitStop) {
+      // Previous STOP must be off the bus before the next START.
+      if (!spin(_BV(TWSTO), 0)) {
+        return true;
+      }
+      x->status = I2CTransfer::eActive;
+      m_index = 0;
+      m_phase = eStart;
+      TWCR = TWI_GO | _BV(TWSTA);
+      continue;
+    }
+
+    // Is hardware still busy with last step?
+    bool start = (m_phase == eStart || m_phase == eRestart);
+    if (!(TWCR & _BV(TWINT)) && !(start && spin(_BV(TWINT), _BV(TWINT)))) {
+      return true;
+    }
+
+    uint8_t st = TW_STATUS;
+    switch (m_phase) {
+
+      case eStart:
+        if (st != TW_START) {
+          finish(I2CTransfer::eFailed);
+        } else if (x->ntx > 0) {
+          TWDR = (x->addr << 1) | TW_WRITE;
+          m_phase = eAddrWrite;
+          TWCR = TWI_GO;
+        } else {
+          TWDR = (x->addr << 1) | TW_READ;
+          m_phase = eAddrRead;
+          TWCR = TWI_GO;
+        }
+        break;
+
+      case eAddrWrite:
+      case eWrite:
+        if (st != ((m_phase == eAddrWrite) ? TW_MT_SLA_ACK : TW_MT_DATA_ACK)) {
+          finish(I2CTransfer::eFailed);
+        } else if (m_index < x->ntx) {
+          TWDR = x->tx[m_index++];
+          m_phase = eWrite;
+          TWCR = TWI_GO;
+        } else if (x->nrx > 0) {
+          m_phase = eRestart;
+          TWCR = TWI_GO | _BV(TWSTA);
+        } else {
+          finish(I2CTransfer::eDone);
+        }
+        break;
+
+      case eRestart:
+        if (st != TW_REP_START) {
+          finish(I2CTransfer::eFailed);
+        } else {
+          TWDR = (x->addr << 1) | TW_READ;
+          m_phase = eAddrRead;
+          TWCR = TWI_GO;
+        }
+        break;
+
+      case eAddrRead:
+        if (st != TW_MR_SLA_ACK) {
+          finish(I2CTransfer::eFailed);
+        } else {
+          // ACK every byte but the last.
+          m_index = 0;
+          m_phase = eRead;
+          TWCR = TWI_GO | ((x->nrx > 1) ? _BV(TWEA) : 0);
+        }
+        break;
+
+      case eRead:
+        if (st != TW_MR_DATA_ACK && st != TW_MR_DATA_NACK) {
+          finish(I2CTransfer::eFailed);
+        } else {
+          x->rx[m_index++] = TWDR;
+          if (m_index < x->nrx) {
+            TWCR = TWI_GO | ((m_index < x->nrx - 1) ? _BV(TWEA) : 0);
+          } else {
+            finish(I2CTransfer::eDone);
+          }
+        }
+        break;
+
+    }
+
+  }
+  return false;
+
+}
+
+// Wait until every queued transfer has completed and the bus is free.
+void I2CQueue::flush() {
+  while (!idle()) {
+    poll();
+  }
+}
+
+// Return true if no transfers are queued or on the bus, not even the
+// last one's STOP.
+bool I2CQueue::idle() const {
+  return m_count == 0 && !(TWCR & _BV(TWSTO));
+}
+
+// Get number of transfers which can still be posted.
+uint8_t I2CQueue::space() const {
+  return I2C_QUEUE_DEPTH - m_count;
+}
+
+// Get number of transfers queued, including one on the bus.
+uint8_t I2CQueue::depth() const {
+  return m_count;
+}
+
+// Get most transfers that have been queued at once.
+uint8_t I2CQueue::maxDepth() const {
+  return m_max_count;
+}
+
+// Get number of transfers completed.
+uint32_t I2CQueue::completed() const {
+  return m_completed;
+}
+
+// Get number of transfers that failed.
+uint32_t I2CQueue::failed() const {
+  return m_failed;
+}
@@ -0,0 +1,73 @@
+#ifndef _I2C_QUEUE__H_
+#define _I2C_QUEUE__H_
+
+#include <Arduino.h>
+
+// Most transfers a sensor queues for one sample: range read and interrupt
+// clear, and range status and convergence time reads while tuning
+#define I2C_SENSOR_TRANSFERS 4
+
+// Most transfers waiting or in progress at once: room for one sensor's
+// sample to wait while another's is on the bus.  Any more only wait
+// longer, since the bus sets how many samples can be read.
+#define I2C_QUEUE_DEPTH (2 * I2C_SENSOR_TRANSFERS)
+
+// One I2C transfer: write ntx bytes from tx then, if nrx is not zero,
+// read nrx bytes into rx after a repeated START.  The poster owns the
+// transfer and its buffers, which must stay put until done().
+struct I2CTransfer {
+  enum E_Status {
+    eIdle,            // never posted
+    eQueued,          // waiting for the bus
+    eActive,          // on the bus
+    eDone,            // completed
+    eFailed           // NACKed or bus error
+  };
+  const uint8_t* tx;  // bytes to write
+  uint8_t* rx;        // buffer for bytes read
+  uint8_t addr;       // 7-bit I2C address
+  uint8_t ntx;        // number of bytes to write
+  uint8_t nrx;        // number of bytes to read
+  uint8_t status;     // E_Status
+
+  bool done() const { return status == eDone || status == eFailed || status == eIdle; }
+  bool ok() const { return status == eDone; }
+};
+
+// First-in first-out queue of I2C transfers, run by the TWI hardware
+// without blocking.  poll() must be called often (once per pass of loop()
+// is enough); each call moves the current transfer on by whatever steps
+// the hardware has finished, and returns at once.
+class I2CQueue {
+
+  private:
+    I2CTransfer* m_queue[I2C_QUEUE_DEPTH];
+    uint8_t m_head;           // index of oldest transfer
+    uint8_t m_count;          // transfers queued, including one on the bus
+    uint8_t m_phase;          // step of current transfer on the bus
+    uint8_t m_index;          // bytes moved so far in current transfer
+    uint8_t m_max_count;      // high-water mark of m_count
+    uint32_t m_completed;     // transfers completed
+    uint32_t m_failed;        // transfers failed
+
+    void finish(const uint8_t status);
+
+  public:
+    I2CQueue();
+    void begin(const uint32_t clock_hz = 100000);
+    bool post(I2CTransfer* xfer);
+    bool poll();
+    void flush();
+    bool idle() const;
+    uint8_t space() const;
+    uint8_t depth() const;
+    uint8_t maxDepth() const;
+    uint32_t completed() const;
+    uint32_t failed() const;
+
+};
+
+// Transfer queue for the TWI bus
+extern I2CQueue i2c_queue;
+
+#endif
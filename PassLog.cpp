@@ -0,0 +1,208 @@
+#include "PassLog.h"
+
+#include "Speedometer.h"
+
+// Fields of a record, low byte written first
+#define LOG_SECS      0x00007FFFUL    // bits 0-14: time since the pass before (sec)
+#define LOG_SPEED_LSB 15              // bits 15-26: speed
+#define LOG_REVERSE   0x08000000UL    // bit 27: sensor 0 crossed last
+#define LOG_BOOT      0x10000000UL    // bit 28: first pass since power-up
+#define LOG_TRACK_LSB 29              // bits 29-30: track
+#define LOG_PHASE     0x80000000UL    // bit 31: lap of the ring
+
+// An erased slot, which no record can match: its speed would be 4095
+#define LOG_ERASED    0xFFFFFFFFUL
+
+// EEPROM address of a slot
+#define LOG_SLOT_ADDR(s) (LOG_EEPROM_ADDR + 1 + (s) * LOG_RECORD)
+
+#if SRAM_REPORT
+// Report SRAM taken by the pass log at build time (SramReport.h).
+static void __attribute__((unused)) sram_report() {
+  SRAM_REPORT_TYPE(PassLog);
+}
+#endif
+
+// Constructor
+PassLog::PassLog() :
+  m_queued(0),
+  m_next(0),
+  m_head(0),
+  m_count(0),
+  m_phase(false),
+  m_mark(false),
+  m_booted(false),
+  m_last_msec(0L),
+  m_lost(0)
+{
+  memset(m_queue, 0, sizeof m_queue);
+}
+
+// Private method
+// Read the record in a slot.
+uint32_t PassLog::readSlot(const uint16_t s) const {
+  uint32_t rec = 0;
+  for (uint8_t i = 0; i < LOG_RECORD; ++i) {
+    rec |= (uint32_t) EEPROM.read(LOG_SLOT_ADDR(s) + i) << (8 * i);
+  }
+  return rec;
+}
+
+// Find the head of the ring left by earlier runs.  The first lap writes
+// phase 0 over erased cells, which read as phase 1, and each later lap
+// the other phase, so the head is the first slot whose phase is not slot
+// 0's; if there is none, a lap has just been finished.
+void PassLog::begin() {
+  m_queued = 0;
+  m_next = 0;
+  m_booted = false;
+  m_lost = 0;
+  m_mark = false;
+  uint32_t first = readSlot(0);
+  if (first == LOG_ERASED) {
+    m_head = 0;
+    m_count = 0;
+    m_phase = false;
+    return;
+  }
+  bool p0 = (first & LOG_PHASE) != 0;
+  uint16_t s = 1;
+  while (s < LOG_RECORDS && ((EEPROM.read(LOG_SLOT_ADDR(s) + LOG_RECORD - 1) & 0x80) != 0) == p0) {
+    ++s;
+  }
+  // The flag may have been lost to a power cut just after the first
+  // wrap, but then the last slot is written and is not the head.  A
+  // whole lap of phase 1 with no flag is slot 0 cut short on the first.
+  bool flagged = EEPROM.read(LOG_EEPROM_ADDR) != 0xFF;
+  bool wrapped = flagged || (s == LOG_RECORDS && !p0)
+    || (s < LOG_RECORDS - 1 && readSlot(LOG_RECORDS - 1) != LOG_ERASED);
+  m_phase = p0;
+  m_head = s;
+  if (s == LOG_RECORDS) {
+    m_phase = !p0;
+    m_head = 0;
+  }
+  m_count = wrapped ? LOG_RECORDS : m_head;
+  m_mark = wrapped && !flagged;
+}
+
+// Queue a pass measured just now on track t, for update() to write.
+// Returns false, and counts the pass lost, if the queue is full.
+bool PassLog::add(const uint8_t t, const int8_t direction, const uint16_t speed) {
+  if (m_queued == LOG_QUEUE) {
+    ++m_lost;
+    return false;
+  }
+  // Whole seconds since the last pass, the fraction carried to the
+  // next, so the times add up to the time since power-up.
+  uint32_t now = millis();
+  uint32_t secs = (now - m_last_msec) / 1000;
+  if (secs > LOG_MAX_SECS) {
+    secs = LOG_MAX_SECS;
+    m_last_msec = now;
+  } else {
+    m_last_msec += secs * 1000;
+  }
+  uint32_t rec = secs;
+  rec |= (uint32_t) (speed < LOG_MAX_SPEED ? speed : LOG_MAX_SPEED) << LOG_SPEED_LSB;
+  rec |= (direction < 0) ? LOG_REVERSE : 0;
+  rec |= m_booted ? 0 : LOG_BOOT;
+  rec |= (uint32_t) (t & 0x03) << LOG_TRACK_LSB;
+  m_booted = true;
+  m_queue[m_queued++] = rec;
+  return true;
+}
+
+// Write the next byte waiting, if the EEPROM is ready.  Returns true
+// when the last byte of a record has been written.
+bool PassLog::update() {
+  // Never wait on the EEPROM; a byte takes 3.3 msec to write.
+  if (!eeprom_is_ready()) {
+    return false;
+  }
+  if (m_mark) {
+    EEPROM.update(LOG_EEPROM_ADDR, 0x00);
+    m_mark = false;
+    return false;
+  }
+  if (m_queued == 0) {
+    return false;
+  }
+  uint32_t rec = m_queue[0] | (m_phase ? LOG_PHASE : 0);
+  EEPROM.update(LOG_SLOT_ADDR(m_head) + m_next, (uint8_t) (rec >> (8 * m_next)));
+  if (++m_next < LOG_RECORD) {
+    return false;
+  }
+  m_next = 0;
+  for (uint8_t i = 1; i < m_queued; ++i) {
+    m_queue[i - 1] = m_queue[i];
+  }
+  --m_queued;
+  if (m_count < LOG_RECORDS) {
+    ++m_count;
+  }
+  if (++m_head == LOG_RECORDS) {
+    m_head = 0;
+    m_phase = !m_phase;
+    m_mark = EEPROM.read(LOG_EEPROM_ADDR) == 0xFF;
+  }
+  return true;
+}
+
+// Get number of records in EEPROM.  The oldest is not counted while it
+// is being overwritten.
+uint16_t PassLog::records() const {
+  return (m_count == LOG_RECORDS && m_next > 0) ? m_count - 1 : m_count;
+}
+
+// Get record i, 0 being the oldest.
+PassRecord PassLog::record(const uint16_t i) const {
+  uint16_t s = (m_head + LOG_RECORDS - records() + i) % LOG_RECORDS;
+  uint32_t rec = readSlot(s);
+  PassRecord pr;
+  pr.boot = (rec & LOG_BOOT) != 0;
+  pr.secs = (uint16_t) (rec & LOG_SECS);
+  pr.track = (uint8_t) ((rec >> LOG_TRACK_LSB) & 0x03);
+  pr.direction = (rec & LOG_REVERSE) ? -1 : 1;
+  pr.speed = (uint16_t) ((rec >> LOG_SPEED_LSB) & 0x0FFF);
+  return pr;
+}
+
+// Get number of passes waiting to be written.
+uint8_t PassLog::pending() const {
+  return m_queued;
+}
+
+// Get number of passes lost since begin() to a full queue.
+uint16_t PassLog::lost() const {
+  return m_lost;
+}
+
+// Print the whole log to Serial as CSV, oldest first, with speeds in
+// the units they were shown in.
+void PassLog::dump() const {
+  Serial.print(F("pass log: "));
+  Serial.print(records());
+  Serial.print(F(" passes, "));
+  Serial.print(pending());
+  Serial.print(F(" waiting, "));
+  Serial.print(lost());
+  Serial.println(F(" lost"));
+  Serial.println(F("pass,boot,secs,track,direction,speed"));
+  for (uint16_t i = 0; i < records(); ++i) {
+    PassRecord pr = record(i);
+    Serial.print(i);
+    Serial.print(',');
+    Serial.print(pr.boot ? 1 : 0);
+    Serial.print(',');
+    Serial.print(pr.secs);
+    Serial.print(',');
+    Serial.print(pr.track);
+    Serial.print(',');
+    Serial.print((int) pr.direction);
+    Serial.print(',');
+    Serial.print(pr.speed / SPEED_FRAC);
+    Serial.print('.');
+    Serial.println(pr.speed % SPEED_FRAC);
+  }
+}
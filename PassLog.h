@@ -0,0 +1,80 @@
+#ifndef _PASSLOG__H_
+#define _PASSLOG__H_
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+#include "SramReport.h"
+
+// EEPROM address of the pass log, clear of the Calibrator's record.  The
+// first byte flags a log which has wrapped; the records follow it.
+#define LOG_EEPROM_ADDR 16
+
+// Bytes of each record
+#define LOG_RECORD 4
+
+// Records held: the rest of the EEPROM, 251 on an ATmega328P and 1019
+// on a Mega 2560
+#define LOG_RECORDS ((E2END + 1 - LOG_EEPROM_ADDR - 1) / LOG_RECORD)
+
+// Records waiting in SRAM to be written
+#define LOG_QUEUE 4
+
+// Largest time between records, and largest speed (1/SPEED_FRAC units),
+// a record can hold; longer times and higher speeds are saved as these
+#define LOG_MAX_SECS 0x7FFF
+#define LOG_MAX_SPEED 4094
+
+// One pass read back from the log
+struct PassRecord {
+  bool boot;            // first pass since power-up
+  uint16_t secs;        // time since the pass before, or since power-up if boot (sec)
+  uint8_t track;        // track the pass was on
+  int8_t direction;     // +1 if sensor 0 was crossed first, -1 if last
+  uint16_t speed;       // measured speed (1/SPEED_FRAC scale mi/hr or km/hr)
+};
+
+// Log of measured speeds kept in EEPROM across power cycles, as a ring
+// of 4-byte records overwritten oldest first, so every cell is written
+// once per lap of the ring and wears evenly.  A record holds the time
+// since the pass before in whole seconds (15 bits, with the fraction
+// carried on so times add up), the speed (12 bits), direction, track
+// (2 bits), a flag for the first pass since power-up, and a phase bit
+// which flips on each lap; the head of the ring is where the phase
+// changes, so nothing else need be written to find it.
+//
+// add() queues a pass in SRAM; update() writes a byte at a time, and
+// only when the EEPROM is ready, so it can run from loop() between
+// samples.  Each record's phase byte is written last, so one cut short
+// by a power loss is not taken as written, except when it was
+// overwriting the oldest record, which then reads back wrong.
+class PassLog {
+
+  private:
+    uint32_t m_queue[LOG_QUEUE];  // records waiting, oldest first
+    uint8_t m_queued;             // number of m_queue waiting
+    uint8_t m_next;               // byte of m_queue[0] next written
+    uint16_t m_head;              // slot next written
+    uint16_t m_count;             // records in EEPROM
+    bool m_phase;                 // phase bit of this lap's records
+    bool m_mark;                  // wrapped flag still to be written
+    bool m_booted;                // a pass added since power-up
+    uint32_t m_last_msec;         // time the last pass is counted from (msec)
+    uint16_t m_lost;              // passes lost to a full queue
+
+    uint32_t readSlot(const uint16_t s) const;
+
+  public:
+    PassLog();
+    void begin();
+    bool add(const uint8_t t, const int8_t direction, const uint16_t speed);
+    bool update();
+    uint16_t records() const;
+    PassRecord record(const uint16_t i) const;
+    uint8_t pending() const;
+    uint16_t lost() const;
+    void dump() const;
+
+};
+
+#endif
@@ -0,0 +1,166 @@
+#include "Profile.h"
+
+#if PROFILE
+
+Profile profile;
+
+// Constructor
+Profile::Profile() {
+  reset();
+}
+
+// Clear every counter.
+void Profile::reset() {
+  memset(m_state, 0, sizeof m_state);
+  memset(m_timing, 0, sizeof m_timing);
+  memset(m_late, 0, sizeof m_late);
+  memset(m_age, 0, sizeof m_age);
+  noInterrupts();
+  for (uint8_t i = 0; i < eNumDrops; ++i) {
+    m_drops[i] = 0L;
+  }
+  interrupts();
+  m_tick_due = 0L;
+  m_ticking = false;
+  m_since = millis();
+}
+
+// Private method
+// Add one run of a timed section.
+void Profile::add(ProfileTiming& pt, const uint32_t usec) {
+  if (pt.total_usec & 0x80000000UL) {
+    pt.total_usec >>= 1;
+    pt.count >>= 1;
+  }
+  pt.total_usec += usec;
+  ++pt.count;
+  if (usec > pt.max_usec) {
+    pt.max_usec = usec;
+  }
+}
+
+// Private method
+// Histogram bucket for a time (usec).
+uint8_t Profile::bucket(const uint32_t usec) {
+  uint32_t u = usec >> 6;
+  uint8_t b = 0;
+  while (u != 0 && b < PROFILE_BUCKETS - 1) {
+    u >>= 1;
+    ++b;
+  }
+  return b;
+}
+
+// Note a state machine tick, due every period_usec.  The first tick sets
+// the phase; after that each tick is due one period after the last was.
+// StateMachine counts in msec, so lateness under 1 msec is only jitter.
+void Profile::tick(const uint32_t now_usec, const uint32_t period_usec) {
+  if (m_ticking) {
+    int32_t late = (int32_t) (now_usec - m_tick_due);
+    ++m_late[bucket(late < 0 ? 0 : (uint32_t) late)];
+    m_tick_due += period_usec;
+  } else {
+    m_tick_due = now_usec + period_usec;
+    m_ticking = true;
+  }
+}
+
+// Get timing of one Speedometer state.
+ProfileTiming Profile::state(const uint8_t s) const {
+  return m_state[s];
+}
+
+// Get timing of one other section.
+ProfileTiming Profile::timing(const E_Timing which) const {
+  return m_timing[which];
+}
+
+// Get number of ticks which ran late by less than bucketLimit(b).
+uint32_t Profile::lateness(const uint8_t b) const {
+  return m_late[b];
+}
+
+// Get number of samples taken when younger than bucketLimit(b).
+uint32_t Profile::age(const uint8_t b) const {
+  return m_age[b];
+}
+
+// Get number of samples lost for one reason.
+uint32_t Profile::drops(const E_Drop why) const {
+  noInterrupts();
+  uint32_t n = m_drops[why];
+  interrupts();
+  return n;
+}
+
+// Get time counting began (msec).
+uint32_t Profile::since() const {
+  return m_since;
+}
+
+// Get upper limit of a histogram bucket (usec), or 0 for the last,
+// which has none.
+uint32_t Profile::bucketLimit(const uint8_t b) {
+  return (b < PROFILE_BUCKETS - 1) ? (64UL << b) : 0L;
+}
+
+// Print one timing as "name: n runs, mean m, max x usec".
+static void print_timing(const __FlashStringHelper* name, const ProfileTiming& pt) {
+  Serial.print(name);
+  Serial.print(F(": "));
+  Serial.print(pt.count);
+  Serial.print(F(" runs, mean "));
+  Serial.print(pt.mean_usec());
+  Serial.print(F(", max "));
+  Serial.print(pt.max_usec);
+  Serial.println(F(" usec"));
+}
+
+// Print one histogram, a bucket per line.
+static void print_histogram(const __FlashStringHelper* name, const uint32_t* hist) {
+  Serial.println(name);
+  for (uint8_t b = 0; b < PROFILE_BUCKETS; ++b) {
+    uint32_t lim = Profile::bucketLimit(b);
+    if (lim != 0) {
+      Serial.print(F("  < "));
+      Serial.print(lim);
+    } else {
+      Serial.print(F("  >= "));
+      Serial.print(Profile::bucketLimit(b - 1));
+    }
+    Serial.print(F(" usec: "));
+    Serial.println(hist[b]);
+  }
+}
+
+// Print one drop counter as "name: n".
+static void print_count(const __FlashStringHelper* name, const uint32_t n) {
+  Serial.print(name);
+  Serial.print(F(": "));
+  Serial.println(n);
+}
+
+// Names are spelt out call by call so that they stay in flash.
+void Profile::dump() const {
+  Serial.print(F("profile over "));
+  Serial.print(millis() - m_since);
+  Serial.println(F(" msec"));
+  print_timing(F("clear"), m_state[0]);
+  print_timing(F("senseA"), m_state[1]);
+  print_timing(F("senseB"), m_state[2]);
+  print_timing(F("updated"), m_state[3]);
+  print_timing(F("active"), m_state[4]);
+  print_timing(F("clearing"), m_state[5]);
+  print_timing(F("update"), m_timing[eUpdate]);
+  print_timing(F("trigger"), m_timing[eTrigger]);
+  print_timing(F("request"), m_timing[eRequest]);
+  print_timing(F("read"), m_timing[eRead]);
+  print_histogram(F("tick lateness"), m_late);
+  print_histogram(F("sample age"), m_age);
+  print_count(F("overrun"), drops(eOverrun));
+  print_count(F("stale"), drops(eStale));
+  print_count(F("failed"), drops(eFailed));
+  print_count(F("queue full"), drops(eQueueFull));
+}
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef _PROFILE__H_
+#define _PROFILE__H_
+
+#include <Arduino.h>
+
+// Set to 0 to compile the hot-path counters out altogether.
+#ifndef PROFILE
+#define PROFILE 1
+#endif
+
+// Number of Speedometer states timed (E_State values)
+#define PROFILE_STATES 6
+
+// Histogram buckets: bucket i counts times below (64 << i) usec, and the
+// last one everything longer
+#define PROFILE_BUCKETS 8
+
+// Count, mean and longest of one timed section.  When the total reaches
+// 2^31 usec, total and count are both halved, so the mean stays good
+// however long the sketch runs.
+struct ProfileTiming {
+  uint32_t count;       // times section ran (halved with total)
+  uint32_t total_usec;  // time spent in section (usec)
+  uint32_t max_usec;    // longest single run (usec)
+
+  uint32_t mean_usec() const { return count ? total_usec / count : 0; }
+};
+
+// Counters cheap enough to leave running in production, taken with
+// micros() (4 usec resolution on a 16 MHz AVR): time spent in each
+// state of the Speedometer's state machine, time in each kind of sensor
+// I2C call, how late each state machine tick ran, how old each sample
+// was when it was taken, and samples lost.
+class Profile {
+
+  public:
+    // Timed sections other than states
+    enum E_Timing {
+      eUpdate,          // whole Speedometer::update() call
+      eTrigger,         // Sensor::trigger(): start a measurement
+      eRequest,         // Sensor::request_distance(): post or do the read
+      eRead,            // from request_distance() until the distance is in
+      eNumTimings
+    };
+    // Reasons samples are lost
+    enum E_Drop {
+      eOverrun,         // sensor flagged a sample before the last was read
+      eStale,           // continuous-mode read finished a period late
+      eFailed,          // read failed on the bus or in the driver
+      eQueueFull,       // trigger or sample's read refused, I2C queue full
+      eNumDrops
+    };
+
+  private:
+    ProfileTiming m_state[PROFILE_STATES];
+    ProfileTiming m_timing[eNumTimings];
+    uint32_t m_late[PROFILE_BUCKETS];     // tick lateness histogram
+    uint32_t m_age[PROFILE_BUCKETS];      // sample age histogram
+    volatile uint32_t m_drops[eNumDrops];
+    uint32_t m_tick_due;                  // time next tick is due (usec)
+    bool m_ticking;                       // m_tick_due is set
+    uint32_t m_since;                     // time of reset() (msec)
+
+    static void add(ProfileTiming& pt, const uint32_t usec);
+    static uint8_t bucket(const uint32_t usec);
+
+  public:
+    Profile();
+    void reset();
+
+    // Recording, on the hot path
+    void addState(const uint8_t state, const uint32_t usec) { add(m_state[state], usec); }
+    void addTiming(const E_Timing which, const uint32_t usec) { add(m_timing[which], usec); }
+    void addAge(const uint32_t usec) { ++m_age[bucket(usec)]; }
+    void addDrop(const E_Drop why) { ++m_drops[why]; }   // safe in an ISR
+    void tick(const uint32_t now_usec, const uint32_t period_usec);
+
+    // Queries
+    ProfileTiming state(const uint8_t s) const;
+    ProfileTiming timing(const E_Timing which) const;
+    uint32_t lateness(const uint8_t b) const;
+    uint32_t age(const uint8_t b) const;
+    uint32_t drops(const E_Drop why) const;
+    uint32_t since() const;
+    static uint32_t bucketLimit(const uint8_t b);
+
+    // Print everything to Serial.  Slow; call from loop() on demand.
+    void dump() const;
+
+};
+
+// Counters for the Speedometer and its sensors
+extern Profile profile;
+
+#endif
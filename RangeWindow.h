@@ -10,25 +10,76 @@ template<typename T>
 class RangeWindow {
 
   private:
-    const SchmittTrigger<T>* m_schmitt_lo; // Schmitt object at low end of range
-    const SchmittTrigger<T>* m_schmitt_hi; // Schmitt object at high end of range
+    SchmittTrigger<T> m_schmitt_lo;   // Schmitt object at low end of range
+    SchmittTrigger<T> m_schmitt_hi;   // Schmitt object at high end of range
 
   public:
     // Constructor
     RangeWindow(const T center, const T hwidth, const T hysteresis) :
-    m_schmitt_lo(new SchmittTrigger<T>(center - hwidth, hysteresis)),
-    m_schmitt_hi(new SchmittTrigger<T>(center + hwidth, hysteresis)) {}
+    m_schmitt_lo(center - hwidth, hysteresis),
+    m_schmitt_hi(center + hwidth, hysteresis) {}
 
     // Determine if value is within defined range, with hysteresis at
     // both ends of range.
     bool within(const T val) {
       // Is value greater than low end of range (with hysteresis)?
-      bool lo = m_schmitt_lo->f(val);
+      bool lo = m_schmitt_lo.f(val);
       // Is value greater than high end of range (with hysteresis)?
-      bool hi = m_schmitt_hi->f(val);
+      bool hi = m_schmitt_hi.f(val);
       // Return true if between low and high ends, false otherwise.
       return lo && !hi;
     }
+
+    // Same as within(val), for an input whose hysteresis state is held
+    // by the caller, so one window can serve several sensors without
+    // one sensor's values shifting another's thresholds.
+    // Arguments:
+    //   val: value to test
+    //   state: hysteresis state of this input, initially 0
+    //     (bit 0: above low end, bit 1: above high end), updated
+    bool within(const T val, uint8_t& state) const {
+      bool lo = m_schmitt_lo.f(val, (state & 0x01) != 0);
+      bool hi = m_schmitt_hi.f(val, (state & 0x02) != 0);
+      state = (lo ? 0x01 : 0x00) | (hi ? 0x02 : 0x00);
+      return lo && !hi;
+    }
+
+    // Move the window, as after calibration.  Inputs whose hysteresis
+    // state is held by the caller keep it.
+    void set(const T center, const T hwidth, const T hysteresis) {
+      m_schmitt_lo.set(center - hwidth, hysteresis);
+      m_schmitt_hi.set(center + hwidth, hysteresis);
+    }
+
+    // Get level crossed by a value entering range from below.
+    T entry_lo() const {
+      return (T) m_schmitt_lo.upper();
+    }
+
+    // Get level crossed by a value entering range from above.
+    T entry_hi() const {
+      return (T) m_schmitt_hi.lower();
+    }
+
+    // Get level crossed by a value leaving range downwards.
+    T exit_lo() const {
+      return (T) m_schmitt_lo.lower();
+    }
+
+    // Get level crossed by a value leaving range upwards.
+    T exit_hi() const {
+      return (T) m_schmitt_hi.upper();
+    }
+
+    // Get the triggers at the low and high ends of range, for code which
+    // tests many values at once against the same levels.
+    const SchmittTrigger<T>& trigger_lo() const {
+      return m_schmitt_lo;
+    }
+
+    const SchmittTrigger<T>& trigger_hi() const {
+      return m_schmitt_hi;
+    }
 };
 
 #endif
@@ -14,8 +14,8 @@ template<typename T>
 class SchmittTrigger {
   
   private:
-    const long m_ref; // reference value
-    const long m_hy;  // hysteresis value
+    long m_ref;       // reference value
+    long m_hy;        // hysteresis value
     bool m_state;     // current output state
     
   public:
@@ -43,17 +43,45 @@ class SchmittTrigger {
     //     or has not been less than (m_ref - m_hy)
     //     since last state change
     bool f(const T val) {
+      // Update and return (possibly changed) state.
+      m_state = f(val, m_state);
+      return m_state;
+    }
+
+    // Same as f(val), for a "Schmitt trigger" whose state is held by
+    // the caller, so one object can serve several inputs.
+    // Arguments:
+    //   val: input value to "Schmitt trigger"
+    //   state: current output state
+    // Returns:
+    //   new output state
+    bool f(const T val, const bool state) const {
       // Check value against hysteresis.  If value is in range
       // [m_ref - m_hy, m_ref + m_hy], state will not change.
       if ((long) val > (m_ref + m_hy)) {
         // State becomes true if value above range.
-        m_state = true;
+        return true;
       } else if ((long) val < (m_ref - m_hy)) {
         // State becomes false if value below range.
-        m_state = false;
+        return false;
       }
-      // Return (possibly updated) state.
-      return m_state;
+      return state;
+    }
+
+    // Move the reference value and hysteresis, keeping the state.
+    void set(const T reference, const T hysteresis) {
+      m_ref = (long) reference;
+      m_hy = (long) hysteresis;
+    }
+
+    // Get level below which state becomes false.
+    long lower() const {
+      return m_ref - m_hy;
+    }
+
+    // Get level above which state becomes true.
+    long upper() const {
+      return m_ref + m_hy;
     }
     
 };
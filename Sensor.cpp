@@ -1,26 +1,93 @@
 #include "Sensor.h"
 
+#include "Profile.h"
+
 #define TRACE 0
 
+// Register writes and reads posted to the transfer queue: 16-bit register
+// index, then any data.
+static const uint8_t START_SINGLE_SHOT[] = { 0x00, 0x18, 0x01 };   // SYSRANGE__START
+static const uint8_t RANGE_VAL[] = { 0x00, 0x62 };                 // RESULT__RANGE_VAL
+static const uint8_t CLEAR_RANGE_INT[] = { 0x00, 0x15, 0x01 };     // SYSTEM__INTERRUPT_CLEAR
+static const uint8_t RANGE_STATUS[] = { 0x00, 0x4D };              // RESULT__RANGE_STATUS
+static const uint8_t RANGE_CONV_TIME[] = { 0x00, 0x7C };           // RESULT__RANGE_RETURN_CONV_TIME
+static const uint8_t MAX_CONV_TIME[] = { 0x00, 0x1C };             // SYSRANGE__MAX_CONVERGENCE_TIME
+
+// Sensor being set up again which is powered at the VL6180X's default
+// address and not yet given its own, or NULL.  Two at once would both
+// take the first one's address.
+static const void* s_addressing = NULL;
+
+// Fill in a transfer to be posted.
+static void setup_transfer(
+    I2CTransfer& x, const byte addr,
+    const uint8_t* tx, const uint8_t ntx, uint8_t* rx, const uint8_t nrx
+) {
+    x.tx = tx;
+    x.rx = rx;
+    x.addr = addr;
+    x.ntx = ntx;
+    x.nrx = nrx;
+    x.status = I2CTransfer::eIdle;
+}
+
 // Constructor
-Sensor::Sensor(
+template<class FILTER>
+BasicSensor<FILTER>::BasicSensor(
     const byte addr, 
     const byte ena_pin, 
     const byte intr_pin,
-    const bool* ready_flag
+    const bool* ready_flag,
+    volatile uint32_t* stamp
 ) : 
-    m_sensor(new VL6180X(&Wire, ena_pin)),
-    m_filter(new Filter<uint32_t>(10)),
+    m_sensor(&Wire, ena_pin),
     m_ready(ready_flag),
+    m_stamp(stamp),
     m_addr(addr),
     m_gpio0(ena_pin),
     m_gpio1(intr_pin),
-    m_dist(NO_READING)
+    m_dist(NO_READING),
+    m_raw(NO_READING),
+    m_continuous(false),
+    m_polled(false),
+    m_pending(false),
+    m_fresh(false),
+    m_held(false),
+    m_primed(false),
+    m_when(0L),
+    m_asked(0L),
+    m_period_usec(0L),
+    m_bus(NULL),
+    m_range(0),
+    m_health(eInService),
+    m_step(eSetupPower),
+    m_failures(0),
+    m_since(0L),
+    m_down_when(0L),
+    m_tuning(false),
+    m_limit_due(false),
+    m_conv_msec(TUNE_START_MSEC),
+    m_error(0xFF),
+    m_conv_usec(0L),
+    m_status_reg(0)
 {
+    memset(&m_stats, 0, sizeof m_stats);
+    memset(m_conv_reg, 0, sizeof m_conv_reg);
+    m_limit_tx[0] = MAX_CONV_TIME[0];
+    m_limit_tx[1] = MAX_CONV_TIME[1];
+    m_limit_tx[2] = TUNE_START_MSEC;
+    setup_transfer(m_start, addr, START_SINGLE_SHOT, sizeof START_SINGLE_SHOT, NULL, 0);
+    setup_transfer(m_read, addr, RANGE_VAL, sizeof RANGE_VAL, &m_range, 1);
+    setup_transfer(m_clear, addr, CLEAR_RANGE_INT, sizeof CLEAR_RANGE_INT, NULL, 0);
+    setup_transfer(m_status, addr, RANGE_STATUS, sizeof RANGE_STATUS, &m_status_reg, 1);
+    setup_transfer(m_conv, addr, RANGE_CONV_TIME, sizeof RANGE_CONV_TIME, m_conv_reg,
+                   sizeof m_conv_reg);
+    setup_transfer(m_limit, addr, m_limit_tx, sizeof m_limit_tx, NULL, 0);
 }
 
 // Set up interrupt handler for sensor's GPIO1 pin.
-void Sensor::setupInterruptHandler(
+template<class FILTER>
+void BasicSensor<FILTER>::setupInterruptHandler(
     const uint8_t irq_pin, 
     void (*irq_func)(), 
     const int value
@@ -28,92 +95,534 @@ void Sensor::setupInterruptHandler(
     attachInterrupt(digitalPinToInterrupt(irq_pin), irq_func, value);
 }
 
-// Initialize sensor and set options.
+// Have is_ready() poll the sensor's GPIO1 pin, for a pin which has no
+// interrupt.  The sample time is then taken when the poll sees it.
+template<class FILTER>
+void BasicSensor<FILTER>::set_polled() {
+    m_polled = true;
+}
+
+// Post trigger and read transfers to a queue instead of blocking in the
+// driver's Wire calls.  Set up with begin() and start_continuous() first,
+// which always block.
+template<class FILTER>
+void BasicSensor<FILTER>::set_bus(I2CQueue* bus) {
+    m_bus = bus;
+}
+
+// Hold sensor in reset, off the I2C bus, until begin() is called.
+template<class FILTER>
+void BasicSensor<FILTER>::shutdown() {
+    m_sensor.begin();
+    m_sensor.VL6180x_Off();
+}
+
+// Initialize sensor and set options.  A sensor which fails is held in
+// reset, and service() tries again later.
 // Returns true only if all steps succeed, false otherwise.
-bool Sensor::begin() {
-    
-    m_sensor->begin();
-    m_sensor->VL6180x_On();
+template<class FILTER>
+bool BasicSensor<FILTER>::begin() {
+    if (!setup()) {
+        hold(micros());
+        return false;
+    }
+    m_since = micros();
+    return true;
+}
+
+// Private method
+// Power sensor up through its enable pin, give it its address, and set
+// options, blocking until done; begin() at start-up.
+// Returns true only if all steps succeed, false otherwise.
+template<class FILTER>
+bool BasicSensor<FILTER>::setup() {
+    for (uint8_t step = eSetupPower; step < eSetupContinuous; ++step) {
+        if (!setup_step(step)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Private method
+// Take one step (E_Setup) of setting the sensor up, a single driver call.
+// Returns true if it succeeds, false otherwise.
+template<class FILTER>
+bool BasicSensor<FILTER>::setup_step(const uint8_t step) {
     
-    if (m_sensor->InitSensor(m_addr) != 0) {
+    int rc = 0;
+    switch (step) {
+        case eSetupPower:
+            m_sensor.begin();
+            m_sensor.VL6180x_On();
+            break;
+        case eSetupInit:
+            rc = m_sensor.InitSensor(m_addr);
+            break;
+        case eSetupPresent:
+            rc = (m_sensor.Present() == 1) ? 0 : -1;
+            break;
+        case eSetupPrepare:
+            rc = m_sensor.Prepare();
+            break;
+        case eSetupGPIO1:
+            rc = m_sensor.SetupGPIO1(GPIOx_SELECT_GPIO_INTERRUPT_OUTPUT,
+                                     GPIOx_SELECT_GPIO_INTERRUPT_OUTPUT);
+            break;
+        case eSetupInterrupt:
+            rc = m_sensor.RangeConfigInterrupt(CONFIG_GPIO_INTERRUPT_NEW_SAMPLE_READY);
+            break;
+        case eSetupConvergence:
+            rc = m_sensor.RangeSetMaxConvergenceTime(m_conv_msec);
+            if (rc == 0) {
+                m_limit_due = false;
+            }
+            break;
+        case eSetupFilter:
+            rc = m_sensor.FilterSetState(0);
+            break;
+        case eSetupDMax:
+            rc = m_sensor.DMaxSetState(0);
+            if (rc == 0) {
+                // Sensor is idle, ready to be triggered.
+                *m_ready = true;
+            }
+            break;
+        case eSetupContinuous:
+            if (m_period_usec != 0) {
+                rc = start_continuous(m_period_usec / 1000);
+            }
+            break;
+    }
 #if TRACE
-        Serial.println("ERROR: InitSensor");
+    if (rc != 0) {
+        Serial.print("ERROR: setup step ");
+        Serial.println(step);
+    }
 #endif
-        return false;
+    return rc == 0;
+    
+}
+
+// Trigger to pulse laser and begin range measurement.
+// With a transfer queue, the trigger is posted and this returns at once.
+template<class FILTER>
+int BasicSensor<FILTER>::trigger() {
+    if (!(*m_ready)) {
+        return -1;
     }
-    if (m_sensor->Present() != 1) {
-#if TRACE
-        Serial.println("ERROR: Present");
+    *m_ready = false;
+    m_since = micros();
+#if PROFILE
+    uint32_t t0 = micros();
 #endif
-        return false;
+    int rc = 0;
+    // A read still in progress is queued ahead of the trigger, so it
+    // completes, interrupt clear and all, before the measurement starts.
+    if (m_bus != NULL) {
+        if (m_bus->post(&m_start)) {
+            m_bus->poll();
+        } else {
+            *m_ready = true;
+            rc = -1;
+#if PROFILE
+            profile.addDrop(Profile::eQueueFull);
+#endif
+        }
+    } else {
+        rc = m_sensor.RangeStartSingleShot();
     }
-    if (m_sensor->Prepare() != 0) {
-#if TRACE
-        Serial.println("ERROR: Prepare");
+#if PROFILE
+    profile.addTiming(Profile::eTrigger, micros() - t0);
 #endif
-        return false;
+    return rc;
+}
+
+// Start continuous ranging, with a new measurement every period_msec
+// (rounded down to a multiple of 10 msec, minimum 10 msec).
+// Each new sample raises the interrupt; collect it with get_distance().
+template<class FILTER>
+int BasicSensor<FILTER>::start_continuous(const uint16_t period_msec) {
+    *m_ready = false;
+    m_dist = NO_READING;
+    m_period_usec = (period_msec < 10 ? 10 : period_msec - period_msec % 10) * 1000UL;
+    m_since = micros();
+    int rc = m_sensor.RangeSetInterMeasPeriod(period_msec);
+    if (rc == 0) {
+        rc = m_sensor.RangeStartContinuousMode();
     }
-    if (m_sensor->SetupGPIO1(GPIOx_SELECT_GPIO_INTERRUPT_OUTPUT, GPIOx_SELECT_GPIO_INTERRUPT_OUTPUT) != 0) {
-#if TRACE
-        Serial.println("ERROR: SetupGPIO1");
+    m_continuous = (rc == 0);
+    return rc;
+}
+
+// Return true if sensor is ready to do another single-shot measurement,
+// or in continuous mode, if a new sample is waiting.
+// A polled GPIO1 pin is only trusted once no transfer to the sensor is
+// outstanding, since it stays high until the interrupt clear is done.
+template<class FILTER>
+bool BasicSensor<FILTER>::is_ready() {
+    if (m_polled && !(*m_ready) && !m_pending && m_start.done()
+        && digitalRead(m_gpio1) == HIGH) {
+        *m_stamp = micros();
+        *m_ready = true;
+    }
+    return *m_ready;
+}
+
+// Start reading the sample flagged by is_ready().
+// With a transfer queue, the range read and the interrupt clear are posted,
+// with the range status and convergence time reads tune() wants, and
+// has_distance() tells when they are done; otherwise the sample is read
+// here and now.
+// Returns true if the sample is being read, or has been and is waiting to
+// be taken; false if the queue has no room, so the caller should retry.
+template<class FILTER>
+bool BasicSensor<FILTER>::request_distance() {
+    if (m_pending || m_fresh) {
+        return true;
+    }
+    uint8_t reads = 2;
+    if (m_tuning) {
+        reads += m_tuner.measuring() ? 2 : 1;
+    }
+    if (m_bus != NULL && m_bus->space() < reads) {
+        // Counted once however many times the read is tried again.
+#if PROFILE
+        if (!m_held) {
+            profile.addDrop(Profile::eQueueFull);
+        }
 #endif
+        m_held = true;
         return false;
     }
-    if (m_sensor->RangeConfigInterrupt(CONFIG_GPIO_INTERRUPT_NEW_SAMPLE_READY) != 0) {
-#if TRACE
-        Serial.println("ERROR: RangeConfigInterrupt");
+    m_held = false;
+    // Time stamp is written by the ISR, so copy it with interrupts off.
+    // In continuous mode, also clear flag before reading, so a sample
+    // completing after this point raises it again.
+    noInterrupts();
+    m_when = *m_stamp;
+    if (m_continuous) {
+        *m_ready = false;
+    }
+    interrupts();
+    m_asked = micros();
+    m_since = m_asked;
+    if (m_bus != NULL) {
+        m_bus->post(&m_read);
+        if (m_tuning) {
+            m_bus->post(&m_status);
+            if (m_tuner.measuring()) {
+                m_bus->post(&m_conv);
+            }
+        }
+        m_bus->post(&m_clear);
+        m_pending = true;
+        m_bus->poll();
+    } else {
+        read_blocking();
+    }
+#if PROFILE
+    profile.addTiming(Profile::eRequest, micros() - m_asked);
 #endif
-        return false;
+    return true;
+}
+
+// Return true if the requested distance has been read and not yet taken.
+template<class FILTER>
+bool BasicSensor<FILTER>::has_distance() {
+    if (m_pending && m_read.done() && m_clear.done() && m_status.done() && m_conv.done()) {
+        m_pending = false;
+        // Range status holds the error code in its top four bits.  A read
+        // not posted this time is left idle, so is not taken as one.
+        m_error = m_status.ok() ? (m_status_reg >> 4) : 0xFF;
+        m_conv_usec = m_conv.ok()
+            ? ((uint32_t) m_conv_reg[0] << 24) | ((uint32_t) m_conv_reg[1] << 16)
+              | ((uint32_t) m_conv_reg[2] << 8) | m_conv_reg[3]
+            : 0L;
+        m_status.status = I2CTransfer::eIdle;
+        m_conv.status = I2CTransfer::eIdle;
+        // In continuous mode, a read done a whole period or more after its
+        // interrupt may have returned the next sample, which raised no
+        // interrupt of its own, so its time is unknown.  Drop it.
+        if (m_continuous && (micros() - m_when) >= m_period_usec) {
+#if PROFILE
+            profile.addDrop(Profile::eStale);
+#endif
+            return m_fresh;
+        }
+        accept(m_read.ok() ? 0 : -1, m_range);
     }
-    if (m_sensor->RangeSetMaxConvergenceTime(8) != 0) {
-#if TRACE
-        Serial.println("ERROR: RangeSetMaxConvergenceTime");
+    return m_fresh;
+}
+
+// Take the distance read, passed through low-pass filter.
+// If error occurred or no measurement available, NO_READING is returned.
+// If when_usec is not NULL, it receives the time (usec) of the interrupt
+// which signalled the sample.
+template<class FILTER>
+uint32_t BasicSensor<FILTER>::take_distance(uint32_t* when_usec) {
+    m_fresh = false;
+    if (m_dist != NO_READING) {
+        ++m_stats.samples;
+    }
+    if (when_usec != NULL) {
+        *when_usec = m_when;
+    }
+    return m_dist;
+}
+
+// Private method
+// Read the waiting sample through the driver, blocking in Wire.
+template<class FILTER>
+void BasicSensor<FILTER>::read_blocking() {
+    VL6180x_RangeData_t data;
+    int rc = m_sensor.RangeGetMeasurementIfReady(&data);
+    m_error = (rc == 0) ? (uint8_t) data.errorStatus : 0xFF;
+    m_conv_usec = (rc == 0) ? data.rtnConvTime : 0L;
+    accept(rc, data.range_mm);
+}
+
+// Private method
+// Filter a range just read (rc is 0), or note a failed read.
+// The first reading fills the filter, so that the filtered distance does
+// not sweep up from zero through the detection window at start-up.
+template<class FILTER>
+void BasicSensor<FILTER>::accept(const int rc, const uint32_t range) {
+    if (rc == 0) {
+        m_failures = 0;
+        if (m_health == eRestarted) {
+            // Back in service: count the time since the fault.
+            uint32_t down = micros() - m_down_when;
+            ++m_stats.recoveries;
+            m_stats.down_usec += down;
+            m_stats.recover_usec = down;
+            if (down > m_stats.recover_max_usec) {
+                m_stats.recover_max_usec = down;
+            }
+            m_health = eInService;
+        }
+        if (!m_primed) {
+            m_filter.fill(range);
+            m_primed = true;
+        }
+        m_raw = range;
+        m_dist = m_filter.filter(range);
+        m_edge.add(m_dist, m_when);
+    } else {
+        if (m_failures < UINT8_MAX) {
+            ++m_failures;
+        }
+        if (m_stats.failures < UINT16_MAX) {
+            ++m_stats.failures;
+        }
+        m_raw = (uint32_t) NO_READING;
+        m_dist = (uint32_t) NO_READING;
+#if PROFILE
+        profile.addDrop(Profile::eFailed);
 #endif
-        return false;
     }
-    if (m_sensor->FilterSetState(0) != 0) {
-#if TRACE
-        Serial.println("ERROR: FilterSetState");
+#if PROFILE
+    profile.addTiming(Profile::eRead, micros() - m_asked);
 #endif
+    m_fresh = true;
+}
+
+// Estimate when filtered distance crossed into a detection window,
+// interpolating between the latest sample and the one before.
+// Arguments:
+//   lo: level crossed when entering window from below (mm)
+//   hi: level crossed when entering window from above (mm)
+// Returns crossing time (usec).
+template<class FILTER>
+uint32_t BasicSensor<FILTER>::crossing_time(const uint32_t lo, const uint32_t hi) const {
+    return m_edge.crossing(lo, hi);
+}
+
+// Get the last range read, before filtering, or NO_READING.  The filter
+// takes several samples to follow a step, which is too slow for spotting
+// a train while sampling slowly.
+template<class FILTER>
+uint32_t BasicSensor<FILTER>::raw_distance() const {
+    return m_raw;
+}
+
+// Private method
+// Take the sensor out of service: hold it in reset, and drop any sample
+// under way.  No transfer to it may be outstanding.
+template<class FILTER>
+void BasicSensor<FILTER>::hold(const uint32_t now) {
+    m_sensor.VL6180x_Off();
+    if (m_health == eInService) {
+        ++m_stats.faults;
+        m_down_when = now;
+    }
+    m_health = eHeld;
+    m_since = now;
+    m_failures = 0;
+    *m_ready = false;
+    m_pending = false;
+    m_fresh = false;
+    m_primed = false;
+    m_continuous = false;
+    m_raw = (uint32_t) NO_READING;
+    m_dist = (uint32_t) NO_READING;
+}
+
+// Private method
+// Take the next step of setting the sensor up again, as begin() did, then
+// restart continuous ranging if it was ranging continuously.  Each step
+// blocks in Wire, so the transfer queue must be idle, but only for one
+// driver call, so the other sensors' samples are never held up by more.
+// Returns true once the sensor is set up, false while it is still being
+// set up or if it is held again.
+template<class FILTER>
+bool BasicSensor<FILTER>::restart() {
+    bool ok = setup_step(m_step);
+    if (s_addressing == this && (m_step == eSetupInit || !ok)) {
+        // Given its own address, or off again: another may power up.
+        s_addressing = NULL;
+    }
+    if (!ok) {
+        ++m_stats.failed_resets;
+        m_sensor.VL6180x_Off();
+        *m_ready = false;
+        m_continuous = false;
+        m_since = micros();
+        m_health = eRetry;
         return false;
     }
-    if (m_sensor->DMaxSetState(0) != 0) {
-#if TRACE
-        Serial.println("ERROR: DMaxSetState");
-#endif
+    if (m_step++ < eSetupContinuous) {
         return false;
     }
-    
+    m_since = micros();
+    m_health = eRestarted;
     return true;
-    
 }
 
-// Trigger to pulse laser and begin range measurement.
-int Sensor::trigger() {
-    if (!(*m_ready)) {
-        return -1;
+// Check the sensor's health, at time now (usec), and take it out of
+// service if it has failed too many reads in a row, or has not flagged a
+// sample it was asked for.  It is only taken out once no transfer to it
+// is outstanding.  One out of service is held in reset for
+// SENSOR_RESET_MSEC, then set up again a step per call, each once the
+// transfer queue is idle; if that fails, it is tried again every
+// SENSOR_RETRY_MSEC.  Like begin(), only one sensor at a time is powered
+// up until it has its own address; the others stay held meanwhile.
+// Returns true if the sensor is in service and may be sampled.
+template<class FILTER>
+bool BasicSensor<FILTER>::service(const uint32_t now) {
+    if (in_service()) {
+        uint32_t limit = SENSOR_TIMEOUT_MSEC * 1000UL;
+        if (m_continuous && limit < 4 * m_period_usec) {
+            limit = 4 * m_period_usec;
+        }
+        bool idle = !m_pending && m_start.done() && m_limit.done();
+        bool stalled = idle && !(*m_ready) && !m_fresh && (now - m_since) > limit;
+        if (stalled || (idle && m_failures >= SENSOR_FAIL_LIMIT)) {
+            if (stalled && m_stats.timeouts < UINT16_MAX) {
+                ++m_stats.timeouts;
+            }
+            if (m_health == eRestarted) {
+                ++m_stats.failed_resets;
+            }
+            hold(now);
+            return false;
+        }
+        return true;
     }
-    *m_ready = false;
-    m_dist = NO_READING;
-    return m_sensor->RangeStartSingleShot();
+    if (m_health != eSettingUp) {
+        uint32_t wait = (m_health == eRetry) ? SENSOR_RETRY_MSEC : SENSOR_RESET_MSEC;
+        if ((now - m_since) < wait * 1000UL) {
+            return false;
+        }
+        if (s_addressing != NULL) {
+            return false;
+        }
+        s_addressing = this;
+        ++m_stats.resets;
+        m_step = eSetupPower;
+        m_health = eSettingUp;
+    }
+    if (m_bus != NULL && !m_bus->idle()) {
+        return false;
+    }
+    return restart();
 }
 
-// Return true if sensor is ready to do another single-shot measurement.
-bool Sensor::is_ready() const {
-    return *m_ready;
+// Return true if the sensor is in service.
+template<class FILTER>
+bool BasicSensor<FILTER>::in_service() const {
+    return m_health == eInService || m_health == eRestarted;
 }
 
-// Get range measurement if one is available.
-// If a measurement is available, it will be passed through low-pass filter
-// before it is returned.
-// If error occurred or no measurement available, NO_READING is returned.
-uint32_t Sensor::get_distance() {
-    VL6180x_RangeData_t data;
-    int rc = m_sensor->RangeGetMeasurementIfReady(&data);
-    if (rc == 0) {
-        m_dist = m_filter->filter(data.range_mm);
-        return m_dist;
-    } else {
-        return (uint32_t) NO_READING;
+// Get the sensor's fault and recovery counters.
+template<class FILTER>
+const SensorHealth& BasicSensor<FILTER>::health() const {
+    return m_stats;
+}
+
+// Start or stop tuning the max convergence time.  Starting begins again
+// from TUNE_START_MSEC, which the sensor goes back to when tuning stops.
+template<class FILTER>
+void BasicSensor<FILTER>::set_tuning(const bool on) {
+    m_tuning = on;
+    m_error = 0xFF;
+    m_conv_usec = 0L;
+    m_tuner.begin();
+    set_convergence(TUNE_START_MSEC);
+}
+
+// Feed the sample just taken to the tuner, targets being valid ranges no
+// farther than limit_mm.  The time it finds is set by set_convergence().
+template<class FILTER>
+void BasicSensor<FILTER>::tune(const uint8_t limit_mm) {
+    if (!m_tuning || !in_service()) {
+        return;
+    }
+    m_tuner.add(m_error, m_raw, m_conv_usec, limit_mm);
+    if (m_limit_due) {
+        set_limit();
     }
 }
+
+// Set the max convergence time (msec), if it differs from the one set:
+// posted, to take effect from the next measurement, or through the
+// driver.  One not set now is tried again from the next tune(), or set
+// up when the sensor is next set up.
+template<class FILTER>
+void BasicSensor<FILTER>::set_convergence(const uint8_t msec) {
+    if (msec != m_conv_msec) {
+        m_conv_msec = msec;
+        m_limit_due = true;
+    }
+    if (m_limit_due && in_service()) {
+        set_limit();
+    }
+}
+
+// Get the max convergence time tuner.
+template<class FILTER>
+const ConvergenceTuner& BasicSensor<FILTER>::tuner() const {
+    return m_tuner;
+}
+
+// Private method
+// Write the max convergence time, unless a write is still under way.
+template<class FILTER>
+void BasicSensor<FILTER>::set_limit() {
+    if (m_bus != NULL) {
+        if (!m_limit.done()) {
+            return;
+        }
+        m_limit_tx[2] = m_conv_msec;
+        if (m_bus->post(&m_limit)) {
+            m_limit_due = false;
+            m_bus->poll();
+        }
+    } else if (m_sensor.RangeSetMaxConvergenceTime(m_conv_msec) == 0) {
+        m_limit_due = false;
+    }
+}
+
+// Sensors with the filter chosen for the sketch.  Another policy needs
+// its own line here.
+template class BasicSensor<SENSOR_FILTER>;
@@ -6,33 +6,172 @@
 #include "ST_VL6180X.h"
 
 #include "Filter.h"
+#include "EdgeEstimator.h"
+#include "I2CQueue.h"
+#include "ConvergenceTuner.h"
 
 // Distance to be returned if sensor returns no valid range measurement.
 #define NO_READING 0xFFFFFFFFL
 
-class Sensor {
+// Samples averaged by each sensor's low-pass filter
+#define SENSOR_FILTER_SAMPLES 10
+
+// Low-pass filter of each sensor's distances, one of the policies in
+// Filter.h: the mean of the last SENSOR_FILTER_SAMPLES, as always; an
+// EmaFilter, which follows an edge sooner; or a MedianFilter, which
+// ignores lone bad readings but takes 256 bytes of SRAM per sensor.
+// host/filter_lag compares them.
+#ifndef SENSOR_FILTER
+#define SENSOR_FILTER FixedFilter<uint32_t, SENSOR_FILTER_SAMPLES>
+#endif
+
+// Consecutive failed reads after which a sensor is taken out of service
+#define SENSOR_FAIL_LIMIT 8
+
+// Longest wait for a sensor to flag a sample, after being triggered or,
+// ranging continuously, since its last one, before it is taken out of
+// service (msec, and at least four continuous ranging periods)
+#define SENSOR_TIMEOUT_MSEC 100
+
+// Time a sensor taken out of service is held in reset, and time before
+// trying again if setting it up fails (msec)
+#define SENSOR_RESET_MSEC 2
+#define SENSOR_RETRY_MSEC 1000
+
+// Faults seen by one sensor, and its recoveries from them
+struct SensorHealth {
+    uint32_t samples;           // samples read and taken
+    uint16_t failures;          // reads failed
+    uint16_t timeouts;          // samples never flagged
+    uint16_t faults;            // times taken out of service
+    uint16_t resets;            // times set up again
+    uint16_t failed_resets;     // times setting up again failed
+    uint16_t recoveries;        // times back in service
+    uint32_t down_usec;         // time out of service, all recoveries (usec)
+    uint32_t recover_usec;      // time out of service, last recovery (usec)
+    uint32_t recover_max_usec;  // time out of service, longest recovery (usec)
+};
+
+// A VL6180X and its filtered distances, the filter being any class with
+// the filter() and fill() of those in Filter.h.
+//
+// service() watches the sensor's health.  One which fails SENSOR_FAIL_LIMIT
+// reads in a row, or never flags a sample, is taken out of service: held
+// in reset by its enable pin, then set up again as begin() does, one
+// driver call per service() while the others go on sampling.  It is back
+// in service once a read succeeds.
+//
+// With set_tuning(), each sample's range status, and while the tuner is
+// measuring its convergence time, are read with the range, and tune()
+// feeds them to a ConvergenceTuner; set_convergence() sets the time.
+template<class FILTER>
+class BasicSensor {
 
   private:
-    const VL6180X* m_sensor;            // (pointer to) sensor object
-    const Filter<uint32_t>* m_filter;   // (pointer to) low-pass filter
+    // Health of the sensor
+    enum E_Health {
+      eInService,                       // sampling normally
+      eHeld,                            // held in reset, to be set up again
+      eRetry,                           // setting up again failed
+      eSettingUp,                       // being set up again, a step at a time
+      eRestarted                        // set up again, no good read yet
+    };
+    // Steps of setting the sensor up, one driver call each
+    enum E_Setup {
+      eSetupPower,                      // power up through enable pin
+      eSetupInit,                       // give it its address
+      eSetupPresent,                    // check it answers
+      eSetupPrepare,                    // load default settings
+      eSetupGPIO1,                      // make GPIO1 the interrupt output
+      eSetupInterrupt,                  // interrupt on each new sample
+      eSetupConvergence,                // set max convergence time
+      eSetupFilter,                     // turn off range filter
+      eSetupDMax,                       // turn off DMax, then ready
+      eSetupContinuous                  // restart continuous ranging, if it was
+    };
+
+    VL6180X m_sensor;                   // sensor driver
+    FILTER m_filter;                    // low-pass filter
     bool* m_ready;                      // (pointer to) is-ready flag
+    volatile uint32_t* m_stamp;         // (pointer to) time of interrupt (usec)
     const byte m_addr;                  // I2C address
     const byte m_gpio0;                 // GPIO pin for enable to sensor
     const byte m_gpio1;                 // GPIO pin for interrupt from sensor
     uint32_t m_dist;                    // measured distance in mm
+    uint32_t m_raw;                     // last range read, unfiltered (mm)
+    bool m_continuous;                  // continuous ranging started
+    bool m_polled;                      // no interrupt, poll GPIO1 pin instead
+    bool m_pending;                     // distance requested, not yet read
+    bool m_fresh;                       // distance read, not yet taken
+    bool m_held;                        // read refused by a full queue, not yet posted
+    bool m_primed;                      // filter filled from first reading
+    uint32_t m_when;                    // time of sample being read (usec)
+    uint32_t m_asked;                   // time read was requested (usec)
+    uint32_t m_period_usec;             // continuous ranging period (usec)
+    EdgeEstimator<uint32_t> m_edge;     // recent distances for edge timing
+    I2CQueue* m_bus;                    // (pointer to) transfer queue, NULL to block
+    I2CTransfer m_start;                // transfer starting a measurement
+    I2CTransfer m_read;                 // transfer reading the range
+    I2CTransfer m_clear;                // transfer clearing the interrupt
+    uint8_t m_range;                    // range read by m_read (mm)
+    uint8_t m_health;                   // E_Health
+    uint8_t m_step;                     // E_Setup taken next while eSettingUp
+    uint8_t m_failures;                 // reads failed in a row
+    uint32_t m_since;                   // time sample last asked for, or
+                                        //   sensor held or set up (usec)
+    uint32_t m_down_when;               // time taken out of service (usec)
+    SensorHealth m_stats;               // sample, fault and recovery counters
+    ConvergenceTuner m_tuner;           // max convergence time tuner
+    bool m_tuning;                      // read status for m_tuner, and tune
+    bool m_limit_due;                   // max convergence time changed, not yet set
+    uint8_t m_conv_msec;                // max convergence time (msec)
+    uint8_t m_error;                    // range error code of last sample, 0xFF if unknown
+    uint32_t m_conv_usec;               // convergence time of last sample, 0 if not read
+    I2CTransfer m_status;               // transfer reading the range status
+    I2CTransfer m_conv;                 // transfer reading the convergence time
+    I2CTransfer m_limit;                // transfer setting the max convergence time
+    uint8_t m_status_reg;               // range status read by m_status
+    uint8_t m_conv_reg[4];              // convergence time read by m_conv, MSB first
+    uint8_t m_limit_tx[3];              // register index and time written by m_limit
+
+    bool setup();
+    bool setup_step(const uint8_t step);
+    void read_blocking();
+    void accept(const int rc, const uint32_t range);
+    void hold(const uint32_t now);
+    bool restart();
+    void set_limit();
 
   public:
-    Sensor(
-      const byte addr, const byte ena_pin, const byte intr_pin, const bool* ready_flag
+    BasicSensor(
+      const byte addr, const byte ena_pin, const byte intr_pin, const bool* ready_flag,
+      volatile uint32_t* stamp
     );
     void setupInterruptHandler(
       const uint8_t irq_pin, void (*irq_func)(), const int value
     );
+    void set_polled();
+    void set_bus(I2CQueue* bus);
+    void shutdown();
     bool begin();
     int trigger();
-    bool is_ready() const;
-    uint32_t get_distance();
+    int start_continuous(const uint16_t period_msec);
+    bool is_ready();
+    bool request_distance();
+    bool has_distance();
+    uint32_t take_distance(uint32_t* when_usec = NULL);
+    uint32_t crossing_time(const uint32_t lo, const uint32_t hi) const;
+    uint32_t raw_distance() const;
+    bool service(const uint32_t now);
+    bool in_service() const;
+    const SensorHealth& health() const;
+    void set_tuning(const bool on);
+    void tune(const uint8_t limit_mm);
+    void set_convergence(const uint8_t msec);
+    const ConvergenceTuner& tuner() const;
   
 };
 
+typedef BasicSensor<SENSOR_FILTER> Sensor;
+
 #endif
@@ -1,5 +1,7 @@
 #include "Speedometer.h"
 
+#include <new.h>
+
 // If TRACE or STREAMING are #define'd, they're in Speedometer.h
 
 #if TRACE
@@ -8,395 +10,1332 @@
 #endif
 #endif
 
-// I2C addresses of sensors
-#define SENS_A 0x2A
-#define SENS_B 0x2B
+// Wiring of each sensor.  Tracks take the sensors in order, as many each
+// as the Speedometer has per track, so with two per track the first pair
+// fits an Uno; further sensors need the extra pins of a Mega 2560.
+// Sensors whose interrupt pin has no external interrupt are polled instead.
+static const Speedometer::SensorPins PINS[] = {
+  // addr  ena intr
+  { 0x2A,   5,   3 },   // brown, orange
+  { 0x2B,   4,   2 },   // red, yellow
+  { 0x2C,  22,  18 },
+  { 0x2D,  23,  19 },
+  { 0x2E,  24,  26 },
+  { 0x2F,  25,  27 },
+  { 0x30,  28,  30 },
+  { 0x31,  29,  31 }
+};
 
-// GPIO pins of sensor-enable outputs (used to set I2C addresses of sensors)
-#define ENA_A 5   // brown
-#define ENA_B 4   // red
+static_assert(sizeof PINS / sizeof PINS[0] >= MAX_SENSORS, "wiring table too short");
+static_assert(I2C_QUEUE_DEPTH >= MAX_TRACK_SENSORS, "I2C queue cannot hold a track's triggers");
 
-// GPIO pins of sensor interrupt inputs
-#define INTR_A 3  // orange
-#define INTR_B 2  // yellow
+// No track selected
+#define NO_TRACK 0xFF
 
-// (Pointers to) sensor objects
-Sensor* sensA;
-Sensor* sensB;
+// Room for every sensor object, built in place by the constructor rather
+// than on the heap
+static uint8_t sensor_arena[MAX_SENSORS][sizeof (Sensor)] __attribute__((aligned(4)));
 
-// Conversion factor
-#define MI_PER_KM (0.62137119224)
+// (Pointers to) sensor objects, in order along each track, track by track
+Sensor* sensors[MAX_SENSORS];
 
 // Timeout (msec)
 #define TIMEOUT_CLEAR 1500
 
+// Period of state machine ticks (msec)
+#define TICK_MSEC 5
+
+// Period of continuous ranging (msec, shortest the VL6180X allows)
+#define CONTINUOUS_MSEC 10
+
 // Flags set when interrupts occur
-volatile bool readyA = false;
-volatile bool readyB = false;
+volatile bool ready[MAX_SENSORS];
+
+// Times (usec) at which interrupts occurred
+volatile uint32_t when[MAX_SENSORS];
+
+// Number of external interrupts with service routines (6 on a Mega 2560)
+#define NUM_ISRS 6
+
+// Sensor served by each external interrupt
+int8_t irq_sensor[NUM_ISRS] = { -1, -1, -1, -1, -1, -1 };
 
 // Interrupt service routines
-void isr_A() {
-  readyA = true;
-}
-void isr_B() {
-  readyB = true;
+static inline void flag(const uint8_t irq) {
+  int8_t s = irq_sensor[irq];
+#if PROFILE
+  if (ready[s]) {
+    profile.addDrop(Profile::eOverrun);
+  }
+#endif
+  when[s] = micros();
+  ready[s] = true;
 }
+void isr_0() { flag(0); }
+void isr_1() { flag(1); }
+void isr_2() { flag(2); }
+void isr_3() { flag(3); }
+void isr_4() { flag(4); }
+void isr_5() { flag(5); }
+void (* const isrs[NUM_ISRS])() = { isr_0, isr_1, isr_2, isr_3, isr_4, isr_5 };
 
 // Private method
-uint32_t Speedometer::timeout_msec() const {
+// Select the speed and timeout constants for the current scale and units.
+// Each is folded at compile time, so this is only a lookup.
+// Constants for spans other than SPACING_MM are scaled from those.
+void Speedometer::setConstants() {
 
-  double scale_min_speed = 1.0;   // limited by display
-  double scale_min_km_per_hr = scale_min_speed * (m_metric ? 1.0 : (1.0 / MI_PER_KM));
-  double scale_m_per_sec = scale_min_km_per_hr / 3.6;
-  double m_per_sec = scale_m_per_sec / (double) m_scale;
-  double mm_per_msec = m_per_sec;
-  double timeout_msec = m_spacing / mm_per_msec;
-  return (uint32_t) timeout_msec;
+  uint32_t k;
+  switch (m_scale) {
+    case eUK: {
+      constexpr uint32_t k_mi = speedConstant(eUK, false), k_km = speedConstant(eUK, true);
+      k = m_metric ? k_km : k_mi;
+      break;
+    }
+    case eJP: {
+      constexpr uint32_t k_mi = speedConstant(eJP, false), k_km = speedConstant(eJP, true);
+      k = m_metric ? k_km : k_mi;
+      break;
+    }
+    case eUS:
+    default: {
+      constexpr uint32_t k_mi = speedConstant(eUS, false), k_km = speedConstant(eUS, true);
+      k = m_metric ? k_km : k_mi;
+      break;
+    }
+  }
+  m_speed_k = (m_spacing == SPACING_MM) ? k : (uint32_t) ((uint64_t) k * m_spacing / SPACING_MM);
+  m_mm_k = (k + SPACING_MM / 2) / SPACING_MM;
+  m_timeout_usec = m_speed_k / SPEED_FRAC;
   
 }
 
+// Get wiring of one sensor.
+const Speedometer::SensorPins& Speedometer::sensorPins(const uint8_t i) {
+  return PINS[i];
+}
+
+// Private method
+// Get a track's sensor j, counting from A.
+Sensor* Speedometer::sensor(const uint8_t t, const uint8_t j) const {
+  return sensors[t * m_nsens + j];
+}
+
+#if SRAM_REPORT
+// Tags naming sizes in the report
+struct SensorChannel;     // one sensor: object, pointer, flag and time stamp
+struct SensorArena;       // room for all MAX_SENSORS sensor objects
+
+// Private method
+// Report SRAM taken by each object at build time (SramReport.h).  A
+// sensor channel and a track are what each further sensor and track
+// cost; the arena and the Speedometer hold MAX_SENSORS and MAX_TRACKS of
+// them whether used or not.
+void Speedometer::sramReport() {
+  SRAM_REPORT_TYPE(Sensor);
+  SRAM_REPORT_BYTES(SensorChannel, sizeof (Sensor) + sizeof (Sensor*) + sizeof (bool) + sizeof (uint32_t));
+  SRAM_REPORT_BYTES(SensorArena, sizeof sensor_arena);
+  SRAM_REPORT_TYPE(Track);
+  SRAM_REPORT_TYPE(Speedometer);
+  SRAM_REPORT_TYPE(I2CQueue);
+  SRAM_REPORT_TYPE(Calibrator);
+  SRAM_REPORT_TYPE(Correlator);
+#if PROFILE
+  SRAM_REPORT_TYPE(Profile);
+#endif
+#if TELEMETRY
+  SRAM_REPORT_TYPE(Telemetry);
+#endif
+}
+#endif
+
 // Constructor
-Speedometer::Speedometer(E_Scale s) : 
-  StateMachine(5, true),    // 5 msec real-time period
-  m_spacing(127),           // sensor spacing (mm, equal to 5.0 inches)
-  m_sense_when(0L),         // time mark at beginning of interval measurement
-  m_speed(0.0),             // most recent speed (km/hr or mi/hr)
+// Tracks and sensors per track are limited to what the wiring table holds.
+Speedometer::Speedometer(E_Scale s, const uint8_t tracks, const uint8_t per_track) : 
+  StateMachine(TICK_MSEC, true),  // 5 msec real-time period
+  m_nsens(per_track < 2 ? 2 : (per_track > MAX_TRACK_SENSORS ? MAX_TRACK_SENSORS : per_track)),
   m_scale(s),               // scale factor (87, 150, 160, ...)
-  m_window(NULL),           // (pointer to) current range window
   m_metric(s == eJP),       // metric or imperial speed
-  m_state(eClear),          // finite state machine current state
-  m_detA(false),            // sensor A detect
-  m_detB(false),            // sensor B detect
-  m_triggered(false),       // emitters triggered
-  m_updated(false)          // measured speed updated
+  m_ntracks(tracks < 1 ? 1 :
+            (tracks * m_nsens > MAX_SENSORS ? MAX_SENSORS / m_nsens : tracks)),
+  m_next(0),                // track to trigger first
+  m_reading(NO_TRACK),      // no track being read
+  m_read_live(0),           // no sensors being read
+  m_asking(false),          // no reads due
+  m_continuous(false),      // sensors ranging continuously
+  m_sampling(eTicked),      // one track per tick
+  m_idle_usec(SAMPLE_IDLE_MSEC * 1000UL),
+  m_cal(NULL),
+  m_correlate(false),
+  m_tuning(false)
 {
 
-  // Set interrupt GPIO pins to INPUT_PULLUP,
-  // create Sensor objects, attach interrupts to GPIO pins
+  // Sensors start SPACING_MM apart.
+  for (uint8_t j = 0; j < MAX_TRACK_SENSORS; ++j) {
+    m_pos[j] = j * SPACING_MM;
+  }
+  m_spacing = m_pos[m_nsens - 1];
+  setConstants();
 
-  pinMode(INTR_A, INPUT_PULLUP);
-  sensA = new Sensor(SENS_A, ENA_A, INTR_A, &readyA);
-  attachInterrupt(digitalPinToInterrupt(INTR_A), isr_A, RISING);
-  
-  pinMode(INTR_B, INPUT_PULLUP);
-  sensB = new Sensor(SENS_B, ENA_B, INTR_B, &readyB);
-  attachInterrupt(digitalPinToInterrupt(INTR_B), isr_B, RISING);
+  // For each sensor, set interrupt GPIO pin to INPUT_PULLUP,
+  // create Sensor object, attach interrupt to GPIO pin if it has one.
+
+  for (uint8_t i = 0; i < m_nsens * m_ntracks; ++i) {
+    const SensorPins& sp = PINS[i];
+    byte intr = sp.intr;
+    ready[i] = false;
+    when[i] = 0L;
+    pinMode(intr, INPUT_PULLUP);
+    sensors[i] = new (sensor_arena[i]) Sensor(sp.addr, sp.ena, intr, &ready[i], &when[i]);
+    int irq = digitalPinToInterrupt(intr);
+    if (irq >= 0 && irq < NUM_ISRS) {
+      irq_sensor[irq] = i;
+      attachInterrupt(irq, isrs[irq], RISING);
+    } else {
+      sensors[i]->set_polled();
+    }
+  }
+
+  // Clear state of every track.
+  for (uint8_t t = 0; t < MAX_TRACKS; ++t) {
+    Track& tk = m_tracks[t];
+    tk.window = NULL;
+    tk.sense_when = 0L;
+    tk.last_when = 0L;
+    memset(tk.sum_tn, 0, sizeof tk.sum_tn);
+    memset(tk.sum_utn, 0, sizeof tk.sum_utn);
+    memset(&tk.fit, 0, sizeof tk.fit);
+    memset(&tk.summary, 0, sizeof tk.summary);
+    memset(&tk.result, 0, sizeof tk.result);
+    tk.clear_when = 0L;
+    memset(tk.leave_when, 0, sizeof tk.leave_when);
+    memset(tk.leaves, 0, sizeof tk.leaves);
+    tk.due = 0L;
+    tk.exit_speed = 0.0;
+    tk.state = eClear;
+    memset(tk.win, 0, sizeof tk.win);
+    tk.det = 0;
+    tk.crossed = 0;
+    tk.live = 0;
+    tk.last = 0;
+    tk.triggered = false;
+    tk.updated = false;
+    tk.summing = false;
+    tk.gap = false;
+    tk.summarized = false;
+    tk.trailing = false;
+    tk.lapsed = false;
+    tk.resulted = false;
+    tk.near = false;
+    tk.correlating = false;
+  }
 
 }
 
-// Try to initialize both sensors.
-bool Speedometer::begin() {
+// Try to initialize all sensors.  One which fails is left out of service
+// and set up again later, while the rest go on sampling.
+// If continuous is true, sensors are left ranging continuously
+// and update() consumes their samples as they arrive; otherwise they
+// are triggered and read on ticks of the state machine.
+// Either way, tracks take turns so that neighbouring tracks' emitters
+// do not fire together.
+// If async is true, triggers and reads are posted to the I2C transfer
+// queue, so update() never waits on the bus; otherwise they block in Wire.
+bool Speedometer::begin(const bool continuous, const bool async) {
 
-  bool okA = sensA->begin();
-  bool okB = sensB->begin();
+  // All sensors power up at the same I2C address.  Hold every one in
+  // reset, then bring them up one at a time, each taking its own address.
+  for (uint8_t i = 0; i < m_nsens * m_ntracks; ++i) {
+    sensors[i]->shutdown();
+  }
+  bool ok = true;
+  for (uint8_t i = 0; i < m_nsens * m_ntracks; ++i) {
+    bool ok_i = sensors[i]->begin();
 #if TRACE
 #if STREAMING
-  Serial << "Speedometer::begin(): okA=" << okA << ", okB=" << okB << endl;
+    Serial << "Speedometer::begin(): sensor " << i << " ok=" << ok_i << endl;
 #endif
 #endif  
-  return okA && okB;
+    ok = ok && ok_i;
+  }
+  if (continuous) {
+    // Start each track's sensors a fraction of the period after the last.
+    // One which fails to start never flags a sample, and is set up again
+    // once that times out.
+    for (uint8_t t = 0; t < m_ntracks; ++t) {
+      if (t > 0) {
+        delayMicroseconds((CONTINUOUS_MSEC * 1000U) / m_ntracks);
+      }
+      for (uint8_t j = 0; j < m_nsens; ++j) {
+        if (sensor(t, j)->in_service()) {
+          ok = (sensor(t, j)->start_continuous(CONTINUOUS_MSEC) == 0) && ok;
+        }
+      }
+    }
+    m_continuous = true;
+  }
+  for (uint8_t t = 0; t < m_ntracks; ++t) {
+    for (uint8_t j = 0; j < m_nsens; ++j) {
+      if (sensor(t, j)->in_service()) {
+        m_tracks[t].live |= 1 << j;
+      }
+    }
+  }
+  if (async) {
+    i2c_queue.begin();
+    for (uint8_t i = 0; i < m_nsens * m_ntracks; ++i) {
+      sensors[i]->set_bus(&i2c_queue);
+    }
+  }
+  return ok;
   
 }
 
 bool Speedometer::update() {
+#if PROFILE
+  uint32_t t0 = micros();
+  bool busy = run();
+  profile.addTiming(Profile::eUpdate, micros() - t0);
+  return busy;
+#else
+  return run();
+#endif
+}
+
+// Private method
+// Body of update().
+bool Speedometer::run() {
+
+  // Move I2C transfers on, and check the sensors' health.
+  i2c_queue.poll();
+  service(micros());
+
+  // In continuous mode there is no fixed tick: each sample is read as
+  // soon as its sensor has flagged it, and consumed once it has been read.
+  if (m_continuous) {
+    bool any = false;
+    for (uint8_t t = 0; t < m_ntracks; ++t) {
+      uint8_t fresh = 0;
+      for (uint8_t j = 0; j < m_nsens; ++j) {
+        Sensor* s = sensor(t, j);
+        if (!(m_tracks[t].live & (1 << j))) {
+          continue;
+        }
+        if (s->is_ready()) {
+          s->request_distance();
+        }
+        if (s->has_distance()) {
+          fresh |= 1 << j;
+        }
+      }
+      if (fresh != 0) {
+        measure(t, fresh);
+        any = true;
+      }
+    }
+    return any;
+  }
+
+  if (m_sampling != eTicked) {
+    return runPaced();
+  }
+
+  // One track is triggered at a time.  Once all of its sensors have
+  // completed their range measurements, reads of all are started on a
+  // tick of the state machine, and the next track is triggered at once so
+  // that it measures while the reads are in progress.  As soon as all
+  // reads are done, that track's state machine is run.  Reads which do
+  // not all fit on the I2C queue at the tick are queued on later passes,
+  // as it has room for each sensor's.
+  bool ticked = false;
 
   // Time to update state machine?
   if (StateMachine::update()) {
-
-    // If not triggered, ...
-    if (!m_triggered) {
-      // ... trigger both sensors to pulse emitters
-      // and set triggered status.
-      sensA->trigger();
-      sensB->trigger();
-      m_triggered = true;
-    } else {
-      // ... otherwise, have both sensors completed range measurement?
-      if (sensA->is_ready() && sensB->is_ready()) {
-        // If so, clear triggered status, read sensors, and determine
-        // if either range counts as a valid detection.
-        m_triggered = false;
-        uint32_t distA = sensA->get_distance();
-        uint32_t distB = sensB->get_distance();
-        m_detA = m_window->within((uint8_t) distA);
-        m_detB = m_window->within((uint8_t) distB);
-#if TRACE
-#if STREAMING
-        Serial << (int) m_detA * 100 << " " << (int) m_detB * 100 << " "
-          << distA << " " << distB << endl;
-#else
-        Serial.print((int) m_detA * 100);
-        Serial.print(" ");
-        Serial.print((int) m_detB * 100);
-        Serial.print(" ");
-        Serial.print(distA);
-        Serial.print(" ");
-        Serial.println(distB);
-#endif
+#if PROFILE
+    profile.tick(micros(), TICK_MSEC * 1000UL);
 #endif
+    Track& tk = m_tracks[m_next];
+    bool all_ready = (m_reading == NO_TRACK);
+    for (uint8_t j = 0; j < m_nsens && tk.triggered && all_ready; ++j) {
+      all_ready = !(tk.live & (1 << j)) || sensor(m_next, j)->is_ready();
+    }
+    if (!tk.triggered) {
+      // Trigger all sensors to pulse emitters and set triggered status.
+      triggerTrack(m_next);
+    } else if (all_ready) {
+      m_asking = true;
+    }
+    ticked = true;
+  }
+
+  if (m_asking) {
+    Track& tk = m_tracks[m_next];
+    uint8_t nt = (m_next + 1) % m_ntracks;
+    // Another track's trigger can go on the bus ahead of these reads;
+    // a lone track's own trigger has to follow them.
+    if (nt != m_next) {
+      triggerTrack(nt);
+    }
+    bool all_read = true;
+    for (uint8_t j = 0; j < m_nsens; ++j) {
+      if (tk.live & (1 << j)) {
+        all_read = sensor(m_next, j)->request_distance() && all_read;
       }
     }
+    if (all_read) {
+      // Reading all sensors, move on to next track.
+      tk.triggered = false;
+      m_reading = m_next;
+      m_read_live = tk.live;
+      m_next = nt;
+      m_asking = false;
+      triggerTrack(nt);
+    }
+  }
 
-    // Finite state machine logic: Action taken on this pass through
-    // loop() depends on current value of m_state.  If state change required,
-    // m_state is updated in this pass but not acted upon until next pass.
+  // A trigger left waiting for room on the I2C queue goes as soon as
+  // there is some, not a tick later.
+  if (m_reading != NO_TRACK) {
+    triggerTrack(m_next);
+  }
 
-    if (m_state == eClear) {
+  if (m_reading != NO_TRACK) {
+    bool all_read = true;
+    for (uint8_t j = 0; j < m_nsens; ++j) {
+      all_read = all_read
+        && (!(m_read_live & (1 << j)) || sensor(m_reading, j)->has_distance());
+    }
+    if (all_read) {
+      // Take distances and run state machine.
+      measure(m_reading, m_read_live);
+      m_reading = NO_TRACK;
+      return true;
+    }
+  }
 
-      // Waiting for detection on only one of two sensors.  Detect on both
-      // from this state is spurious and will be rejected.
-      
-      if (m_detA && m_detB) {
-        // Spurious double-detect
-#if TRACE
-#if STREAMING
-        Serial << millis() << " CLEARING 1" << endl;
-#else
-        Serial.print(millis());
-        Serial.println(" CLEARING 1");
-#endif
-#endif
-        m_state = eClearing;
-      } else if (m_detA && !m_detB) {
-        // Detect on only sensor A, mark the time and change state
-        // to "Sensed A".
-        uint32_t now = millis();
-#if TRACE
-#if STREAMING
-        Serial << now << " SENSA" << endl;
-#else
-        Serial.print(now);
-        Serial.println(" SENSA");
+  // Unless it was time for StateMachine to update, nothing happened.
+  return ticked;
+  
+}
+
+// Private method
+// Check the health of every sensor at time now (usec), and drop those out
+// of service from their tracks.  Under single-shot sampling a sensor back
+// in service rejoins its track when the track is next triggered, and its
+// reads are waited on only if they were asked for.
+void Speedometer::service(const uint32_t now) {
+  for (uint8_t t = 0; t < m_ntracks; ++t) {
+    uint8_t live = 0;
+    for (uint8_t j = 0; j < m_nsens; ++j) {
+      if (sensor(t, j)->service(now)) {
+        live |= 1 << j;
+      }
+    }
+    m_tracks[t].live = m_continuous ? live : (m_tracks[t].live & live);
+    if (t == m_reading) {
+      m_read_live &= live;
+    }
+  }
+}
+
+// Private method
+// Trigger all of a track's sensors in service to pulse their emitters,
+// unless done.  The triggers go on the I2C queue together, or wait until
+// it has room for all of them; a trigger which found it full would leave
+// its sensor flagged ready with no measurement started.
+void Speedometer::triggerTrack(const uint8_t t) {
+  Track& tk = m_tracks[t];
+  if (!tk.triggered && i2c_queue.space() >= m_nsens) {
+    tk.live = 0;
+    for (uint8_t j = 0; j < m_nsens; ++j) {
+      if (sensor(t, j)->in_service()) {
+        sensor(t, j)->trigger();
+        tk.live |= 1 << j;
+      }
+    }
+    tk.triggered = true;
+  }
+}
+
+// Private method
+// Single-shot sampling without the tick.  As under eTicked, one track
+// measures at a time, and the next is triggered while the last is read;
+// but reads start as soon as all of a track's sensors are ready, and the
+// next track triggered is the next one due.  While any track is armed,
+// every track is due again at once, so sampling runs as fast as the
+// VL6180X's convergence time allows; otherwise each is due an idle period
+// after its last reads.  Armed tracks are not sped up alone: the filter's
+// lag is a number of samples, so each sensor's sample rate has to stay
+// the same through a pass for its crossing times to agree.
+bool Speedometer::runPaced() {
+
+  uint32_t now = micros();
+  Track& tk = m_tracks[m_next];
+  if (tk.triggered && m_reading == NO_TRACK) {
+    bool all_ready = true;
+    for (uint8_t j = 0; j < m_nsens && all_ready; ++j) {
+      all_ready = !(tk.live & (1 << j)) || sensor(m_next, j)->is_ready();
+    }
+    if (all_ready) {
+      bool all_read = true;
+      for (uint8_t j = 0; j < m_nsens; ++j) {
+        if (tk.live & (1 << j)) {
+          all_read = sensor(m_next, j)->request_distance() && all_read;
+        }
+      }
+      if (all_read) {
+        tk.triggered = false;
+        tk.due = now + (armed() ? 0L : m_idle_usec);
+        m_reading = m_next;
+        m_read_live = tk.live;
+      }
+    }
+  }
+
+  // Trigger the next track due, unless one is already measuring; its
+  // trigger follows any reads just posted.
+  if (!m_tracks[m_next].triggered) {
+    for (uint8_t k = 1; k <= m_ntracks; ++k) {
+      uint8_t t = (m_next + k) % m_ntracks;
+      if ((int32_t) (now - m_tracks[t].due) >= 0) {
+        m_next = t;
+        triggerTrack(t);
+        break;
+      }
+    }
+  }
+
+  if (m_reading != NO_TRACK) {
+    bool all_read = true;
+    for (uint8_t j = 0; j < m_nsens; ++j) {
+      all_read = all_read
+        && (!(m_read_live & (1 << j)) || sensor(m_reading, j)->has_distance());
+    }
+    if (all_read) {
+      measure(m_reading, m_read_live);
+      m_reading = NO_TRACK;
+      // A train just seen makes every track due at once, rather than an
+      // idle period after its last reads were asked for.
+      if (armed()) {
+        for (uint8_t t = 0; t < m_ntracks; ++t) {
+          m_tracks[t].due = now;
+        }
+      }
+      return true;
+    }
+  }
+  return false;
+
+}
+
+// Private method
+// Return true if single-shot sampling should run flat out: always under
+// eFastest, and under eAdaptive while any track is in a pass or has a
+// sensor seeing something.
+bool Speedometer::armed() const {
+  if (m_sampling == eFastest) {
+    return true;
+  }
+  for (uint8_t t = 0; t < m_ntracks; ++t) {
+    if (m_tracks[t].state != eClear || m_tracks[t].near) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Private method
+// Take a track's new samples and run its state machine on them, timing
+// both against the state the track was in.
+// fresh has a bit set for each sensor with a new sample.
+void Speedometer::measure(const uint8_t t, const uint8_t fresh) {
+#if PROFILE
+  uint32_t t0 = micros();
+  uint8_t s0 = m_tracks[t].state;
 #endif
+  sample(t, fresh);
+  step(t);
+#if PROFILE
+  profile.addState(s0, micros() - t0);
 #endif
-        m_sense_when = now;
-        m_state = eSenseA;
-      } else if (!m_detA && m_detB) {
-        // Detect on only sensor B, mark the time and change state
-        // to "Sensed B".
-        uint32_t now = millis();
-#if TRACE
-#if STREAMING
-        Serial << now << " SENSB" << endl;
-#else
-        Serial.print(now);
-        Serial.println(" SENSB");
+}
+
+// Read new samples from a track's sensors, and determine if each
+// range counts as a valid detection.
+void Speedometer::sample(const uint8_t t, const uint8_t fresh) {
+
+  Track& tk = m_tracks[t];
+  const uint8_t last = m_nsens - 1;
+#if TELEMETRY
+  uint32_t distA = NO_READING;
+  uint32_t distB = NO_READING;
 #endif
+  tk.near = false;
+  // A sensor out of service detects nothing.  An end sensor out of
+  // service, or failing a read, which reads as leaving, may miss or add
+  // an edge its departures are counted by.
+  tk.det &= tk.live;
+  uint8_t ends = 1 | (1 << last);
+  if ((tk.live & ends) != ends) {
+    tk.lapsed = true;
+  }
+  for (uint8_t j = 0; j < m_nsens; ++j) {
+    if (fresh & (1 << j)) {
+      uint32_t when;            // time sample was flagged (usec)
+      uint32_t dist = sensor(t, j)->take_distance(&when);
+      uint32_t raw = sensor(t, j)->raw_distance();
+      if (dist == NO_READING && (j == 0 || j == last)) {
+        tk.lapsed = true;
+      }
+      tk.near = tk.near || raw < ARM_MM;
+      sensor(t, j)->tune(tk.window->exit_hi());
+      if (m_cal != NULL) {
+        m_cal->add(t, j, dist);
+      }
+      if (m_correlate && (j == 0 || j == last)) {
+        tk.xc.add(j == 0 ? 0 : 1, raw, when);
+      }
+#if PROFILE
+      profile.addAge(micros() - when);
 #endif
-        m_sense_when = now;
-        m_state = eSenseB;
+      if (tk.window->within((uint8_t) dist, tk.win[j])) {
+        tk.det |= 1 << j;
+      } else {
+        if ((tk.det & (1 << j)) && (j == 0 || j == last)) {
+          leave(t, j);
+        }
+        tk.det &= ~(1 << j);
+      }
+#if TELEMETRY
+      if (j == 0) {
+        distA = dist;
+      } else if (j == last) {
+        distB = dist;
       }
-      
-    } else if (m_state == eSenseA) {
-
-      // Detection on sensor A, now watch only for detection on sensor B.
-      
-      // How much time has elapsed since detect on A?
-      uint32_t now = millis();
-      uint32_t elapsed = now - m_sense_when;
-      // If detection on B...
-      if (m_detB) {
-        // ... calculate speed from elapsed time and flag as updated.
-        m_speed = calcScaleSpeed(elapsed);
-        m_updated = true;
-#if TRACE
-#if STREAMING
-        Serial << now << " UPDATED 1 " << elapsed << " " << m_speed << endl;
-#else
-        Serial.print(now);
-        Serial.print(" UPDATED 1 ");
-        Serial.print(elapsed);
-        Serial.print(" ");
-        Serial.println(m_speed);
 #endif
+    }
+  }
+  if (m_tuning) {
+    // A track's sensors share the longest time any is tuned to, so that
+    // weak returns, at the edges of cars, are cut off alike at each.
+    uint8_t msec = TUNE_MIN_MSEC;
+    for (uint8_t j = 0; j < m_nsens; ++j) {
+      uint8_t m = sensor(t, j)->tuner().msec();
+      msec = m > msec ? m : msec;
+    }
+    for (uint8_t j = 0; j < m_nsens; ++j) {
+      sensor(t, j)->set_convergence(msec);
+    }
+  }
+#if TELEMETRY
+  record(t, TelemetryRecord::eSample, tk.state, micros(), 0L, distA, distB,
+         ((fresh & 1) ? TELEMETRY_FRESH_A : 0) | ((fresh >> last) & 1 ? TELEMETRY_FRESH_B : 0));
 #endif
-        // Now begin timeout period.
-        m_sense_when = now;
-        m_state = eUpdated;
-      } else {
-        // ... otherwise, clear measuring of interval if we've waited too long.
-        if (elapsed > timeout_msec()) {
-          m_speed = 0.0;
-#if TRACE
-#if STREAMING
-          Serial << now << " ACTIVE 1" << endl;
-#else
-          Serial.print(now);
-          Serial.println(" ACTIVE 1");
+
+}
+
+#if TELEMETRY
+// Private method
+// Log a telemetry record of a track's state, and of the distances just
+// read from sensors A and B if any.  Distances too far to fit a byte are
+// logged as 255.
+void Speedometer::record(const uint8_t t, const uint8_t kind, const uint8_t state,
+                         const uint32_t when, const uint32_t aux,
+                         const uint32_t distA, const uint32_t distB,
+                         const uint8_t fresh) {
+  TelemetryRecord* rec = telemetry.claim(kind, t);
+  if (rec == NULL) {
+    return;
+  }
+  const Track& tk = m_tracks[t];
+  rec->info |= fresh | ((tk.det & 1) ? TELEMETRY_DET_A : 0)
+    | ((tk.det >> (m_nsens - 1)) & 1 ? TELEMETRY_DET_B : 0);
+  rec->state = state;
+  rec->t_usec = when;
+  rec->aux = aux;
+  rec->distA = distA > 0xFF ? 0xFF : (uint8_t) distA;
+  rec->distB = distB > 0xFF ? 0xFF : (uint8_t) distB;
+  rec->speed = tk.result.mean;
+  telemetry.commit(rec);
+}
 #endif
+
+// Private method
+// Note that a track's sensor j has been crossed, at the time its filtered
+// range entered the window, and return that time.  The first crossing of
+// a pass (tk.crossed clear) starts it and sets its direction; each later
+// one gives the speed over the segment since the one before, and adds to
+// the least-squares sums, so nothing but running totals is kept.
+uint32_t Speedometer::cross(const uint8_t t, const uint8_t j) {
+  Track& tk = m_tracks[t];
+  uint32_t when = sensor(t, j)->crossing_time(tk.window->entry_lo(), tk.window->entry_hi());
+  if (tk.crossed == 0) {
+    tk.sense_when = when;
+    memset(tk.sum_tn, 0, sizeof tk.sum_tn);
+    memset(tk.sum_utn, 0, sizeof tk.sum_utn);
+    memset(&tk.fit, 0, sizeof tk.fit);
+    memset(tk.leave_when, 0, sizeof tk.leave_when);
+    memset(tk.leaves, 0, sizeof tk.leaves);
+    tk.lapsed = false;
+    tk.fit.direction = (j == 0) ? 1 : -1;
+  } else {
+    uint8_t lo = (j < tk.last) ? j : tk.last;
+    uint8_t hi = (j < tk.last) ? tk.last : j;
+    uint32_t dt = when - tk.last_when;
+    uint32_t speed = (dt == 0) ? UINT16_MAX : m_mm_k * (m_pos[hi] - m_pos[lo]) / dt;
+    tk.fit.segment[lo] = speed > UINT16_MAX ? UINT16_MAX : (uint16_t) speed;
+  }
+  float u = (float) m_pos[j] / m_spacing;
+  if (tk.fit.direction < 0) {
+    u = 1.0 - u;
+  }
+  float dt = (float) (when - tk.sense_when) * 1.0e-3;
+  float dtn = 1.0;
+  for (uint8_t n = 0; n < 4; ++n) {
+    if (n < 3) {
+      tk.sum_utn[n] += u * dtn;
+    }
+    dtn *= dt;
+    tk.sum_tn[n] += dtn;
+  }
+  if (m_correlate && (j == 0 || j == m_nsens - 1)) {
+    tk.xc.crossed(j == 0 ? 0 : 1);
+  }
+  tk.crossed |= 1 << j;
+  ++tk.fit.crossings;
+  tk.last = j;
+  tk.last_when = when;
+  return when;
+}
+
+// Private method
+// Note crossings of any sensors between A and B, while a pass is under way.
+void Speedometer::watch(const uint8_t t) {
+  Track& tk = m_tracks[t];
+  for (uint8_t j = 1; j < m_nsens - 1; ++j) {
+    uint8_t bit = 1 << j;
+    if ((tk.det & bit) && !(tk.crossed & bit)) {
+      cross(t, j);
+    }
+  }
+}
+
+// Private method
+// Note that a track's sensor A or B (j) has just left the window, at the
+// time its filtered range crossed the window's exit level.  Only the last
+// time each leaves in a pass counts, when the train's tail goes by; those
+// between are gaps between cars.  The last sensor's n-th departure is the
+// same edge as the first's, so once it has left as often as the first,
+// which is clear, the two times are of one trailing edge; as a rule the
+// train's tail, or, with gaps between cars longer than the sensors'
+// spacing, a car's.  That completes the pass's result, unless either was
+// out of service or failed a read during the pass and may have missed an
+// edge, or the edge took less than half or more than twice as long as
+// the front did; a sensor which hung before it was taken out of service
+// misses one too.
+void Speedometer::leave(const uint8_t t, const uint8_t j) {
+  Track& tk = m_tracks[t];
+  if (tk.crossed & (1 << j)) {
+    // Entering from below is leaving upwards, and entering from above
+    // leaving downwards.
+    uint8_t k = (j == 0) ? 0 : 1;
+    tk.leave_when[k] =
+      sensor(t, j)->crossing_time(tk.window->exit_hi(), tk.window->exit_lo());
+    if (tk.leaves[k] < UINT8_MAX) {
+      ++tk.leaves[k];
+    }
+    uint8_t first = (tk.fit.direction > 0) ? 0 : 1;
+    uint8_t first_bit = first ? 1 << (m_nsens - 1) : 1;
+    uint32_t dt = tk.leave_when[k] - tk.leave_when[first];
+    uint32_t span = tk.summary.span_usec;
+    if (tk.trailing && !tk.correlating && !tk.lapsed && k != first
+        && tk.leaves[k] == tk.leaves[first] && !(tk.det & first_bit)
+        && dt > span / 2 && dt < 2 * span) {
+      endResult(t);
+    }
+  }
+}
+
+// Private method
+// Fit u, the fraction of the span travelled, as a quadratic in crossing
+// time t by least squares over the pass's crossings (a straight line if
+// only two), and take speed and acceleration from it.  Under steady
+// acceleration u is exactly quadratic in t, so the speed is that of the
+// train at the middle of the span, not its average across it.
+// Returns speed at the end of the span (mm/usec).
+float Speedometer::fitPass(const uint8_t t) {
+  Track& tk = m_tracks[t];
+  SpeedProfile& fit = tk.fit;
+  const float n = fit.crossings;
+  const float* st = tk.sum_tn;    // st[k] = sum of t^(k + 1)
+  const float* su = tk.sum_utn;   // su[k] = sum of u t^k
+  float c0, c1, c2;               // u = c0 + c1 t + c2 t^2
+  float det = 0.0;
+  if (fit.crossings >= 3) {
+    det = n * (st[1] * st[3] - st[2] * st[2]) - st[0] * (st[0] * st[3] - st[2] * st[1])
+      + st[1] * (st[0] * st[2] - st[1] * st[1]);
+  }
+  if (det != 0.0) {
+    c0 = (su[0] * (st[1] * st[3] - st[2] * st[2]) - st[0] * (su[1] * st[3] - st[2] * su[2])
+          + st[1] * (su[1] * st[2] - st[1] * su[2])) / det;
+    c1 = (n * (su[1] * st[3] - st[2] * su[2]) - su[0] * (st[0] * st[3] - st[2] * st[1])
+          + st[1] * (st[0] * su[2] - su[1] * st[1])) / det;
+    c2 = (n * (st[1] * su[2] - su[1] * st[2]) - st[0] * (st[0] * su[2] - su[1] * st[1])
+          + su[0] * (st[0] * st[2] - st[1] * st[1])) / det;
+  } else {
+    c1 = (n * su[1] - st[0] * su[0]) / (n * st[1] - st[0] * st[0]);
+    c0 = (su[0] - c1 * st[0]) / n;
+    c2 = 0.0;
+  }
+  // du/dt = c1 + 2 c2 t, so (du/dt)^2 = c1^2 + 4 c2 (u - c0), and
+  // d2u/dt2 = 2 c2, in spans per msec and per msec^2 (a span per msec^2
+  // being span mm/usec per sec).
+  float v2 = c1 * c1 + 4.0 * c2 * (0.5 - c0);
+  float v = (v2 > 0.0) ? sqrt(v2) * m_spacing * 1.0e-3 : 0.0;  // mm/usec
+  float units = (float) m_mm_k / SPEED_FRAC;      // scale units per mm/usec
+  fit.speed = v * units;
+  fit.accel = 2.0 * c2 * m_spacing * units;
+  v2 = c1 * c1 + 4.0 * c2 * (1.0 - c0);
+  return (v2 > 0.0) ? sqrt(v2) * m_spacing * 1.0e-3 : 0.0;
+}
+
+// Private method
+// Start summing up a pass whose speed has just been measured: the front
+// of the train has reached the last sensor, which it took span_usec to
+// reach from the first, at exit_speed (mm/usec).
+void Speedometer::beginSummary(const uint8_t t, const uint32_t span_usec,
+                               const float exit_speed) {
+  Track& tk = m_tracks[t];
+  memset(&tk.summary, 0, sizeof tk.summary);
+  tk.summary.span_usec = span_usec;
+  tk.exit_speed = exit_speed;
+  tk.summary.gap_min_usec = UINT32_MAX;
+  tk.summing = true;
+  tk.gap = false;
+}
+
+// Private method
+// Follow the last sensor crossed while the train goes by.  Each time it
+// clears and then detects again is a gap between cars; the summary keeps
+// only their number, sum and extremes.  Runs straight after the sample
+// which changed the sensor's detection, so both ends of a gap are timed
+// from its samples, as the front's crossing was, and not from when the
+// loop got round to them.
+void Speedometer::followSummary(const uint8_t t) {
+  Track& tk = m_tracks[t];
+  PassSummary& sum = tk.summary;
+  const Sensor* s = sensor(t, tk.last);
+  if (!s->in_service()) {
+    // Detection cleared by a fault is no gap.
+    return;
+  }
+  bool on = (tk.det & (1 << tk.last)) != 0;
+  if (!on && !tk.gap) {
+    tk.clear_when = s->crossing_time(tk.window->exit_hi(), tk.window->exit_lo());
+    tk.gap = true;
+  } else if (on && tk.gap) {
+    uint32_t gap = s->crossing_time(tk.window->entry_lo(), tk.window->entry_hi())
+      - tk.clear_when;
+    if (gap < sum.gap_min_usec) {
+      sum.gap_min_usec = gap;
+    }
+    if (gap > sum.gap_max_usec) {
+      sum.gap_max_usec = gap;
+    }
+    sum.gap_mean_usec += gap;     // sum until endSummary()
+    if (sum.cars < UINT8_MAX) {
+      ++sum.cars;                 // gaps until endSummary()
+    }
+    tk.gap = false;
+  }
+}
+
+// Private method
+// Finish the summary once all sensors have stayed clear: the tail left
+// the last sensor when it last cleared, and the train is taken to have
+// kept the speed it had on reaching it.
+void Speedometer::endSummary(const uint8_t t) {
+  Track& tk = m_tracks[t];
+  PassSummary& sum = tk.summary;
+  uint32_t occupied = tk.clear_when - tk.last_when;   // last sensor only
+  sum.occupied_usec = sum.span_usec + occupied;
+  float length = tk.exit_speed * occupied;
+  sum.length_mm = (length > UINT16_MAX) ? UINT16_MAX : (uint16_t) (length + 0.5);
+  sum.length = length * m_scale * 1.0e-3 * (m_metric ? 1.0 : FT_PER_M);
+  if (sum.cars == 0) {
+    sum.gap_min_usec = 0L;
+  } else {
+    sum.gap_mean_usec /= sum.cars;
+  }
+  if (sum.cars < UINT8_MAX) {
+    ++sum.cars;
+  }
+  if (tk.trailing) {
+    endResult(t);
+  }
+  tk.summing = false;
+  tk.summarized = true;
+}
+
+// Private method
+// Start a pass's result with its leading speed, which stands alone until
+// the tail has gone by.
+void Speedometer::beginResult(const uint8_t t, const uint16_t speed) {
+  Track& tk = m_tracks[t];
+  SpeedResult& res = tk.result;
+  res.direction = tk.fit.direction;
+  res.lead = speed;
+  res.trail = 0;
+  res.mean = speed;
+  res.agree = false;
+  tk.trailing = true;
+  tk.resulted = false;
+}
+
+// Private method
+// Complete a pass's result with its trailing speed: the tail took as long
+// to go from the first sensor to the last as the front did, at the same
+// speed.  Both must have left this pass.
+void Speedometer::endResult(const uint8_t t) {
+  Track& tk = m_tracks[t];
+  SpeedResult& res = tk.result;
+  res.trail = 0;
+  if (tk.leaves[0] != 0 && tk.leaves[1] != 0) {
+    uint8_t first = (tk.fit.direction > 0) ? 0 : 1;
+    uint32_t dt = tk.leave_when[1 - first] - tk.leave_when[first];
+    if ((int32_t) dt > 0 && dt <= m_timeout_usec) {
+      res.trail = calcScaleSpeedFixed(dt);
+    }
+  }
+  if (res.trail != 0) {
+    res.mean = ((uint32_t) res.lead + res.trail) / 2;
+    uint16_t diff = (res.lead > res.trail) ? res.lead - res.trail : res.trail - res.lead;
+    res.agree = diff <= res.mean / SPEED_AGREE;
+  } else {
+    res.mean = res.lead;
+    res.agree = false;
+  }
+  tk.trailing = false;
+  tk.resulted = true;
+}
+
+// Run one step of a track's finite state machine on its latest detections.
+void Speedometer::step(const uint8_t t) {
+
+  Track& tk = m_tracks[t];
+  const bool detA = (tk.det & 1) != 0;
+  const bool detB = (tk.det & (1 << (m_nsens - 1))) != 0;
+
+  // Finite state machine logic: Action taken on this pass through
+  // loop() depends on current value of tk.state.  If state change required,
+  // tk.state is updated in this pass but not acted upon until next pass.
+
+  if (tk.summing) {
+    followSummary(t);
+  }
+
+  if (tk.state == eClear) {
+
+    // Waiting for detection on only one of sensors A and B.  Detect on
+    // both from this state is spurious and will be rejected.
+    
+    if (detA && detB) {
+      // Spurious double-detect
+#if TELEMETRY
+      record(t, TelemetryRecord::eState, eClearing, micros(), 0L);
 #endif
-          m_state = eActive;
-        }
-      }
-      
-    } else if (m_state == eSenseB) {
-      
-      // Detection on sensor B, now watch only for detection on sensor A.
-      
-      // How much time has elapsed since detect on B?
-      uint32_t now = millis();
-      uint32_t elapsed = now - m_sense_when;
-      // If detection on A...
-      if (m_detA) {
-        /// ... calculate speed from elapsed time and flag as updated.
-        m_speed = calcScaleSpeed(elapsed);
-        m_updated = true;
-#if TRACE
-#if STREAMING
-        Serial << now << " UPDATED 2 " << elapsed << " " << m_speed << endl;
+      tk.state = eClearing;
+    } else if (detA && !detB) {
+      // Detect on only sensor A, mark the time it crossed into the
+      // window (starting the pass) and change state to "Sensed A".
+      tk.crossed = 0;
+#if TELEMETRY
+      uint32_t now = cross(t, 0);
+      record(t, TelemetryRecord::eState, eSenseA, now, 0L);
 #else
-        Serial.print(now);
-        Serial.print(" UPDATED 2 ");
-        Serial.print(elapsed);
-        Serial.print(" ");
-        Serial.println(m_speed);
-#endif
+      cross(t, 0);
 #endif
-        // Now begin timeout period.
-        m_sense_when = now;
-        m_state = eUpdated;
-      } else {
-        // ... otherwise, clear measuring of interval if we've waited too long.
-        if (elapsed > timeout_msec()) {
-          m_speed = 0.0;
-#if TRACE
-#if STREAMING
-          Serial << now << " ACTIVE 2" << endl;
+      tk.state = eSenseA;
+    } else if (!detA && detB) {
+      // Detect on only sensor B, mark the time it crossed into the
+      // window (starting the pass) and change state to "Sensed B".
+      tk.crossed = 0;
+#if TELEMETRY
+      uint32_t now = cross(t, m_nsens - 1);
+      record(t, TelemetryRecord::eState, eSenseB, now, 0L);
 #else
-          Serial.print(now);
-          Serial.println(" ACTIVE 2");
+      cross(t, m_nsens - 1);
 #endif
+      tk.state = eSenseB;
+    }
+    
+  } else if (tk.state == eSenseA) {
+
+    // Detection on sensor A, now watch for detection on any sensors
+    // between and on sensor B.
+    watch(t);
+    
+    // How much time has elapsed since detect on A?
+    uint32_t now = micros();
+    uint32_t elapsed = now - tk.sense_when;
+    // If detection on B...
+    if (detB) {
+      // ... take elapsed time between the two window crossings, ...
+      // ... calculate speed from elapsed time and flag as updated.
+      elapsed = cross(t, m_nsens - 1) - tk.sense_when;
+      tk.fit.edge_speed = calcScaleSpeedFixed(elapsed);
+      beginResult(t, tk.fit.edge_speed);
+      beginSummary(t, elapsed, fitPass(t));
+      // With correlation, the speed waits for the last sensor's profile.
+      tk.correlating = m_correlate;
+      tk.updated = !m_correlate;
+#if TELEMETRY
+      record(t, TelemetryRecord::eState, eUpdated, now, elapsed);
 #endif
-          m_state = eActive;
-        }
+      // Now begin timeout period.
+      tk.sense_when = now;
+      tk.state = eUpdated;
+    } else {
+      // ... otherwise, clear measuring of interval if we've waited too long.
+      if (elapsed > m_timeout_usec) {
+        memset(&tk.result, 0, sizeof tk.result);
+#if TELEMETRY
+        record(t, TelemetryRecord::eState, eActive, now, 0L);
+#endif
+        tk.state = eActive;
       }
-      
-    } else if (m_state == eUpdated) {
-
-      // Speed has been measured, waiting for display to be updated from
-      // sketch's loop() function.
-      
-      if (!m_updated) {
-        // Display has been updated, can now begin wait for both sensors to
-        // clear to no-detect status.
-#if TRACE
-        uint32_t now = millis();
-#if STREAMING
-        Serial << now << " " << m_detA << " " << m_detB << " ACTIVE 3" << endl;
-#else
-        Serial.print(now);
-        Serial.print(" ");
-        Serial.print(m_detA);
-        Serial.print(" ");
-        Serial.print(m_detB);
-        Serial.println(" ACTIVE 3");
+    }
+    
+  } else if (tk.state == eSenseB) {
+    
+    // Detection on sensor B, now watch for detection on any sensors
+    // between and on sensor A.
+    watch(t);
+    
+    // How much time has elapsed since detect on B?
+    uint32_t now = micros();
+    uint32_t elapsed = now - tk.sense_when;
+    // If detection on A...
+    if (detA) {
+      // ... take elapsed time between the two window crossings, ...
+      /// ... calculate speed from elapsed time and flag as updated.
+      elapsed = cross(t, 0) - tk.sense_when;
+      tk.fit.edge_speed = calcScaleSpeedFixed(elapsed);
+      beginResult(t, tk.fit.edge_speed);
+      beginSummary(t, elapsed, fitPass(t));
+      // With correlation, the speed waits for the last sensor's profile.
+      tk.correlating = m_correlate;
+      tk.updated = !m_correlate;
+#if TELEMETRY
+      record(t, TelemetryRecord::eState, eUpdated, now, elapsed);
 #endif
+      // Now begin timeout period.
+      tk.sense_when = now;
+      tk.state = eUpdated;
+    } else {
+      // ... otherwise, clear measuring of interval if we've waited too long.
+      if (elapsed > m_timeout_usec) {
+        memset(&tk.result, 0, sizeof tk.result);
+#if TELEMETRY
+        record(t, TelemetryRecord::eState, eActive, now, 0L);
 #endif
-//        m_sense_when = now;
-        m_state = eActive;
+        tk.state = eActive;
       }
-      
-    } else if (m_state == eActive) {
-
-      // Waiting for both sensors to return to no-detect state.
+    }
+    
+  } else if (tk.state == eUpdated) {
 
-      if (!m_detA && !m_detB) {
-        // Sensors cleared, begin timeout period before restarting state machine.
-        m_sense_when = millis();
-#if TRACE
-#if STREAMING
-//        Serial << m_sense_when << " " << m_detA << " " << m_detB << " CLEARING 4" << endl;
-#else
-//        Serial.print(m_sense_when);
-//        Serial.print(" ");
-//        Serial.print(m_detA);
-//        Serial.print(" ");
-//        Serial.print(m_detB);
-//        Serial.println(" CLEARING 4");
+    // Speed has been measured, waiting for display to be updated from
+    // sketch's loop() function.  With correlation, the profiles are
+    // matched first, once the last sensor has kept its samples; the speed
+    // from the crossings stands if they do not match, or if the samples
+    // never come because an end sensor is out of service or the longest
+    // wait for a second sensor has run out.
+    
+    if (tk.correlating) {
+      uint8_t ends = 1 | (1 << (m_nsens - 1));
+      bool ready = tk.xc.ready();
+      if (ready || (tk.live & ends) != ends
+          || (micros() - tk.sense_when) > m_timeout_usec) {
+        uint32_t dt;
+        if (ready && tk.xc.estimate(tk.fit.direction, dt)) {
+          tk.fit.xc_speed = calcScaleSpeedFixed(dt);
+          tk.result.lead = tk.fit.xc_speed;
+          tk.result.mean = tk.result.lead;
+        }
+        tk.xc.rearm();
+        tk.correlating = false;
+        tk.updated = true;
+      }
+    } else if (!tk.updated) {
+      // Display has been updated, can now begin wait for all sensors to
+      // clear to no-detect status.
+#if TELEMETRY
+      record(t, TelemetryRecord::eState, eActive, micros(), 0L);
 #endif
+//        tk.sense_when = now;
+      tk.state = eActive;
+    }
+    
+  } else if (tk.state == eActive) {
+
+    // Waiting for all sensors to return to no-detect state.
+
+    if (tk.det == 0) {
+      // Sensors cleared, begin timeout period before restarting state machine.
+      tk.sense_when = micros();
+#if TELEMETRY
+      record(t, TelemetryRecord::eState, eClearing, tk.sense_when, 0L);
 #endif
-        m_state = eClearing;
-      }
+      tk.state = eClearing;
+    }
 
-    } else if (m_state == eClearing) {
+  } else if (tk.state == eClearing) {
 
-      // If either sensor detects during wait-for-clear state, restart timeout period.
+    // If any sensor detects during wait-for-clear state, restart timeout period.
 
-      uint32_t now = millis();
-      if (m_detA || m_detB) {
-        // Uh-oh, sensor(s) detected during timeout period.
-        m_state = eActive;
-      } else if ((now - m_sense_when) > TIMEOUT_CLEAR) {
-        // Timeout period completed, go back to initial state.
-#if TRACE
-#if STREAMING
-        Serial << now << " CLEAR" << endl;
-#else
-        Serial.print(now);
-        Serial.println(" CLEAR");
+    uint32_t now = micros();
+    if (tk.det != 0) {
+      // Uh-oh, sensor(s) detected during timeout period.
+#if TELEMETRY
+      record(t, TelemetryRecord::eState, eActive, now, 0L);
 #endif
-#endif
-        m_state = eClear;
+      tk.state = eActive;
+    } else if ((now - tk.sense_when) > TIMEOUT_CLEAR * 1000L) {
+      // Timeout period completed, go back to initial state.
+      if (tk.summing) {
+        endSummary(t);
       }
-      
+      tk.xc.rearm();
+#if TELEMETRY
+      record(t, TelemetryRecord::eState, eClear, now, 0L);
+#endif
+      tk.state = eClear;
     }
     
-    // Turn on built-in LED if one sensor detected and waiting for other one.
-    bool led_on = (m_state == eSenseA) || (m_state == eSenseB);
-    digitalWrite(LED_BUILTIN, led_on ? HIGH : LOW);
-    return true;
-    
   }
   
-  // We get here if it wasn't time for StateMachine to update.
-  return false;
-  
+  // Turn on built-in LED if, on any track, one sensor detected and
+  // waiting for other one.
+  bool led_on = false;
+  for (uint8_t i = 0; i < m_ntracks; ++i) {
+    led_on = led_on || (m_tracks[i].state == eSenseA) || (m_tracks[i].state == eSenseB);
+  }
+  digitalWrite(LED_BUILTIN, led_on ? HIGH : LOW);
+
 }
 
 // Set scale option.
 void Speedometer::setScale(E_Scale s) {
-  m_scale = s;
+  if (s != m_scale) {
+    m_scale = s;
+    setConstants();
+  }
 }
 
 // Set metric/imperial speed choice.
 void Speedometer::setMetric(bool m) {
-  m_metric = m;
+  if (m != m_metric) {
+    m_metric = m;
+    setConstants();
+  }
+}
+
+// Set distances (mm) from each sensor to the next, m_nsens - 1 of them,
+// the same along every track.  Returns false, changing nothing, if any
+// is zero or they add up to more than MAX_SPAN_MM.
+bool Speedometer::setSpacings(const uint16_t* mm) {
+  uint16_t pos[MAX_TRACK_SENSORS];
+  pos[0] = 0;
+  for (uint8_t j = 1; j < m_nsens; ++j) {
+    if (mm[j - 1] == 0 || mm[j - 1] > MAX_SPAN_MM - pos[j - 1]) {
+      return false;
+    }
+    pos[j] = pos[j - 1] + mm[j - 1];
+  }
+  memcpy(m_pos, pos, m_nsens * sizeof pos[0]);
+  m_spacing = m_pos[m_nsens - 1];
+  setConstants();
+  return true;
+}
+
+// Set when single-shot measurements are triggered, and how often an idle
+// track is sampled under eAdaptive.  No effect in continuous mode, where
+// the sensors time their own measurements.
+void Speedometer::setSampling(const E_Sampling policy, const uint16_t idle_msec) {
+  m_sampling = policy;
+  m_idle_usec = idle_msec * 1000UL;
 }
 
-// Set window of ranges accepted for valid detection.
+// Set window of ranges accepted for valid detection on every track.
 void Speedometer::setWindow(RangeWindow<uint8_t>* win) {
-  m_window = win;
+  for (uint8_t t = 0; t < MAX_TRACKS; ++t) {
+    m_tracks[t].window = win;
+  }
+}
+
+// Set window of ranges accepted for valid detection on one track.
+void Speedometer::setWindow(const uint8_t t, RangeWindow<uint8_t>* win) {
+  m_tracks[t].window = win;
+}
+
+// Pass every filtered distance to a calibrator, or stop with NULL.
+void Speedometer::setCalibrator(Calibrator* cal) {
+  m_cal = cal;
 }
 
-// Range is considered "inside" window.
+// Report each pass's speed from correlating the profiles of the first
+// and last sensors (Correlator.h), a few samples after the last sensor
+// is crossed, instead of from the window crossings alone.
+void Speedometer::setCorrelation(const bool on) {
+  m_correlate = on;
+}
+
+// Tune each sensor's max convergence time to the stock its track's window
+// sees (ConvergenceTuner.h), for the highest sample rate which still
+// ranges it, or stop tuning.  Call after begin().  No effect in continuous
+// mode, where the ranging period, not the measurement, sets the rate.
+void Speedometer::setTuning(const bool on) {
+  m_tuning = on && !m_continuous;
+  for (uint8_t t = 0; t < m_ntracks; ++t) {
+    for (uint8_t j = 0; j < m_nsens; ++j) {
+      sensor(t, j)->set_tuning(m_tuning);
+    }
+  }
+}
+
+// Range is considered "inside" track 0's window.
 bool Speedometer::inWindow(const uint8_t range) const {
-  return m_window->within(range);
+  return m_tracks[0].window->within(range);
 }
 
 // Calculate speed from:
-//   - elapsed time (msec)
+//   - elapsed time (usec)
 //   - sensor spacing (mm)
 //   - scale factor (87, 150, 160, ...)
 //   - units (km/hr or mi/hr)
-double Speedometer::calcScaleSpeed(const uint32_t dt_msec) const {
-  double m_per_sec = (double) m_spacing / (double) dt_msec;
+double Speedometer::calcScaleSpeed(const uint32_t dt_usec) const {
+  double m_per_sec = (double) m_spacing * 1.0e3 / (double) dt_usec;
   double scale_speed = m_per_sec * (double) m_scale;
   double km_per_hr = scale_speed * 3.6;
   return km_per_hr * (m_metric ? 1.0 : MI_PER_KM);
 }
 
-// Return true exactly once if measured speed has been updated.
-bool Speedometer::isUpdated() {
-  if (m_updated) {
-    m_updated = false;
+// Calculate speed in fixed point (1/SPEED_FRAC scale mi/hr or km/hr) from
+// elapsed time (usec) with a single integer divide, limited to what a
+// uint16_t holds.  The result is truncated, so that rounding it to whole
+// units, as (speed + SPEED_FRAC/2) / SPEED_FRAC, rounds the exact speed.
+uint16_t Speedometer::calcScaleSpeedFixed(const uint32_t dt_usec) const {
+  if (dt_usec == 0) {
+    return UINT16_MAX;
+  }
+  uint32_t speed = m_speed_k / dt_usec;
+  return speed > UINT16_MAX ? UINT16_MAX : (uint16_t) speed;
+}
+
+// Calculate timeout (usec) waiting for second sensor in floating point:
+// the time to cross the sensor spacing at 1 scale mi/hr or km/hr, the
+// slowest speed the display shows.
+double Speedometer::calcTimeout() const {
+  double scale_min_speed = 1.0;   // limited by display
+  double scale_min_km_per_hr = scale_min_speed * (m_metric ? 1.0 : (1.0 / MI_PER_KM));
+  double scale_m_per_sec = scale_min_km_per_hr / 3.6;
+  double m_per_sec = scale_m_per_sec / (double) m_scale;
+  double mm_per_usec = m_per_sec * 1.0e-3;
+  return m_spacing / mm_per_usec;
+}
+
+// Get cached timeout (usec) for current scale and units.
+uint32_t Speedometer::getTimeout() const {
+  return m_timeout_usec;
+}
+
+// Get number of tracks served.
+uint8_t Speedometer::getTracks() const {
+  return m_ntracks;
+}
+
+// Get number of sensors along each track.
+uint8_t Speedometer::getSensors() const {
+  return m_nsens;
+}
+
+// Return true exactly once if track's measured speed has been updated.
+bool Speedometer::isUpdated(const uint8_t t) {
+  Track& tk = m_tracks[t];
+  if (tk.updated) {
+    tk.updated = false;
+    return true;
+  } else {
+    return false;
+  }
+}
+
+// Get track's measured speed in currently selected units, taking the
+// middle of the interval the truncated fixed-point speed stands for: the
+// leading speed, then the mean of both once the tail has gone by.
+double Speedometer::getSpeed(const uint8_t t) {
+  m_tracks[t].updated = false;
+  return ((double) m_tracks[t].result.mean + 0.5) / SPEED_FRAC;
+}
+
+// Get track's measured speed in 1/SPEED_FRAC of currently selected units.
+uint16_t Speedometer::getSpeedFixed(const uint8_t t) {
+  m_tracks[t].updated = false;
+  return m_tracks[t].result.mean;
+}
+
+// Get profile of track's last measured pass: speeds between neighbouring
+// sensors, and the least-squares speed and acceleration over all of them.
+const Speedometer::SpeedProfile& Speedometer::getProfile(const uint8_t t) const {
+  return m_tracks[t].fit;
+}
+
+// Return true exactly once if track's pass summary has been updated.
+bool Speedometer::isSummarized(const uint8_t t) {
+  Track& tk = m_tracks[t];
+  if (tk.summarized) {
+    tk.summarized = false;
     return true;
   } else {
     return false;
   }
 }
 
-// Get measured speed in currently selected units.
-double Speedometer::getSpeed() {
-  m_updated = false;
-  return m_speed;
+// Get summary of track's last pass.
+const Speedometer::PassSummary& Speedometer::getSummary(const uint8_t t) const {
+  return m_tracks[t].summary;
+}
+
+// Return true exactly once if track's pass result is complete, as soon as
+// the tail has left the last sensor, or once all have cleared if it never
+// was seen to.
+bool Speedometer::isResult(const uint8_t t) {
+  Track& tk = m_tracks[t];
+  if (tk.resulted) {
+    tk.resulted = false;
+    return true;
+  } else {
+    return false;
+  }
+}
+
+// Get speeds of track's last pass measured, leading and trailing edges.
+const Speedometer::SpeedResult& Speedometer::getResult(const uint8_t t) const {
+  return m_tracks[t].result;
+}
+
+// Return true if sensor j of track t is in service.
+bool Speedometer::inService(const uint8_t t, const uint8_t j) const {
+  return sensor(t, j)->in_service();
+}
+
+// Get fault and recovery counters of sensor j of track t.
+const SensorHealth& Speedometer::getHealth(const uint8_t t, const uint8_t j) const {
+  return sensor(t, j)->health();
+}
+
+// Get max convergence time tuner of sensor j of track t.
+const ConvergenceTuner& Speedometer::getTuner(const uint8_t t, const uint8_t j) const {
+  return sensor(t, j)->tuner();
 }
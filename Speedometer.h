@@ -6,10 +6,63 @@
 #include "Sensor.h"
 
 #include "RangeWindow.h"
+#include "Calibrator.h"
+#include "Correlator.h"
 
+#include "Telemetry.h"
+#include "Profile.h"
+#include "SramReport.h"
+
+// TRACE prints start-up failures; states and samples at run time are
+// logged as binary records when TELEMETRY (Telemetry.h) is set
 #define TRACE 0
 #define STREAMING 0
 
+// Most sensors in all, one per entry of the wiring table.  Every one
+// takes SRAM whether it is wired or not, and those after the first two
+// need the pins of a Mega 2560, so other AVRs have room for two.
+#ifndef MAX_SENSORS
+#if defined(__AVR__) && !defined(__AVR_ATmega2560__)
+#define MAX_SENSORS 2
+#else
+#define MAX_SENSORS 8
+#endif
+#endif
+
+// Most tracks one Speedometer can serve
+#define MAX_TRACKS (MAX_SENSORS / 2)
+
+// Most sensors along one track
+#define MAX_TRACK_SENSORS (MAX_SENSORS < 4 ? MAX_SENSORS : 4)
+
+// Default separation of neighbouring sensors (mm, equal to 5.0 inches)
+#define SPACING_MM 127
+
+// Longest distance from first to last sensor of a track (mm), so that
+// fixed-point speed constants fit 32 bits
+#define MAX_SPAN_MM 700
+
+// Period at which single-shot sampling polls a track with nothing in
+// sight, under the adaptive policy (msec)
+#define SAMPLE_IDLE_MSEC 20
+
+// Range closer than which a sensor is taken to see something (mm), for
+// waking sampling from its idle period; the VL6180X reports 255 for no
+// target
+#define ARM_MM 200
+
+// Speeds are held in fixed point, in units of 1/SPEED_FRAC of a scale
+// mi/hr or km/hr
+#define SPEED_FRAC 10
+
+// Leading- and trailing-edge speeds of a pass agree when they differ by
+// no more than 1/SPEED_AGREE of their mean
+#define SPEED_AGREE 16
+
+// Conversion factors
+#define MI_PER_KM (0.62137119224)
+#define FT_PER_M (3.2808399)
+
 class Speedometer : public StateMachine {
 
   public:
@@ -17,48 +70,219 @@ class Speedometer : public StateMachine {
     enum E_Scale {
       eUK = 148, eJP = 150, eUS = 160
     };
+
+    // When single-shot measurements are triggered
+    enum E_Sampling {
+      eTicked,          // one track per 5 msec tick, in turn
+      eFastest,         // each track again as soon as it has been read
+      eAdaptive         // as eFastest while any track is armed (not eClear,
+                        // or a sensor sees something), else every idle period
+    };
   
+    // Speeds measured along a track with three or more sensors, in the
+    // direction of travel, and by each estimate of the whole span
+    struct SpeedProfile {
+      uint8_t crossings;    // sensors crossed
+      int8_t direction;     // +1 if sensor 0 was crossed first, -1 if last
+      uint16_t segment[MAX_TRACK_SENSORS - 1];  // fixed-point speed between
+                            // sensors j and j + 1 (0 if not measured)
+      uint16_t edge_speed;  // fixed-point speed from the window crossings
+      uint16_t xc_speed;    // fixed-point speed from correlating the first
+                            // and last sensors' profiles (0 if not found,
+                            // or correlation is off)
+      float speed;          // least-squares speed at middle of span (scale
+                            // mi/hr or km/hr)
+      float accel;          // least-squares acceleration (scale mi/hr or
+                            // km/hr per sec, 0 with fewer than 3 crossings)
+    };
+
+    // Summary of one train's pass, from its front reaching the first
+    // sensor until its tail cleared the last.  Length comes from the time
+    // the last sensor was occupied and the measured speed; gaps are those
+    // seen by the last sensor, each one ending a car.
+    struct PassSummary {
+      uint32_t span_usec;       // time front took from first sensor to last (usec)
+      uint32_t occupied_usec;   // time from front at first sensor to tail clear of last (usec)
+      uint16_t length_mm;       // model length of train (mm)
+      float length;             // scale length (scale m or ft)
+      uint8_t cars;             // cars counted, one more than the gaps
+      uint32_t gap_min_usec;    // shortest gap between cars (usec, 0 if none)
+      uint32_t gap_max_usec;    // longest gap between cars (usec, 0 if none)
+      uint32_t gap_mean_usec;   // mean gap between cars (usec, 0 if none)
+    };
+
+    // Speeds of one pass, from the train's front reaching the first and
+    // last sensors and from its tail leaving them.  The leading speed is
+    // the one shown as soon as it is measured; the rest are filled in
+    // once the tail has left the last sensor, or when the pass summary
+    // is if it never is seen to.  Speeds are fixed point, in 1/SPEED_FRAC
+    // scale mi/hr or km/hr.
+    struct SpeedResult {
+      int8_t direction;     // +1 if sensor 0 was crossed first, -1 if last
+      uint16_t lead;        // speed from the front's window crossings
+      uint16_t trail;       // speed from the tail's window departures (0 if
+                            // not measured)
+      uint16_t mean;        // mean of lead and trail, or lead alone
+      bool agree;           // lead and trail within 1/SPEED_AGREE of mean
+    };
+
   private:
-    // Separation of sensors (mm)
-    const int m_spacing;
-    // Time of most recent first-detect (msec)
-    uint32_t m_sense_when;
-    // Measured speed (scale mi/hr or km/hr)
-    double m_speed;
+    // Distance from first to last sensor of each track (mm)
+    uint16_t m_spacing;
+    // Position of each sensor along a track, from sensor 0 (mm)
+    uint16_t m_pos[MAX_TRACK_SENSORS];
+    // Sensors along each track
+    const uint8_t m_nsens;
     // Model scale (1:148, 1:150, or 1:160)
     E_Scale m_scale;
-    // (Pointer to) Window of range
-    RangeWindow<uint8_t>* m_window;
     // Metric (km/hr) or imperial (mi/hr)
     bool m_metric;
+    // Fixed-point speed is m_speed_k / elapsed usec across the whole span,
+    // or m_mm_k * distance (mm) / elapsed usec, for current scale and units
+    uint32_t m_speed_k;
+    uint32_t m_mm_k;
+    // Longest wait for second sensor (usec), for current scale and units
+    uint32_t m_timeout_usec;
     // State of finite state machine
     enum E_State {
-      eClear,           // waiting for sense on sensor A or B
+      eClear,           // waiting for sense on sensor A (first) or B (last)
       eSenseA,          // sensed on A, waiting for B
       eSenseB,          // sensed on B, waiting for A
       eUpdated,         // speed measured, waiting for display to update
-      eActive,          // waiting for both sensors to clear
+      eActive,          // waiting for all sensors to clear
       eClearing         // waiting for timeout after sensors clear
-    } m_state;
-    bool m_detA;        // sensor A detected
-    bool m_detB;        // sensor B detected
-    bool m_triggered;   // sensor emitters triggered
-    bool m_updated;     // speed measure updated
+    };
+    // State of one track's sensors, kept compact since there is one per
+    // track.  Sensor A is the track's first sensor and B its last; any
+    // between only add crossing times to the pass.
+    struct Track {
+      RangeWindow<uint8_t>* window; // (pointer to) window of range
+      uint32_t sense_when;          // time of most recent first-detect (usec)
+      uint32_t last_when;           // time of latest crossing this pass (usec)
+      float sum_tn[4];              // least-squares sums over this pass's
+      float sum_utn[3];             //   crossings of t^n, n = 1..4, and of
+                                    //   u t^n, n = 0..2, where t is msec
+                                    //   from sense_when and u the fraction
+                                    //   of the span travelled
+      SpeedProfile fit;             // profile of last pass measured
+      PassSummary summary;          // summary of last pass, or one being summed
+      Correlator xc;                // profiles of first and last sensors
+      SpeedResult result;           // speeds of last pass measured
+      uint32_t clear_when;          // time last sensor crossed last left the
+                                    //   window (usec)
+      uint32_t leave_when[2];       // time sensors A and B last left the
+                                    //   window this pass (usec)
+      uint8_t leaves[2];            // times sensors A and B left the window
+                                    //   this pass
+      uint32_t due;                 // time track is next due to be triggered (usec)
+      float exit_speed;             // speed at last sensor crossed (mm/usec)
+      uint8_t state;                // E_State of finite state machine
+      uint8_t win[MAX_TRACK_SENSORS]; // each sensor's state within RangeWindow
+      uint8_t det;                  // sensors detecting, a bit for each
+      uint8_t crossed;              // sensors crossed this pass, a bit for each
+      uint8_t live;                 // sensors in service, a bit for each
+      uint8_t last;                 // sensor crossed most recently
+      bool triggered : 1;           // sensor emitters triggered
+      bool updated : 1;             // speed measure updated
+      bool summing : 1;             // speed measured, waiting for tail to clear
+      bool gap : 1;                 // last sensor crossed clear while summing
+      bool summarized : 1;          // pass summary updated
+      bool trailing : 1;            // result waits for the tail to leave
+      bool lapsed : 1;              // sensor A or B out of service this pass
+      bool resulted : 1;            // pass result complete
+      bool near : 1;                // a sensor saw something in last sample
+      bool correlating : 1;         // speed waits for profiles to be matched
+    };
+    Track m_tracks[MAX_TRACKS];
+    const uint8_t m_ntracks;  // number of tracks in use
+    uint8_t m_next;           // track whose sensors are triggered next
+    uint8_t m_reading;        // track whose sensors are being read, or NO_TRACK
+    uint8_t m_read_live;      // sensors of m_reading being read, a bit for each
+    bool m_asking;            // reads of m_next due, not all yet queued
+    bool m_continuous;        // sensors in continuous ranging mode
+    E_Sampling m_sampling;    // single-shot sampling policy
+    uint32_t m_idle_usec;     // period of an idle track under eAdaptive (usec)
+    Calibrator* m_cal;        // (pointer to) calibrator fed samples, or NULL
+    bool m_correlate;         // report speeds from correlated profiles
+    bool m_tuning;            // tune sensors' max convergence times
 
-    uint32_t timeout_msec() const;
+    void setConstants();
+    bool run();
+    bool runPaced();
+    bool armed() const;
+#if SRAM_REPORT
+    static void sramReport();
+#endif
+    Sensor* sensor(const uint8_t t, const uint8_t j) const;
+    void service(const uint32_t now);
+    void triggerTrack(const uint8_t t);
+    void measure(const uint8_t t, const uint8_t fresh);
+    void sample(const uint8_t t, const uint8_t fresh);
+    void step(const uint8_t t);
+    uint32_t cross(const uint8_t t, const uint8_t j);
+    void watch(const uint8_t t);
+    void leave(const uint8_t t, const uint8_t j);
+    float fitPass(const uint8_t t);
+    void beginSummary(const uint8_t t, const uint32_t span_usec, const float exit_speed);
+    void followSummary(const uint8_t t);
+    void endSummary(const uint8_t t);
+    void beginResult(const uint8_t t, const uint16_t speed);
+    void endResult(const uint8_t t);
+#if TELEMETRY
+    void record(const uint8_t t, const uint8_t kind, const uint8_t state,
+                const uint32_t when, const uint32_t aux,
+                const uint32_t distA = NO_READING, const uint32_t distB = NO_READING,
+                const uint8_t fresh = 0);
+#endif
 
   public:
-    Speedometer(E_Scale s = eJP);
+    // Wiring of one sensor
+    struct SensorPins {
+      byte addr;              // I2C address
+      byte ena;               // GPIO pin of sensor-enable output
+      byte intr;              // GPIO pin of sensor interrupt input
+    };
+    static const SensorPins& sensorPins(const uint8_t i);
+
+    // Constant K for which K / (elapsed usec) is the fixed-point speed.
+    // Crossing the sensor spacing in K / SPEED_FRAC usec is a speed of
+    // one unit, the slowest the display shows, so that is also the timeout.
+    static constexpr uint32_t speedConstant(E_Scale s, bool metric) {
+      return (uint32_t) ((double) SPACING_MM * 1.0e3 * 3.6 * (double) s
+                         * (metric ? 1.0 : MI_PER_KM) * SPEED_FRAC + 0.5);
+    }
+
+    Speedometer(E_Scale s = eJP, const uint8_t tracks = 1, const uint8_t per_track = 2);
     virtual bool update();
-    bool begin();
+    bool begin(const bool continuous = false, const bool async = true);
     void setScale(E_Scale s);
     void setMetric(bool m);
+    void setSampling(const E_Sampling policy, const uint16_t idle_msec = SAMPLE_IDLE_MSEC);
+    bool setSpacings(const uint16_t* mm);
     void setWindow(RangeWindow<uint8_t>* win);
+    void setWindow(const uint8_t t, RangeWindow<uint8_t>* win);
+    void setCalibrator(Calibrator* cal);
+    void setCorrelation(const bool on);
+    void setTuning(const bool on);
     bool inWindow(const uint8_t range) const;
     bool within(const uint8_t range) const;
-    double calcScaleSpeed(const uint32_t dt_msec) const;
-    bool isUpdated();
-    double getSpeed();
+    double calcScaleSpeed(const uint32_t dt_usec) const;
+    uint16_t calcScaleSpeedFixed(const uint32_t dt_usec) const;
+    double calcTimeout() const;
+    uint32_t getTimeout() const;
+    uint8_t getTracks() const;
+    uint8_t getSensors() const;
+    bool isUpdated(const uint8_t t = 0);
+    double getSpeed(const uint8_t t = 0);
+    uint16_t getSpeedFixed(const uint8_t t = 0);
+    const SpeedProfile& getProfile(const uint8_t t = 0) const;
+    bool isSummarized(const uint8_t t = 0);
+    const PassSummary& getSummary(const uint8_t t = 0) const;
+    bool isResult(const uint8_t t = 0);
+    const SpeedResult& getResult(const uint8_t t = 0) const;
+    bool inService(const uint8_t t, const uint8_t j) const;
+    const SensorHealth& getHealth(const uint8_t t, const uint8_t j) const;
+    const ConvergenceTuner& getTuner(const uint8_t t, const uint8_t j) const;
   
 };
 
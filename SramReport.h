@@ -0,0 +1,28 @@
+#ifndef _SRAM_REPORT__H_
+#define _SRAM_REPORT__H_
+
+#include <Arduino.h>
+
+// Set to 1 to have the compiler report the SRAM taken by each object, as
+// warnings of the form
+//   'static void SramBytes<T, N>::of() [with T = Sensor; ... N = 95]'
+//   is deprecated: SRAM report
+// for the board being built for.  The Arduino IDE shows them with
+// "Compiler warnings" set to Default or more.  Nothing is added to the
+// sketch.
+#ifndef SRAM_REPORT
+#define SRAM_REPORT 0
+#endif
+
+#if SRAM_REPORT
+template<typename T, size_t N>
+struct SramBytes {
+  __attribute__((deprecated("SRAM report"))) static void of() {}
+};
+
+// Report the size of type T, or n bytes under the name of tag type T.
+#define SRAM_REPORT_TYPE(T) SramBytes<T, sizeof (T)>::of()
+#define SRAM_REPORT_BYTES(T, n) SramBytes<T, (n)>::of()
+#endif
+
+#endif
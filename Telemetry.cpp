@@ -0,0 +1,95 @@
+#include "Telemetry.h"
+
+#if TELEMETRY
+
+Telemetry telemetry;
+
+// Constructor
+Telemetry::Telemetry() :
+  m_head(0),
+  m_count(0),
+  m_sent(0),
+  m_lost(0),
+  m_dropped(0L)
+{
+}
+
+// Private method
+// Get next free record, with its header filled in.
+TelemetryRecord* Telemetry::slot(const uint8_t kind, const uint8_t track) {
+  TelemetryRecord* rec = &m_ring[(m_head + m_count) % TELEMETRY_RECORDS];
+  memset(rec, 0, sizeof(TelemetryRecord));
+  rec->sync = TELEMETRY_SYNC;
+  rec->info = (kind & TELEMETRY_KIND_MASK) | (track << TELEMETRY_TRACK_SHIFT);
+  return rec;
+}
+
+// Private method
+// Set check byte so that the XOR of the whole record is zero.
+void Telemetry::seal(TelemetryRecord* rec) {
+  const uint8_t* p = (const uint8_t*) rec;
+  uint8_t x = 0;
+  rec->check = 0;
+  for (uint8_t i = 0; i < sizeof(TelemetryRecord); ++i) {
+    x ^= p[i];
+  }
+  rec->check = x;
+}
+
+TelemetryRecord* Telemetry::claim(const uint8_t kind, const uint8_t track) {
+  if (m_lost > 0 && m_count < TELEMETRY_RECORDS - 1) {
+    // Say how many records were lost before logging any more.
+    TelemetryRecord* rec = slot(TelemetryRecord::eDropped, 0);
+    rec->t_usec = micros();
+    rec->aux = m_lost;
+    seal(rec);
+    ++m_count;
+    m_lost = 0;
+  }
+  if (m_count >= TELEMETRY_RECORDS || m_lost > 0) {
+    ++m_lost;
+    ++m_dropped;
+    return NULL;
+  }
+  return slot(kind, track);
+}
+
+void Telemetry::commit(TelemetryRecord* rec) {
+  seal(rec);
+  ++m_count;
+}
+
+// Write queued records to Serial as far as its transmit buffer has room,
+// without blocking.  A record may go out over several calls.
+void Telemetry::drain() {
+  while (m_count > 0) {
+    int room = Serial.availableForWrite();
+    if (room <= 0) {
+      return;
+    }
+    const uint8_t* p = (const uint8_t*) &m_ring[m_head] + m_sent;
+    uint8_t n = sizeof(TelemetryRecord) - m_sent;
+    if (n > room) {
+      n = room;
+    }
+    Serial.write(p, n);
+    m_sent += n;
+    if (m_sent == sizeof(TelemetryRecord)) {
+      m_sent = 0;
+      m_head = (m_head + 1) % TELEMETRY_RECORDS;
+      --m_count;
+    }
+  }
+}
+
+// Get number of records waiting to be written.
+uint8_t Telemetry::pending() const {
+  return m_count;
+}
+
+// Get number of records dropped because the ring was full.
+uint32_t Telemetry::dropped() const {
+  return m_dropped;
+}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef _TELEMETRY__H_
+#define _TELEMETRY__H_
+
+#include <Arduino.h>
+
+// Set to 1 to log binary telemetry records to Serial (115200 baud).
+// The host build may #define it on the command line instead.
+#ifndef TELEMETRY
+#define TELEMETRY 0
+#endif
+
+// Records held in RAM waiting for the UART
+#define TELEMETRY_RECORDS 16
+
+// First byte of every record
+#define TELEMETRY_SYNC 0xA5
+
+// Bits of TelemetryRecord::info
+#define TELEMETRY_KIND_MASK 0x03
+#define TELEMETRY_TRACK_SHIFT 2
+#define TELEMETRY_DET_A 0x10
+#define TELEMETRY_DET_B 0x20
+#define TELEMETRY_FRESH_A 0x40
+#define TELEMETRY_FRESH_B 0x80
+
+// Fixed-size binary record, sent to the UART as it lies in memory
+// (little-endian).  The XOR of all 16 bytes is zero, which together with
+// the sync byte lets a reader find record boundaries in a capture that
+// starts part way through a record or has lost bytes.
+struct TelemetryRecord {
+  enum E_Kind {
+    eSample,          // sensors read and detections made
+    eState,           // track's state machine changed state
+    eDropped          // records lost for want of room; count in aux
+  };
+  uint8_t sync;       // TELEMETRY_SYNC
+  uint8_t info;       // kind (bits 0-1), track (2-3), detect and fresh bits
+  uint8_t state;      // Speedometer state, new state for eState
+  uint8_t check;      // makes XOR of record zero
+  uint32_t t_usec;    // time of sample or state change (usec)
+  uint32_t aux;       // elapsed time of a speed measurement (usec), or count
+  uint8_t distA;      // distance read from sensor A (mm, 255 if none)
+  uint8_t distB;      // distance read from sensor B (mm, 255 if none)
+  uint16_t speed;     // fixed-point speed, as Speedometer::getSpeedFixed()
+};
+
+static_assert(sizeof(TelemetryRecord) == 16, "TelemetryRecord must be 16 bytes");
+
+// Ring buffer of telemetry records.  Logging a record only copies it
+// into RAM; drain() writes as much to Serial as its transmit buffer will
+// take without waiting, and should be called when loop() has nothing
+// better to do.  Records which find the ring full are dropped and
+// counted, and an eDropped record goes out once there is room again.
+class Telemetry {
+
+  private:
+    TelemetryRecord m_ring[TELEMETRY_RECORDS];
+    uint8_t m_head;           // index of oldest record
+    uint8_t m_count;          // records held
+    uint8_t m_sent;           // bytes of oldest record already written
+    uint16_t m_lost;          // records dropped since last eDropped record
+    uint32_t m_dropped;       // records dropped in all
+
+    TelemetryRecord* slot(const uint8_t kind, const uint8_t track);
+    void seal(TelemetryRecord* rec);
+
+  public:
+    Telemetry();
+    // Get a record to fill in, or NULL if the ring is full.  The record
+    // is only logged by commit(), which must come before the next claim().
+    TelemetryRecord* claim(const uint8_t kind, const uint8_t track);
+    void commit(TelemetryRecord* rec);
+    void drain();
+    uint8_t pending() const;
+    uint32_t dropped() const;
+
+};
+
+// Telemetry log written by the Speedometer
+extern Telemetry telemetry;
+
+#endif
@@ -1,8 +1,8 @@
 #include <StateMachine.h>
 
-#include <SparkFun_Alphanumeric_Display.h>
-
 #include "Speedometer.h"
+#include "AlphaDisplay.h"
+#include "PassLog.h"
 
 // If TRACE or STREAMING are #define'd, they're in Speedometer.h
 
@@ -20,13 +20,42 @@
 #define SCALE_PIN 9
 // GPIO pin to select one of two detect ranges
 #define RANGE_PIN 10
+// GPIO pin which, held LOW at reset, recalibrates the detect ranges
+#define CALIBRATE_PIN 11
+
+// Set to 0 to trigger each measurement from the Speedometer's 5 msec tick,
+// as the sketch always has, or 1 to leave sensors ranging continuously
+#define CONTINUOUS 0
+
+// When single-shot measurements are triggered (CONTINUOUS 0): eTicked
+// from the 5 msec tick, eFastest as fast as the sensors allow, or
+// eAdaptive, slowly until a train comes near and then as fast as possible
+#define SAMPLING Speedometer::eTicked
+
+// Set to 1 to take each speed from matching the whole of the first and
+// last sensors' range profiles (Correlator.h), which holds steadier for
+// locomotives with sloping or irregular fronts, 0 for the crossings alone
+#define CORRELATE 0
+
+// Set to 1 to tune each sensor's max convergence time to the passing
+// trains (ConvergenceTuner.h), for a faster single-shot sample rate
+// (CONTINUOUS 0), 0 to keep 8 msec
+#define TUNE_CONVERGENCE 0
 
-// 14-segment 8-character display
-HT16K33 display;
+// Number of tracks (see Speedometer.cpp for the pins used by each sensor;
+// more than two sensors in all need a Mega)
+#define TRACKS 1
+
+// Sensors along each track, 2 to 4.  With three or more the Speedometer
+// also fits speed and acceleration (Speedometer::getProfile()).
+#define SENSORS 2
+
+// 14-segment 8-character display, a pair of 4-character units
+AlphaDisplay display(0x70, 0x71);
 
 // Define Speedometer object with default scale.
 Speedometer::E_Scale scale = Speedometer::eUS;
-Speedometer meter(scale);
+Speedometer meter(scale, TRACKS, SENSORS);
 
 // All units in mm
 // Center of range 1
@@ -42,11 +71,79 @@ Speedometer meter(scale);
 RangeWindow<uint8_t> range_win1(CENTER_1, HWIDTH, HYSTERESIS);  // near track
 RangeWindow<uint8_t> range_win2(CENTER_2, HWIDTH, HYSTERESIS);  // far track
 
+// Finds the detect ranges from passing trains, saved in EEPROM.  Until it
+// has, or if only one track is found, the ranges above are used.
+Calibrator calibrator(0);
+
+// Every speed measured, kept in EEPROM across power cycles and dumped
+// when 'L' is received on the serial port.
+PassLog passlog;
+
+// Print each sensor's samples, faults and recoveries, when 'H' is
+// received on the serial port.
+void printHealth() {
+  Serial.println(F("track,sensor,in_service,samples,failures,timeouts,faults,resets,"
+                   "failed_resets,recoveries,down_ms,recover_max_ms"));
+  for (uint8_t t = 0; t < meter.getTracks(); ++t) {
+    for (uint8_t j = 0; j < meter.getSensors(); ++j) {
+      const SensorHealth& h = meter.getHealth(t, j);
+      Serial.print(t);
+      Serial.print(',');
+      Serial.print(j);
+      Serial.print(',');
+      Serial.print(meter.inService(t, j) ? 1 : 0);
+      Serial.print(',');
+      Serial.print(h.samples);
+      Serial.print(',');
+      Serial.print(h.failures);
+      Serial.print(',');
+      Serial.print(h.timeouts);
+      Serial.print(',');
+      Serial.print(h.faults);
+      Serial.print(',');
+      Serial.print(h.resets);
+      Serial.print(',');
+      Serial.print(h.failed_resets);
+      Serial.print(',');
+      Serial.print(h.recoveries);
+      Serial.print(',');
+      Serial.print(h.down_usec / 1000);
+      Serial.print(',');
+      Serial.println(h.recover_max_usec / 1000);
+    }
+  }
+}
+
+// Draw track t's speed, in 1/SPEED_FRAC units, on the display; it goes
+// out over idle passes of loop().  For example, 123 km/hr is displayed as
+// " 123KPH ", with small gap between two 4-character display units.  With
+// more than one track, the track number (from 1) is shown first, as
+// "1 123KPH".
+void showSpeed(const uint8_t t, const uint16_t speed_fixed, const bool jp_scale) {
+  uint16_t speed = (speed_fixed + SPEED_FRAC / 2) / SPEED_FRAC;
+  uint8_t pos = 0;
+  if (TRACKS > 1) {
+    display.printNumber(0, 1, t + 1);
+    pos = 1;
+  } else {
+    display.putChar(DISPLAY_CHARS - 1, ' ');
+  }
+  display.printNumber(pos, 4, speed);
+  display.printText(pos + 4, jp_scale ? "KPH" : "MPH");
+}
+
+// Move the detect ranges to the windows calibrated, nearest track first.
+void applyCalibration() {
+  RangeWindow<uint8_t>* wins[2] = { &range_win1, &range_win2 };
+  for (uint8_t i = 0; i < calibrator.windows() && i < 2; ++i) {
+    CalWindow w = calibrator.window(i);
+    wins[i]->set(w.center, w.hwidth, w.hysteresis);
+  }
+}
+
 void setup() {
 
-#if TRACE
   Serial.begin(115200);
-#endif
 
   // Initialize I2C interface.
   Wire.begin();
@@ -56,9 +153,22 @@ void setup() {
   pinMode(METRIC_PIN, INPUT_PULLUP);
   pinMode(SCALE_PIN, INPUT_PULLUP);
   pinMode(RANGE_PIN, INPUT_PULLUP);
+  pinMode(CALIBRATE_PIN, INPUT_PULLUP);
+
+  // Use the saved detect ranges, or find them if there are none or
+  // recalibration is asked for.
+  if (digitalRead(CALIBRATE_PIN) == LOW || !calibrator.load()) {
+    calibrator.begin(SENSORS);
+    meter.setCalibrator(&calibrator);
+  } else {
+    applyCalibration();
+  }
 
-  // Try to initialize pair of 4-character displays as single HT16K33 object.
-  if (!display.begin(0x70, 0x71)) {
+  // Find where the pass log left off.
+  passlog.begin();
+
+  // Try to initialize pair of 4-character displays at minimum brightness.
+  if (!display.begin(0)) {   // range [0,15]
     // Display failed to init.
 #if TRACE
 #if STREAMING
@@ -68,15 +178,18 @@ void setup() {
 #endif
 #endif
   } else {
-    // Display initialied, set to minimum brightness.
-    display.setBrightness(0);   // range [0,15]
+    // Display initialized.
     display.print("DISP OK");
+    display.flush();
     delay(500);
   }
 
   // Try to initialize sensors for Speedometer object.
-  if (!meter.begin()) {
-    // Sensor(s) failed to init.  Display error message and halt.
+  meter.setSampling(SAMPLING);
+  meter.setCorrelation(CORRELATE);
+  if (!meter.begin(CONTINUOUS)) {
+    // Sensor(s) failed to init.  Display error message and go on; the
+    // Speedometer sets them up again while the rest sample.
 #if TRACE
 #if STREAMING
     Serial << "meter.begin() failed" << endl;
@@ -85,14 +198,17 @@ void setup() {
 #endif
 #endif
     display.print("SPD ERR");
-    while (true) ;    // do not proceed
+    display.flush();
+    delay(500);
   } else {
     // Sensors initialized.
     display.print("SPD  OK");
+    display.flush();
     delay(500);
   }
+  meter.setTuning(TUNE_CONVERGENCE);
   
-  // Clear display for now.
+  // Clear display for now; loop() sends it.
   display.clear();
 
 }
@@ -109,17 +225,59 @@ void loop() {
     meter.setScale(jp_scale ? Speedometer::eJP : Speedometer::eUS);
     meter.setWindow(digitalRead(RANGE_PIN) == HIGH ? &range_win2 : &range_win1);
     
-    // If measured speed has been updated...
-    if (meter.isUpdated()) {
-      // Write new speed to display.
-      // For example, 123 km/hr is displayed as " 123KPH ", with small gap
-      // between two 4-character display units.
-      char str[9];
-      sprintf(str, "%4d%s",
-              (int) round(meter.getSpeed()), (jp_scale ? "KPH" : "MPH"));
-      display.print(str);
+    // If measured speed has been updated on any track, show the leading
+    // speed at once; once the tail has gone by, show the mean of both and
+    // log it, to be written to EEPROM over idle passes of loop().
+    for (uint8_t t = 0; t < meter.getTracks(); ++t) {
+      if (meter.isUpdated(t)) {
+        showSpeed(t, meter.getSpeedFixed(t), jp_scale);
+      }
+      if (meter.isResult(t)) {
+        const Speedometer::SpeedResult& res = meter.getResult(t);
+        showSpeed(t, res.mean, jp_scale);
+        passlog.add(t, res.direction, res.mean);
+      }
     }
     
   }
+  else {
+    // Nothing else to do this pass, send any changed display segments.
+    display.update();
+    // Move calibration on a step; once it is done, stop feeding it.
+    if (calibrator.active() && calibrator.update()) {
+      applyCalibration();
+    } else if (!calibrator.active()) {
+      meter.setCalibrator(NULL);
+    }
+#if TELEMETRY
+    // Nothing else to do this pass, send telemetry.
+    telemetry.drain();
+#endif
+    // Write the next byte of any speeds logged.
+    passlog.update();
+#if !TELEMETRY
+    // 'L' received asks for the pass log, 'H' for the sensors' health,
+    // any other character for the hot-path counters.
+    if (Serial.available() > 0) {
+      char want = 0;
+      while (Serial.available() > 0) {
+        char c = Serial.read();
+        if (c == 'L' || c == 'H') {
+          want = c;
+        }
+      }
+      if (want == 'L') {
+        passlog.dump();
+      } else if (want == 'H') {
+        printHealth();
+      }
+#if PROFILE
+      else {
+        profile.dump();
+      }
+#endif
+    }
+#endif
+  }
          
 }
@@ -0,0 +1,106 @@
+#ifndef _ARDUINO__H_
+#define _ARDUINO__H_
+
+// Host stand-in for the Arduino core, just large enough to build the
+// sketch's Sensor and Speedometer sources on Linux.  Time, GPIO levels
+// and interrupts are all driven by the simulator in HostSim.h.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#define F_CPU 16000000UL
+
+#define _BV(bit) (1 << (bit))
+
+// Strings kept in flash on the AVR; ordinary strings here.
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+
+// Tables kept in flash on the AVR; ordinary memory here.
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t*) (p))
+#define pgm_read_word(p) (*(const uint16_t*) (p))
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define LOW 0
+#define HIGH 1
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define LED_BUILTIN 13
+
+#define NOT_AN_INTERRUPT -1
+
+// Same mapping as the ATmega328P: only pins 2 and 3 have external interrupts.
+#define digitalPinToInterrupt(p) ((p) == 2 ? 0 : ((p) == 3 ? 1 : NOT_AN_INTERRUPT))
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+void attachInterrupt(uint8_t irq, void (*isr)(), int mode);
+void detachInterrupt(uint8_t irq);
+inline void interrupts() {}
+inline void noInterrupts() {}
+
+// Serial output goes to stdout, or wherever sim::serial_output() says.
+// Once begin() has set a baud rate, bytes leave a 64-byte transmit
+// buffer at that rate in simulated time, and write() blocks while the
+// buffer is full, as on the AVR.
+class HardwareSerial {
+
+  private:
+    double m_byte_usec;     // time to send one byte, zero before begin()
+    double m_done_usec;     // time the last byte written will have been sent
+
+  public:
+    HardwareSerial() : m_byte_usec(0.0), m_done_usec(0.0) {}
+    void begin(unsigned long baud);
+    int availableForWrite();
+    size_t write(uint8_t b);
+    size_t write(const uint8_t* buf, size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        write(buf[i]);
+      }
+      return n;
+    }
+    void print(const char* s) { write((const uint8_t*) s, strlen(s)); }
+    void print(const __FlashStringHelper* s) { print(reinterpret_cast<const char*>(s)); }
+    void print(char c) { write((uint8_t) c); }
+    void print(int v) { format("%d", v); }
+    void print(unsigned int v) { format("%u", v); }
+    void print(long v) { format("%ld", v); }
+    void print(unsigned long v) { format("%lu", v); }
+    void print(double v) { format("%.2f", v); }
+    template<typename T> void println(T v) { print(v); print('\n'); }
+    void println() { print('\n'); }
+
+  private:
+    template<typename T> void format(const char* fmt, T v) {
+      char buf[32];
+      snprintf(buf, sizeof buf, fmt, v);
+      print(buf);
+    }
+
+};
+
+extern HardwareSerial Serial;
+
+#endif
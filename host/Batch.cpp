@@ -0,0 +1,201 @@
+#include "Batch.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace batch {
+
+#ifdef __SSE2__
+
+  // Unsigned divide of four 32-bit lanes by one divisor d, by multiplying
+  // and shifting (Granlund and Montgomery, "Division by invariant integers
+  // using multiplication", fig. 4.1): exact for every dividend.
+  class Divider {
+
+    private:
+      __m128i m_mul;      // low 32 bits of 2^(32 + l) / d, rounded up
+      __m128i m_shift1;   // min(l, 1)
+      __m128i m_shift2;   // max(l - 1, 0)
+
+    public:
+      Divider(const uint32_t d) {
+        unsigned l = 0;         // ceil(log2(d))
+        while (((uint64_t) 1 << l) < d) {
+          ++l;
+        }
+        uint32_t mul = (uint32_t) ((((uint64_t) 1 << 32) * (((uint64_t) 1 << l) - d)) / d + 1);
+        m_mul = _mm_set1_epi32((int) mul);
+        m_shift1 = _mm_cvtsi32_si128(l < 1 ? l : 1);
+        m_shift2 = _mm_cvtsi32_si128(l > 0 ? l - 1 : 0);
+      }
+
+      __m128i divide(const __m128i n) const {
+        // High halves of each lane's 64-bit product with m_mul.
+        __m128i even = _mm_srli_epi64(_mm_mul_epu32(n, m_mul), 32);
+        __m128i odd = _mm_mul_epu32(_mm_srli_epi64(n, 32), m_mul);
+        __m128i hi = _mm_or_si128(even, _mm_and_si128(odd, _mm_set_epi32(-1, 0, -1, 0)));
+        __m128i q = _mm_add_epi32(hi, _mm_srl_epi32(_mm_sub_epi32(n, hi), m_shift1));
+        return _mm_srl_epi32(q, m_shift2);
+      }
+
+  };
+
+  // Comparison of 32-bit unsigned lanes with a level held as a long,
+  // which may lie outside the range of uint32_t: lanes above the level if
+  // ABOVE, else lanes below it.
+  template<bool ABOVE>
+  class Level {
+
+    private:
+      __m128i m_level;    // level, offset by 2^31 for a signed compare
+      uint64_t m_use;     // all ones if the compare decides
+      uint64_t m_force;   // result when it does not
+
+    public:
+      Level(const long level) {
+        bool always = ABOVE ? (level < 0) : (level > (long) UINT32_MAX);
+        bool never = ABOVE ? (level >= (long) UINT32_MAX) : (level <= 0);
+        m_level = _mm_set1_epi32((int) ((uint32_t) level ^ 0x80000000u));
+        m_use = (always || never) ? 0 : ~(uint64_t) 0;
+        m_force = always ? ~(uint64_t) 0 : 0;
+      }
+
+      // All ones in each lane above (or below) the level, given lanes
+      // offset by 2^31, as long as the compare decides.
+      __m128i test(const __m128i biased) const {
+        return ABOVE ? _mm_cmpgt_epi32(biased, m_level) : _mm_cmpgt_epi32(m_level, biased);
+      }
+
+      // Bit k set for sample k of 16 compared true, given them four to a
+      // vector.
+      unsigned test16(const __m128i v0, const __m128i v1, const __m128i v2, const __m128i v3) const {
+        __m128i lo = _mm_packs_epi32(test(v0), test(v1));
+        __m128i hi = _mm_packs_epi32(test(v2), test(v3));
+        return (unsigned) _mm_movemask_epi8(_mm_packs_epi16(lo, hi));
+      }
+
+      // Bit k set for sample k of 64 above (or below) the level, given
+      // the bits from test16().
+      uint64_t decide(const uint64_t bits) const {
+        return (bits & m_use) | m_force;
+      }
+
+  };
+
+  // State of a Schmitt trigger after each of 64 samples, given the samples
+  // which set it and those which reset it and its state before the first.
+  // A set sample starts a run of ones that carries through samples which
+  // do neither and stops at a reset, just as a carry runs through an
+  // adder, so one 64-bit add resolves the whole word.
+  static inline uint64_t resolve(const uint64_t set, const uint64_t reset, const bool state) {
+    uint64_t keep = ~(set | reset);
+    uint64_t carry = ((set | keep) + set + (state ? 1 : 0)) ^ keep;
+    return set | (keep & carry);
+  }
+
+#endif
+
+  // Filter n samples into out, which must not overlap in.
+  //
+  // The output is the window's running sum divided by its length.  Four
+  // sums at a time are found as a prefix sum of the differences between
+  // the samples entering the window and those leaving it, added to the
+  // last sum of the four before.  Sums wrap as Filter<T>'s does.
+  void filter(const uint32_t* in, uint32_t* out, size_t n, size_t nsamps) {
+#ifdef __SSE2__
+    const size_t ns = nsamps < 1 ? 1 : (nsamps > BATCH_MAX_SAMPLES ? BATCH_MAX_SAMPLES : nsamps);
+    const Divider div((uint32_t) ns);
+    uint32_t sum = 0;
+    size_t i = 0;
+    // Until the window fills, the samples leaving it are the zeros a new
+    // Filter starts with.
+    for ( ; i < n && i < ns; ++i) {
+      sum += in[i];
+      out[i] = sum / ns;
+    }
+    __m128i run = _mm_set1_epi32((int) sum);
+    for ( ; i + 4 <= n; i += 4) {
+      __m128i d = _mm_sub_epi32(_mm_loadu_si128((const __m128i*) (in + i)),
+                                _mm_loadu_si128((const __m128i*) (in + i - ns)));
+      d = _mm_add_epi32(d, _mm_slli_si128(d, 4));
+      d = _mm_add_epi32(d, _mm_slli_si128(d, 8));
+      run = _mm_add_epi32(d, run);
+      _mm_storeu_si128((__m128i*) (out + i), div.divide(run));
+      run = _mm_shuffle_epi32(run, 0xFF);
+    }
+    sum = (uint32_t) _mm_cvtsi128_si32(run);
+    for ( ; i < n; ++i) {
+      sum += in[i] - in[i - ns];
+      out[i] = sum / ns;
+    }
+#else
+    filter_scalar(in, out, n, nsamps);
+#endif
+  }
+
+  // Test n samples against a window, 64 at a time.
+  //
+  // Each sample is compared with the four levels of the window's two
+  // triggers, sixteen samples at a time, giving for each trigger a word of
+  // samples which set it and a word which reset it.  resolve() turns
+  // those into the trigger's state after each sample, and a sample is
+  // within range when the low end's trigger is set and the high end's is
+  // not.
+  void within(const RangeWindow<uint32_t>& win, const uint32_t* in, size_t n,
+              uint8_t& state, uint64_t* bits) {
+#ifdef __SSE2__
+    const SchmittTrigger<uint32_t>& tlo = win.trigger_lo();
+    const SchmittTrigger<uint32_t>& thi = win.trigger_hi();
+    const Level<true> set_lo(tlo.upper());
+    const Level<false> reset_lo(tlo.lower());
+    const Level<true> set_hi(thi.upper());
+    const Level<false> reset_hi(thi.lower());
+    const __m128i bias = _mm_set1_epi32((int) 0x80000000u);
+    bool lo = (state & 0x01) != 0;
+    bool hi = (state & 0x02) != 0;
+    uint32_t pad[64];
+    for (size_t base = 0; base < n; base += 64) {
+      // Samples of this word, padded with zeros past the last.
+      const uint32_t* p = in + base;
+      size_t len = n - base < 64 ? n - base : 64;
+      if (len < 64) {
+        for (size_t k = 0; k < 64; ++k) {
+          pad[k] = (k < len) ? p[k] : 0;
+        }
+        p = pad;
+      }
+      uint64_t s_lo = 0, r_lo = 0, s_hi = 0, r_hi = 0;
+      for (unsigned k = 0; k < 64; k += 16) {
+        const __m128i* q = (const __m128i*) (p + k);
+        __m128i v0 = _mm_xor_si128(_mm_loadu_si128(q), bias);
+        __m128i v1 = _mm_xor_si128(_mm_loadu_si128(q + 1), bias);
+        __m128i v2 = _mm_xor_si128(_mm_loadu_si128(q + 2), bias);
+        __m128i v3 = _mm_xor_si128(_mm_loadu_si128(q + 3), bias);
+        s_lo |= (uint64_t) set_lo.test16(v0, v1, v2, v3) << k;
+        r_lo |= (uint64_t) reset_lo.test16(v0, v1, v2, v3) << k;
+        s_hi |= (uint64_t) set_hi.test16(v0, v1, v2, v3) << k;
+        r_hi |= (uint64_t) reset_hi.test16(v0, v1, v2, v3) << k;
+      }
+      uint64_t st_lo = resolve(set_lo.decide(s_lo), reset_lo.decide(r_lo), lo);
+      uint64_t st_hi = resolve(set_hi.decide(s_hi), reset_hi.decide(r_hi), hi);
+      uint64_t mask = (len < 64) ? (((uint64_t) 1 << len) - 1) : ~(uint64_t) 0;
+      bits[base / 64] = st_lo & ~st_hi & mask;
+      lo = ((st_lo >> (len - 1)) & 1) != 0;
+      hi = ((st_hi >> (len - 1)) & 1) != 0;
+    }
+    state = (lo ? 0x01 : 0x00) | (hi ? 0x02 : 0x00);
+#else
+    within_scalar(win, in, n, state, bits);
+#endif
+  }
+
+  const char* simd() {
+#ifdef __SSE2__
+    return "sse2";
+#else
+    return "scalar";
+#endif
+  }
+
+}
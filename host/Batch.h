@@ -0,0 +1,73 @@
+#ifndef _BATCH__H_
+#define _BATCH__H_
+
+// Batch forms of Filter<T>::filter and RangeWindow<T>::within for host
+// builds, which run the sketch's detection over whole recorded traces.
+//
+// Each function takes an array of samples and gives the same results as
+// feeding them one at a time to the per-sample form.  The *_scalar forms
+// do exactly that, for any T; filter() and within() do the same for
+// uint32_t, the type of a Sensor's distances, with SSE2 where the host
+// has it and the scalar forms where it has not.
+//
+// Detections are returned as a bitmap: bit (i % 64) of word (i / 64) is
+// set if sample i is within range.  Bits past the last sample are clear.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Filter.h"
+#include "RangeWindow.h"
+
+// Longest filter window of the batch forms
+#define BATCH_MAX_SAMPLES 16
+
+namespace batch {
+
+  // Words of bitmap needed for n samples.
+  inline size_t bitmap_words(size_t n) {
+    return (n + 63) / 64;
+  }
+
+  // Filter n samples as a new Filter<T, BATCH_MAX_SAMPLES>(nsamps) would,
+  // writing each output to out.  Windows longer than BATCH_MAX_SAMPLES are
+  // cut to it.
+  template<typename T>
+  void filter_scalar(const T* in, T* out, size_t n, size_t nsamps) {
+    Filter<T, BATCH_MAX_SAMPLES> f(nsamps > BATCH_MAX_SAMPLES ? BATCH_MAX_SAMPLES : nsamps);
+    for (size_t i = 0; i < n; ++i) {
+      out[i] = f.filter(in[i]);
+    }
+  }
+
+  // Test n samples against a window as win.within(val, state) would,
+  // setting a bit of bits for each one within range.  state is the
+  // hysteresis state before the first sample, initially 0, and is left
+  // as it is after the last.
+  template<typename T>
+  void within_scalar(const RangeWindow<T>& win, const T* in, size_t n,
+                     uint8_t& state, uint64_t* bits) {
+    for (size_t w = 0; w < bitmap_words(n); ++w) {
+      bits[w] = 0;
+    }
+    for (size_t i = 0; i < n; ++i) {
+      if (win.within(in[i], state)) {
+        bits[i / 64] |= (uint64_t) 1 << (i % 64);
+      }
+    }
+  }
+
+  // Same as filter_scalar(), using SIMD.
+  void filter(const uint32_t* in, uint32_t* out, size_t n, size_t nsamps);
+
+  // Same as within_scalar(), using SIMD.
+  void within(const RangeWindow<uint32_t>& win, const uint32_t* in, size_t n,
+              uint8_t& state, uint64_t* bits);
+
+  // Name of the instruction set filter() and within() use ("sse2", or
+  // "scalar" on hosts without it).
+  const char* simd();
+
+}
+
+#endif
@@ -0,0 +1,162 @@
+#include "Capture.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <vector>
+
+// MappedCapture
+
+MappedCapture::MappedCapture() :
+  m_base(NULL),
+  m_size(0),
+  m_channels(0),
+  m_record(0),
+  m_records(0)
+{
+}
+
+MappedCapture::~MappedCapture() {
+  if (m_base != NULL) {
+    munmap((void*) m_base, m_size);
+  }
+}
+
+bool MappedCapture::open(const char* path) {
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(CaptureHeader)) {
+    close(fd);
+    return false;
+  }
+  void* base = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    return false;
+  }
+  CaptureHeader hdr;
+  memcpy(&hdr, base, sizeof hdr);
+  if (hdr.magic != CAPTURE_MAGIC || hdr.channels == 0) {
+    munmap(base, (size_t) st.st_size);
+    return false;
+  }
+  // Records are read in order, a chunk at a time.
+  madvise(base, (size_t) st.st_size, MADV_SEQUENTIAL);
+  m_base = (const uint8_t*) base;
+  m_size = (size_t) st.st_size;
+  m_channels = hdr.channels;
+  m_record = sizeof(uint64_t) + m_channels;
+  m_records = (m_size - sizeof(CaptureHeader)) / m_record;
+  return true;
+}
+
+unsigned MappedCapture::channels() const {
+  return m_channels;
+}
+
+size_t MappedCapture::records() const {
+  return m_records;
+}
+
+uint64_t MappedCapture::time_us(size_t i) const {
+  uint64_t t;
+  memcpy(&t, m_base + sizeof(CaptureHeader) + i * m_record, sizeof t);
+  return t;
+}
+
+uint8_t MappedCapture::range_mm(size_t i, unsigned channel) const {
+  return m_base[sizeof(CaptureHeader) + i * m_record + sizeof(uint64_t) + channel];
+}
+
+size_t MappedCapture::find(uint64_t t_us) const {
+  // First record after t_us, by bisection
+  size_t lo = 0, hi = m_records;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (time_us(mid) <= t_us) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo == 0 ? m_records : lo - 1;
+}
+
+uint64_t MappedCapture::duration_us() const {
+  return m_records == 0 ? 0 : time_us(m_records - 1);
+}
+
+// CaptureTrace
+
+CaptureTrace::CaptureTrace(const MappedCapture& capture, uint64_t offset_us,
+                           uint64_t duration_us) :
+  m_capture(capture),
+  m_offset_us(offset_us),
+  m_duration_us(duration_us),
+  m_cursor(capture.records())
+{
+}
+
+uint8_t CaptureTrace::range_mm(unsigned channel, uint64_t t_us) {
+  if (channel >= m_capture.channels()) {
+    return NO_TARGET_MM;
+  }
+  uint64_t t = m_offset_us + t_us;
+  const size_t n = m_capture.records();
+  // Time only moves forward in a replay, so step on from the last record
+  // found, and only search when that is a long way behind.
+  size_t i = m_cursor;
+  if (i == n || m_capture.time_us(i) > t) {
+    i = m_capture.find(t);
+  } else {
+    for (unsigned k = 0; i + 1 < n && m_capture.time_us(i + 1) <= t; ++k) {
+      if (k == 8) {
+        i = m_capture.find(t);
+        break;
+      }
+      ++i;
+    }
+  }
+  m_cursor = i;
+  return (i == n) ? NO_TARGET_MM : m_capture.range_mm(i, channel);
+}
+
+uint64_t CaptureTrace::duration_us() const {
+  return m_duration_us;
+}
+
+bool write_capture(const char* path, RangeSource& src, unsigned channels, uint32_t step_us) {
+  FILE* fp = fopen(path, "wb");
+  if (fp == NULL) {
+    return false;
+  }
+  CaptureHeader hdr;
+  memset(&hdr, 0, sizeof hdr);
+  hdr.magic = CAPTURE_MAGIC;
+  hdr.channels = (uint8_t) channels;
+  bool ok = fwrite(&hdr, sizeof hdr, 1, fp) == 1;
+  std::vector<uint8_t> rec(sizeof(uint64_t) + channels);
+  std::vector<uint8_t> last(channels);
+  uint64_t end = src.duration_us();
+  for (uint64_t t = 0; ok && t <= end; t += step_us) {
+    bool changed = (t == 0);
+    for (unsigned c = 0; c < channels; ++c) {
+      uint8_t r = src.range_mm(c, t);
+      changed = changed || r != last[c];
+      last[c] = r;
+    }
+    if (changed || t + step_us > end) {
+      memcpy(&rec[0], &t, sizeof t);
+      memcpy(&rec[sizeof t], &last[0], channels);
+      ok = fwrite(&rec[0], rec.size(), 1, fp) == 1;
+    }
+  }
+  return (fclose(fp) == 0) && ok;
+}
@@ -0,0 +1,76 @@
+#ifndef _CAPTURE__H_
+#define _CAPTURE__H_
+
+// Binary captures of range samples, as logged by a rig over days, and
+// traces which replay them from a memory-mapped file.
+//
+// A capture is a CaptureHeader followed by records of the same length,
+// one for each time any channel's range changed: the time (usec since
+// the capture began, little-endian uint64_t), then one range per channel
+// (mm).  Each range holds until the next record, as in a RecordedTrace.
+
+#include "RangeTrace.h"
+
+#include <stddef.h>
+
+// CaptureHeader::magic, "TSC1" in the file
+#define CAPTURE_MAGIC 0x31435354
+
+struct CaptureHeader {
+  uint32_t magic;       // CAPTURE_MAGIC
+  uint8_t channels;     // ranges per record
+  uint8_t reserved[3];  // zero
+};
+
+// Capture file mapped into memory, read-only.  The mapping is shared by
+// processes forked after open().
+class MappedCapture {
+
+  private:
+    const uint8_t* m_base;    // start of mapping
+    size_t m_size;            // bytes mapped
+    unsigned m_channels;      // ranges per record
+    size_t m_record;          // bytes per record
+    size_t m_records;         // whole records in the file
+
+  public:
+    MappedCapture();
+    ~MappedCapture();
+    bool open(const char* path);
+    unsigned channels() const;
+    size_t records() const;
+    // Time of record i (usec).
+    uint64_t time_us(size_t i) const;
+    // Range on a channel at record i (mm).
+    uint8_t range_mm(size_t i, unsigned channel) const;
+    // Index of the last record at or before t_us, or records() if none.
+    size_t find(uint64_t t_us) const;
+    // Time of the last record (usec), 0 if there are none.
+    uint64_t duration_us() const;
+
+};
+
+// Part of a capture, as a RangeSource whose time zero is offset_us into
+// the capture.  Ranges before the first record are NO_TARGET_MM.
+class CaptureTrace : public RangeSource {
+
+  private:
+    const MappedCapture& m_capture;
+    uint64_t m_offset_us;     // capture time of this trace's time zero
+    uint64_t m_duration_us;   // length of this trace
+    size_t m_cursor;          // record of last range_mm(), or records()
+
+  public:
+    CaptureTrace(const MappedCapture& capture, uint64_t offset_us, uint64_t duration_us);
+    virtual uint8_t range_mm(unsigned channel, uint64_t t_us);
+    virtual uint64_t duration_us() const;
+
+};
+
+// Write a capture of a source's first channels, sampling each every
+// step_us over its whole duration.  Returns false if the file cannot be
+// written.
+bool write_capture(const char* path, RangeSource& src, unsigned channels,
+                   uint32_t step_us = 1000);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef _COMPONENTOBJECT__H_
+#define _COMPONENTOBJECT__H_
+
+// Empty host stand-in; the fake VL6180X lives in vl6180x_class.h.
+
+#endif
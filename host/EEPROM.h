@@ -0,0 +1,32 @@
+#ifndef _EEPROM__H_
+#define _EEPROM__H_
+
+// Host stand-in for the Arduino EEPROM library, with the ATmega328P's
+// 1 KB of EEPROM.  Contents start erased (0xFF) and survive sim::reset(),
+// as they survive a reset on the board.  A write takes 3.4 msec of
+// simulated time; eeprom_is_ready() is false until it is done, and a
+// further write made before then waits for it, as on the AVR.
+
+#include <Arduino.h>
+
+#define E2END 0x3FF
+
+class EEPROMClass {
+
+  public:
+    uint8_t read(const int idx);
+    void write(const int idx, const uint8_t val);
+    void update(const int idx, const uint8_t val) {
+      if (read(idx) != val) {
+        write(idx, val);
+      }
+    }
+    uint16_t length() { return E2END + 1; }
+
+};
+
+extern EEPROMClass EEPROM;
+
+bool eeprom_is_ready();
+
+#endif
@@ -0,0 +1,75 @@
+#include "FakeHT16K33.h"
+
+// Same wiring as AlphaDisplay.cpp: segment s of character d is bit
+// (d + ROW[s]) of RAM byte 2 * COM[s].
+static const uint8_t COM[14] = { 0, 1, 2, 3, 4, 5, 6, 1, 0, 2, 3, 4, 5, 6 };
+static const uint8_t ROW[14] = { 0, 0, 0, 0, 0, 0, 0, 4, 4, 4, 4, 4, 4, 4 };
+
+FakeHT16K33::FakeHT16K33(uint8_t addr) :
+  m_addr(addr),
+  m_ptr(0),
+  m_first(false),
+  m_on(false),
+  m_writes(0),
+  m_bytes(0)
+{
+  memset(m_ram, 0, sizeof m_ram);
+}
+
+uint16_t FakeHT16K33::segments(unsigned d) const {
+  uint16_t segs = 0;
+  for (unsigned s = 0; s < 14; ++s) {
+    if (m_ram[2 * COM[s]] & (1 << (d + ROW[s]))) {
+      segs |= 1 << s;
+    }
+  }
+  return segs;
+}
+
+bool FakeHT16K33::on() const {
+  return m_on;
+}
+
+uint32_t FakeHT16K33::writes() const {
+  return m_writes;
+}
+
+uint32_t FakeHT16K33::bytes() const {
+  return m_bytes;
+}
+
+bool FakeHT16K33::i2c_address(uint8_t addr) const {
+  return addr == m_addr;
+}
+
+bool FakeHT16K33::i2c_start(bool read) {
+  if (!read) {
+    m_first = true;
+    ++m_writes;
+  }
+  return true;
+}
+
+// The first byte is a command; after a RAM address command the rest are
+// data, the address counting up and wrapping at 16.
+bool FakeHT16K33::i2c_write(uint8_t b) {
+  if (m_first) {
+    m_first = false;
+    if ((b & 0xF0) == 0x00) {
+      m_ptr = b & 0x0F;
+    } else if ((b & 0xF0) == 0x80) {
+      m_on = (b & 0x01) != 0;
+    }
+    return true;
+  }
+  m_ram[m_ptr] = b;
+  m_ptr = (m_ptr + 1) & 0x0F;
+  ++m_bytes;
+  return true;
+}
+
+uint8_t FakeHT16K33::i2c_read() {
+  uint8_t b = m_ram[m_ptr];
+  m_ptr = (m_ptr + 1) & 0x0F;
+  return b;
+}
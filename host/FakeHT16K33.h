@@ -0,0 +1,36 @@
+#ifndef _FAKE_HT16K33__H_
+#define _FAKE_HT16K33__H_
+
+// Fake HT16K33 LED driver on the simulated I2C bus, holding the display
+// RAM and counting what is written to it, so that host builds can check
+// what AlphaDisplay would show and how much bus traffic it took.
+
+#include "FakeTWI.h"
+
+class FakeHT16K33 : public I2CDevice {
+
+  private:
+    uint8_t m_addr;           // 7-bit I2C address
+    uint8_t m_ram[16];        // display RAM
+    uint8_t m_ptr;            // RAM address of next data byte
+    bool m_first;             // next byte written is a command
+    bool m_on;                // oscillator and display on
+    uint32_t m_writes;        // write transfers addressed to the chip
+    uint32_t m_bytes;         // display RAM bytes written
+
+  public:
+    FakeHT16K33(uint8_t addr);
+    // Segments shown by character d (0-3), bit 0 for segment A.
+    uint16_t segments(unsigned d) const;
+    bool on() const;
+    uint32_t writes() const;
+    uint32_t bytes() const;
+
+    virtual bool i2c_address(uint8_t addr) const;
+    virtual bool i2c_start(bool read);
+    virtual bool i2c_write(uint8_t b);
+    virtual uint8_t i2c_read();
+
+};
+
+#endif
@@ -0,0 +1,180 @@
+#include "FakeTWI.h"
+
+#include "HostSim.h"
+
+#include <util/twi.h>
+
+#include <vector>
+
+TwiControl TWCR;
+uint8_t TWSR = TW_NO_INFO;
+uint8_t TWDR = 0;
+uint8_t TWBR = 72;
+
+namespace {
+
+  // What the master is doing on the bus
+  enum E_Phase {
+    eFree,          // no START sent
+    eAddress,       // START sent, next byte addresses a device
+    eTransmit,      // device addressed for writing
+    eReceive,       // device addressed for reading
+    eIgnored        // address NACKed, waiting for STOP or START
+  };
+
+  std::vector<I2CDevice*> s_devices;
+  uint8_t s_ctrl = 0;           // TWEA, TWEN and TWIE as last written
+  bool s_int = false;           // TWINT: operation complete
+  bool s_stopping = false;      // TWSTO: STOP being sent
+  uint8_t s_phase = eFree;
+  I2CDevice* s_dev = NULL;      // device addressed
+  uint32_t s_seq = 0;           // invalidates events of a disabled TWI
+  uint64_t s_busy_usec = 0;
+  bool s_busy = false;          // operation under way
+
+  // Set status code, keeping the prescaler bits.
+  void set_status(uint8_t status) {
+    TWSR = status | (TWSR & 3);
+  }
+
+  // Kinds of operation completing at the end of an event
+  enum E_Op { eOpStart, eOpStop, eOpAddress, eOpWrite, eOpRead };
+
+  void complete(void*, uint32_t tag) {
+    if ((tag >> 3) != s_seq) {
+      return;
+    }
+    s_busy = false;
+    switch (tag & 7) {
+      case eOpStart:
+        if (s_dev != NULL) {
+          s_dev->i2c_stop();
+          s_dev = NULL;
+        }
+        set_status((s_phase == eFree) ? TW_START : TW_REP_START);
+        s_phase = eAddress;
+        break;
+      case eOpStop:
+        if (s_dev != NULL) {
+          s_dev->i2c_stop();
+          s_dev = NULL;
+        }
+        s_phase = eFree;
+        s_stopping = false;
+        return;                 // STOP does not set TWINT
+      case eOpAddress: {
+        bool read = (TWDR & TW_READ) != 0;
+        uint8_t addr = TWDR >> 1;
+        for (size_t i = 0; i < s_devices.size() && s_dev == NULL; ++i) {
+          if (s_devices[i]->i2c_address(addr) && s_devices[i]->i2c_start(read)) {
+            s_dev = s_devices[i];
+          }
+        }
+        if (s_dev != NULL) {
+          set_status(read ? TW_MR_SLA_ACK : TW_MT_SLA_ACK);
+          s_phase = read ? eReceive : eTransmit;
+        } else {
+          set_status(read ? TW_MR_SLA_NACK : TW_MT_SLA_NACK);
+          s_phase = eIgnored;
+        }
+        break;
+      }
+      case eOpWrite:
+        set_status(s_dev->i2c_write(TWDR) ? TW_MT_DATA_ACK : TW_MT_DATA_NACK);
+        break;
+      case eOpRead:
+        TWDR = s_dev->i2c_read();
+        set_status((s_ctrl & _BV(TWEA)) ? TW_MR_DATA_ACK : TW_MR_DATA_NACK);
+        break;
+    }
+    s_int = true;
+  }
+
+  // Schedule completion of an operation lasting some bit times.
+  void after_bits(double bits, uint32_t op) {
+    uint32_t usec = (uint32_t) (bits * twi_sim::bit_usec() + 0.5);
+    s_busy_usec += usec;
+    s_busy = true;
+    sim::schedule(sim::now_us() + usec, complete, NULL, (s_seq << 3) | op);
+  }
+
+}
+
+TwiControl& TwiControl::operator=(uint8_t val) {
+  s_ctrl = val & (_BV(TWEA) | _BV(TWEN) | _BV(TWIE));
+  if (!(val & _BV(TWEN))) {
+    // Disabling the TWI abandons whatever it was doing.
+    ++s_seq;
+    s_busy = false;
+    s_int = false;
+    s_stopping = false;
+    s_phase = eFree;
+    s_dev = NULL;
+    return *this;
+  }
+  if (!(val & _BV(TWINT))) {
+    return *this;
+  }
+  // Writing TWINT clears the flag and starts the next operation.
+  s_int = false;
+  if (val & _BV(TWSTO)) {
+    s_stopping = true;
+    after_bits(1.0, eOpStop);
+  } else if (val & _BV(TWSTA)) {
+    after_bits(1.0, eOpStart);
+  } else if (s_phase == eAddress) {
+    after_bits(9.0, eOpAddress);
+  } else if (s_phase == eTransmit) {
+    after_bits(9.0, eOpWrite);
+  } else if (s_phase == eReceive) {
+    after_bits(9.0, eOpRead);
+  } else {
+    set_status(TW_BUS_ERROR);
+    s_int = true;
+  }
+  return *this;
+}
+
+// While an operation is under way, each read takes 1 usec of simulated
+// time, so that a loop spinning on TWINT or TWSTO sees it change.
+TwiControl::operator uint8_t() const {
+  if (s_busy) {
+    sim::run_until(sim::now_us() + 1);
+  }
+  return s_ctrl | (s_int ? _BV(TWINT) : 0) | (s_stopping ? _BV(TWSTO) : 0);
+}
+
+void twi_sim::reset() {
+  s_devices.clear();
+  s_ctrl = 0;
+  s_int = false;
+  s_stopping = false;
+  s_phase = eFree;
+  s_dev = NULL;
+  ++s_seq;
+  s_busy = false;
+  s_busy_usec = 0;
+  TWSR = TW_NO_INFO;
+  TWDR = 0;
+  TWBR = 72;
+}
+
+void twi_sim::attach(I2CDevice* dev) {
+  s_devices.push_back(dev);
+}
+
+// SCL frequency is F_CPU / (16 + 2 * TWBR * prescaler).
+double twi_sim::bit_usec() {
+  static const unsigned PRESCALE[4] = { 1, 4, 16, 64 };
+  return (16.0 + 2.0 * TWBR * PRESCALE[TWSR & 3]) * 1.0e6 / (double) F_CPU;
+}
+
+void twi_sim::wire_transfer(unsigned nstarts, unsigned nbytes) {
+  uint32_t usec = (uint32_t) ((2.0 * nstarts + 9.0 * nbytes) * bit_usec() + 0.5);
+  s_busy_usec += usec;
+  sim::run_until(sim::now_us() + usec);
+}
+
+uint64_t twi_sim::busy_usec() {
+  return s_busy_usec;
+}
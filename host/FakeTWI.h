@@ -0,0 +1,56 @@
+#ifndef _FAKE_TWI__H_
+#define _FAKE_TWI__H_
+
+// Fake ATmega two-wire interface and the I2C bus behind it.
+//
+// The registers in <util/twi.h> drive a single-master bus model.  Each
+// START, address or data byte takes its time on the simulated clock, at
+// the bit rate programmed into TWBR, and the addressed device sees the
+// byte when it completes.  Devices join the bus with attach().
+//
+// Fake drivers which model a blocking library call instead of going
+// through the registers (as the VL6180X driver does through Wire) charge
+// the equivalent bus time with wire_transfer().
+
+#include <Arduino.h>
+
+// A device on the simulated bus
+class I2CDevice {
+
+  public:
+    virtual ~I2CDevice() {}
+    // True if the device answers to this 7-bit address.
+    virtual bool i2c_address(uint8_t addr) const = 0;
+    // Addressed after a START, for reading or writing; false to NACK.
+    virtual bool i2c_start(bool read) = 0;
+    // Byte written by the master; false to NACK.
+    virtual bool i2c_write(uint8_t b) = 0;
+    // Byte read by the master.
+    virtual uint8_t i2c_read() = 0;
+    // STOP, or a repeated START addressed elsewhere.
+    virtual void i2c_stop() {}
+
+};
+
+namespace twi_sim {
+
+  // Power-on state: no devices, TWI disabled, 100 kHz.
+  void reset();
+
+  // Put a device on the bus.  It must outlive the simulation run.
+  void attach(I2CDevice* dev);
+
+  // Time of one SCL period at the programmed bit rate (usec).
+  double bit_usec();
+
+  // Block for nstarts START/STOP pairs and nbytes bytes on the bus, as a
+  // polled Wire transfer would, running simulated events meanwhile.
+  void wire_transfer(unsigned nstarts, unsigned nbytes);
+
+  // Time the bus has been busy since reset(), through the registers or
+  // wire_transfer() (usec).
+  uint64_t busy_usec();
+
+}
+
+#endif
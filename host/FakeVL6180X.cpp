@@ -0,0 +1,389 @@
+#include "vl6180x_class.h"
+
+#include "HostSim.h"
+#include "RangeTrace.h"
+
+#include <vector>
+
+// Registers handled on the bus
+#define SYSTEM__INTERRUPT_CLEAR           0x015
+#define SYSRANGE__START                   0x018
+#define SYSRANGE__INTERMEASUREMENT_PERIOD 0x01B
+#define SYSRANGE__MAX_CONVERGENCE_TIME    0x01C
+#define RESULT__RANGE_STATUS              0x04D
+#define RESULT__INTERRUPT_STATUS_GPIO     0x04F
+#define RESULT__RANGE_VAL                 0x062
+#define RESULT__RANGE_RETURN_CONV_TIME    0x07C
+#define IDENTIFICATION__MODEL_ID          0x000
+
+// I2C address every device has after reset
+#define DEFAULT_ADDR 0x29
+
+namespace {
+
+  struct Wiring {
+    int ena;
+    unsigned channel;
+    int gpio1;
+  };
+
+  std::vector<Wiring> s_wiring;
+  RangeSource* s_source = NULL;
+  uint32_t s_measure_usec = 3000;
+  uint32_t s_conv50_usec = 0;
+  std::vector<uint64_t> s_samples;
+  std::vector<VL6180X*> s_devices;
+  uint32_t s_collisions = 0;
+
+}
+
+void VL6180X::connect(int ena_pin, unsigned channel, int gpio1_pin) {
+  Wiring w = { ena_pin, channel, gpio1_pin };
+  s_wiring.push_back(w);
+}
+
+void VL6180X::disconnect_all() {
+  s_wiring.clear();
+  s_samples.clear();
+  s_collisions = 0;
+}
+
+uint32_t VL6180X::collisions() {
+  return s_collisions;
+}
+
+uint64_t VL6180X::samples(unsigned channel) {
+  return (channel < s_samples.size()) ? s_samples[channel] : 0;
+}
+
+// A device counts as on a channel once begin() has found its wiring.
+bool VL6180X::inject(unsigned channel, E_Fault kind) {
+  bool found = false;
+  for (size_t i = 0; i < s_devices.size(); ++i) {
+    VL6180X* dev = s_devices[i];
+    for (size_t k = 0; k < s_wiring.size(); ++k) {
+      if (s_wiring[k].ena == dev->m_ena && s_wiring[k].channel == channel
+          && dev->m_channel == channel && dev->m_powered) {
+        dev->m_fault = kind;
+        if (kind == eHang) {
+          ++dev->m_seq;
+        }
+        found = true;
+      }
+    }
+  }
+  return found;
+}
+
+void VL6180X::set_source(RangeSource* src) {
+  s_source = src;
+}
+
+void VL6180X::set_measure_usec(uint32_t usec) {
+  s_measure_usec = usec;
+}
+
+void VL6180X::set_convergence_usec(uint32_t usec) {
+  s_conv50_usec = usec;
+}
+
+// Constructor
+VL6180X::VL6180X(TwoWire*, int pin) :
+  m_ena(pin),
+  m_gpio1(-1),
+  m_channel(0),
+  m_addr(DEFAULT_ADDR),
+  m_conv_ms(50),
+  m_powered(false),
+  m_active_high(false),
+  m_busy(false),
+  m_ready(false),
+  m_continuous(false),
+  m_period_us(10000),
+  m_seq(0),
+  m_reg(0),
+  m_nreg(0),
+  m_fault(eNoFault),
+  m_conv_us(0),
+  m_conv_error(RANGE_NO_ERROR)
+{
+  memset(&m_data, 0, sizeof m_data);
+  twi_sim::attach(this);
+  s_devices.push_back(this);
+}
+
+// Drive GPIO1 to its asserted or idle level.
+void VL6180X::set_line(bool asserted) {
+  if (m_gpio1 >= 0) {
+    sim::drive_pin((uint8_t) m_gpio1, (asserted == m_active_high) ? HIGH : LOW);
+  }
+}
+
+// Measurement finished: sample the source and raise the interrupt line.
+// In continuous mode the next measurement is already under way; an
+// uncollected sample is overwritten without a new interrupt edge.
+void VL6180X::complete(void* arg, uint32_t tag) {
+  VL6180X* dev = (VL6180X*) arg;
+  if (tag != dev->m_seq || !dev->m_busy) {
+    return;
+  }
+  uint32_t conv_us = dev->m_conv_us;
+  uint8_t conv_error = dev->m_conv_error;
+  if (dev->m_continuous) {
+    uint32_t t = dev->measure_usec();
+    sim::schedule(sim::now_us() + (t > dev->m_period_us ? t : dev->m_period_us), complete,
+                  dev, tag);
+  }
+  uint8_t range = s_source ? s_source->range_mm(dev->m_channel, sim::now_us()) : NO_TARGET_MM;
+  if (dev->m_channel >= s_samples.size()) {
+    s_samples.resize(dev->m_channel + 1, 0);
+  }
+  ++s_samples[dev->m_channel];
+  dev->m_busy = dev->m_continuous;
+  dev->m_ready = true;
+  memset(&dev->m_data, 0, sizeof dev->m_data);
+  dev->m_data.range_mm = range;
+  dev->m_data.errorStatus = (range >= NO_TARGET_MM) ? RANGE_NO_TARGET : RANGE_NO_ERROR;
+  dev->m_data.rtnConvTime = conv_us;
+  if (conv_error != RANGE_NO_ERROR) {
+    dev->m_data.range_mm = NO_TARGET_MM;
+    dev->m_data.errorStatus = conv_error;
+  }
+  dev->set_line(true);
+}
+
+int VL6180X::begin() {
+  pinMode(m_ena, OUTPUT);
+  for (size_t i = 0; i < s_wiring.size(); ++i) {
+    if (s_wiring[i].ena == m_ena) {
+      m_channel = s_wiring[i].channel;
+      m_gpio1 = s_wiring[i].gpio1;
+    }
+  }
+  return 0;
+}
+
+void VL6180X::VL6180x_On() {
+  digitalWrite(m_ena, HIGH);
+  m_powered = true;
+  m_active_high = false;
+  set_line(false);
+}
+
+void VL6180X::VL6180x_Off() {
+  digitalWrite(m_ena, LOW);
+  m_powered = false;
+  m_busy = false;
+  m_ready = false;
+  m_continuous = false;
+  m_addr = DEFAULT_ADDR;
+  m_fault = eNoFault;
+  ++m_seq;
+  if (m_gpio1 >= 0) {
+    sim::drive_pin((uint8_t) m_gpio1, LOW);
+  }
+}
+
+// The new address is written to whatever answers at the default address,
+// so every other device powered up and still there takes it too, and one
+// which has already taken another's no longer answers.
+int VL6180X::InitSensor(uint8_t addr) {
+  if (!m_powered || m_fault == eMute || m_addr != DEFAULT_ADDR) {
+    return -1;
+  }
+  for (size_t i = 0; i < s_devices.size(); ++i) {
+    VL6180X* dev = s_devices[i];
+    if (dev != this && dev->m_powered && dev->m_fault != eMute
+        && dev->m_addr == DEFAULT_ADDR) {
+      dev->m_addr = addr;
+      ++s_collisions;
+    }
+  }
+  m_addr = addr;
+  return 0;
+}
+
+int VL6180X::Present() {
+  return m_powered ? 1 : 0;
+}
+
+int VL6180X::Prepare() {
+  return (m_powered && m_fault != eMute) ? 0 : -1;
+}
+
+int VL6180X::SetupGPIO1(uint8_t, int polarity) {
+  if (!m_powered) {
+    return -1;
+  }
+  m_active_high = (polarity != 0);
+  set_line(m_ready);
+  return 0;
+}
+
+int VL6180X::RangeConfigInterrupt(uint8_t) {
+  return m_powered ? 0 : -1;
+}
+
+int VL6180X::RangeSetMaxConvergenceTime(uint8_t ms) {
+  m_conv_ms = ms;
+  return m_powered ? 0 : -1;
+}
+
+int VL6180X::FilterSetState(int) {
+  return m_powered ? 0 : -1;
+}
+
+int VL6180X::DMaxSetState(int) {
+  return m_powered ? 0 : -1;
+}
+
+// Start a single-shot or continuous measurement.
+int VL6180X::start(bool continuous) {
+  if (!m_powered || m_busy || m_fault == eMute) {
+    return -1;
+  }
+  m_continuous = continuous;
+  m_busy = true;
+  if (m_fault == eHang) {
+    return 0;
+  }
+  sim::schedule(sim::now_us() + measure_usec(), complete, this, ++m_seq);
+  return 0;
+}
+
+// Time a measurement starting now takes, from the range now; sets the
+// convergence time and error it reports.  Nothing in range runs to the
+// max convergence time, as does a target too far to converge by then.
+uint32_t VL6180X::measure_usec() {
+  m_conv_us = 0;
+  m_conv_error = RANGE_NO_ERROR;
+  if (s_conv50_usec == 0) {
+    return s_measure_usec;
+  }
+  uint32_t max_us = m_conv_ms * 1000UL;
+  uint8_t range = s_source ? s_source->range_mm(m_channel, sim::now_us()) : NO_TARGET_MM;
+  uint64_t need = (uint64_t) s_conv50_usec * range * range / 2500;
+  if (range >= NO_TARGET_MM) {
+    m_conv_us = max_us;
+  } else if (need > max_us) {
+    m_conv_us = max_us;
+    m_conv_error = RANGE_MAX_CONVERGENCE;
+  } else {
+    m_conv_us = (uint32_t) need;
+  }
+  return s_measure_usec + m_conv_us;
+}
+
+// Collect the waiting sample, releasing the interrupt line.
+void VL6180X::clear() {
+  m_ready = false;
+  set_line(false);
+}
+
+// Write to SYSRANGE__START: one register write.
+int VL6180X::RangeStartSingleShot() {
+  twi_sim::wire_transfer(1, 4);
+  return start(false);
+}
+
+// Period is rounded down to a 10 msec step, minimum 10 msec, as on the
+// real part.
+int VL6180X::RangeSetInterMeasPeriod(uint32_t period_msec) {
+  if (!m_powered) {
+    return -1;
+  }
+  uint32_t steps = period_msec / 10;
+  m_period_us = (steps < 1 ? 1 : (steps > 255 ? 255 : steps)) * 10000;
+  return 0;
+}
+
+int VL6180X::RangeStartContinuousMode() {
+  twi_sim::wire_transfer(1, 4);
+  return start(true);
+}
+
+// The ST driver reads the interrupt status, and once a sample is ready,
+// the range, return signal rate and range status, then clears the
+// interrupt: roughly five register transfers.
+int VL6180X::RangeGetMeasurementIfReady(VL6180x_RangeData_t* data) {
+  if (m_fault == eMute) {
+    twi_sim::wire_transfer(1, 1);
+    return -1;
+  }
+  if (!m_ready) {
+    twi_sim::wire_transfer(2, 5);
+    return NOT_READY;
+  }
+  twi_sim::wire_transfer(9, 25);
+  *data = m_data;
+  clear();
+  return 0;
+}
+
+bool VL6180X::i2c_address(uint8_t addr) const {
+  return m_powered && m_fault != eMute && addr == m_addr;
+}
+
+// A write begins with the 16-bit register index; a read continues from
+// the index last written.
+bool VL6180X::i2c_start(bool read) {
+  if (!read) {
+    m_nreg = 0;
+  }
+  return true;
+}
+
+bool VL6180X::i2c_write(uint8_t b) {
+  if (m_nreg < 2) {
+    m_reg = (m_reg << 8) | b;
+    ++m_nreg;
+  } else {
+    write_reg(m_reg++, b);
+  }
+  return true;
+}
+
+uint8_t VL6180X::i2c_read() {
+  return read_reg(m_reg++);
+}
+
+void VL6180X::write_reg(uint16_t reg, uint8_t val) {
+  switch (reg) {
+    case SYSTEM__INTERRUPT_CLEAR:
+      if (val & 0x01) {
+        clear();
+      }
+      break;
+    case SYSRANGE__START:
+      if (val & 0x01) {
+        start((val & 0x02) != 0);
+      }
+      break;
+    case SYSRANGE__INTERMEASUREMENT_PERIOD:
+      m_period_us = ((uint32_t) val + 1) * 10000;
+      break;
+    case SYSRANGE__MAX_CONVERGENCE_TIME:
+      m_conv_ms = val;
+      break;
+  }
+}
+
+uint8_t VL6180X::read_reg(uint16_t reg) const {
+  switch (reg) {
+    case IDENTIFICATION__MODEL_ID:
+      return 0xB4;
+    case RESULT__RANGE_STATUS:
+      return (m_data.errorStatus << 4) | (m_busy ? 0 : 0x01);
+    case RESULT__INTERRUPT_STATUS_GPIO:
+      return m_ready ? 0x04 : 0x00;
+    case RESULT__RANGE_VAL:
+      return m_data.range_mm;
+    case RESULT__RANGE_RETURN_CONV_TIME:
+    case RESULT__RANGE_RETURN_CONV_TIME + 1:
+    case RESULT__RANGE_RETURN_CONV_TIME + 2:
+    case RESULT__RANGE_RETURN_CONV_TIME + 3:
+      return (uint8_t) (m_data.rtnConvTime >> (8 * (RESULT__RANGE_RETURN_CONV_TIME + 3 - reg)));
+    default:
+      return 0;
+  }
+}
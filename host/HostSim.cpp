@@ -0,0 +1,225 @@
+#include "HostSim.h"
+
+#include "FakeTWI.h"
+
+#include <EEPROM.h>
+#include <Wire.h>
+
+#include <queue>
+#include <vector>
+
+HardwareSerial Serial;
+TwoWire Wire;
+EEPROMClass EEPROM;
+
+#define NUM_PINS 64
+#define NUM_IRQS 2
+
+namespace {
+
+  struct Event {
+    uint64_t at;          // time due (usec)
+    uint64_t order;       // tie-breaker, preserves scheduling order
+    sim::EventFunc fn;
+    void* arg;
+    uint32_t tag;
+    bool operator>(const Event& e) const {
+      return (at != e.at) ? (at > e.at) : (order > e.order);
+    }
+  };
+
+  struct Irq {
+    void (*isr)();
+    int mode;
+  };
+
+  uint64_t s_now = 0;
+  uint64_t s_order = 0;
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event> > s_events;
+  uint8_t s_mode[NUM_PINS];
+  uint8_t s_level[NUM_PINS];
+  Irq s_irq[NUM_IRQS];
+  FILE* s_serial_out = NULL;
+  uint8_t s_eeprom[E2END + 1];
+  uint32_t s_eeprom_writes[E2END + 1];  // writes made to each cell
+  bool s_eeprom_used = false;       // s_eeprom initialised
+  uint64_t s_eeprom_busy = 0;       // time last EEPROM write is done (usec)
+
+}
+
+void sim::reset() {
+  s_now = 0;
+  s_order = 0;
+  s_events = std::priority_queue<Event, std::vector<Event>, std::greater<Event> >();
+  memset(s_mode, INPUT, sizeof s_mode);
+  memset(s_level, LOW, sizeof s_level);
+  memset(s_irq, 0, sizeof s_irq);
+  s_eeprom_busy = 0;
+  Serial = HardwareSerial();
+  twi_sim::reset();
+}
+
+uint64_t sim::now_us() {
+  return s_now;
+}
+
+void sim::schedule(uint64_t at_us, EventFunc fn, void* arg, uint32_t tag) {
+  Event e = { at_us < s_now ? s_now : at_us, s_order++, fn, arg, tag };
+  s_events.push(e);
+}
+
+void sim::run_until(uint64_t t_us) {
+  while (!s_events.empty() && s_events.top().at <= t_us) {
+    Event e = s_events.top();
+    s_events.pop();
+    s_now = e.at;
+    e.fn(e.arg, e.tag);
+  }
+  if (t_us > s_now) {
+    s_now = t_us;
+  }
+}
+
+void sim::drive_pin(uint8_t pin, int level) {
+  if (pin >= NUM_PINS) {
+    return;
+  }
+  uint8_t old = s_level[pin];
+  s_level[pin] = (level != LOW) ? HIGH : LOW;
+  int irq = digitalPinToInterrupt(pin);
+  if (irq == NOT_AN_INTERRUPT || s_irq[irq].isr == NULL || old == s_level[pin]) {
+    return;
+  }
+  int mode = s_irq[irq].mode;
+  bool rising = (s_level[pin] == HIGH);
+  if (mode == CHANGE || (mode == RISING && rising) || (mode == FALLING && !rising)) {
+    s_irq[irq].isr();
+  }
+}
+
+int sim::pin_level(uint8_t pin) {
+  return (pin < NUM_PINS) ? s_level[pin] : LOW;
+}
+
+void sim::serial_output(FILE* f) {
+  s_serial_out = f;
+}
+
+// Arduino core functions
+
+uint32_t millis() {
+  return (uint32_t) (s_now / 1000);
+}
+
+uint32_t micros() {
+  return (uint32_t) s_now;
+}
+
+void delay(uint32_t ms) {
+  sim::run_until(s_now + (uint64_t) ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  sim::run_until(s_now + us);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin < NUM_PINS) {
+    s_mode[pin] = mode;
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  if (pin < NUM_PINS && s_mode[pin] == OUTPUT) {
+    s_level[pin] = (val != LOW) ? HIGH : LOW;
+  }
+}
+
+int digitalRead(uint8_t pin) {
+  return sim::pin_level(pin);
+}
+
+void attachInterrupt(uint8_t irq, void (*isr)(), int mode) {
+  if (irq < NUM_IRQS) {
+    s_irq[irq].isr = isr;
+    s_irq[irq].mode = mode;
+  }
+}
+
+void detachInterrupt(uint8_t irq) {
+  if (irq < NUM_IRQS) {
+    s_irq[irq].isr = NULL;
+  }
+}
+
+// Serial: 10 bits (start, 8 data, stop) per byte, 64-byte transmit buffer
+
+#define SERIAL_TX_BUFFER 64
+
+void HardwareSerial::begin(unsigned long baud) {
+  m_byte_usec = 10.0e6 / (double) baud;
+  m_done_usec = (double) s_now;
+}
+
+int HardwareSerial::availableForWrite() {
+  if (m_byte_usec == 0.0 || m_done_usec <= (double) s_now) {
+    return SERIAL_TX_BUFFER;
+  }
+  int queued = (int) ceil((m_done_usec - (double) s_now) / m_byte_usec);
+  return queued >= SERIAL_TX_BUFFER ? 0 : SERIAL_TX_BUFFER - queued;
+}
+
+size_t HardwareSerial::write(uint8_t b) {
+  if (m_byte_usec != 0.0) {
+    // Wait for room in the buffer, then queue the byte behind the rest.
+    while (availableForWrite() == 0) {
+      uint64_t t = (uint64_t) ceil(m_done_usec - (SERIAL_TX_BUFFER - 1) * m_byte_usec);
+      sim::run_until(t > s_now ? t : s_now + 1);
+    }
+    if (m_done_usec < (double) s_now) {
+      m_done_usec = (double) s_now;
+    }
+    m_done_usec += m_byte_usec;
+  }
+  return fwrite(&b, 1, 1, s_serial_out != NULL ? s_serial_out : stdout);
+}
+
+// EEPROM: 3.4 msec per byte written, erased to 0xFF
+
+#define EEPROM_WRITE_USEC 3400
+
+void sim::eeprom_erase() {
+  memset(s_eeprom, 0xFF, sizeof s_eeprom);
+  memset(s_eeprom_writes, 0, sizeof s_eeprom_writes);
+  s_eeprom_used = true;
+}
+
+uint32_t sim::eeprom_writes(const int idx) {
+  return (s_eeprom_used && idx >= 0 && idx <= E2END) ? s_eeprom_writes[idx] : 0;
+}
+
+uint8_t EEPROMClass::read(const int idx) {
+  if (!s_eeprom_used) {
+    sim::eeprom_erase();
+  }
+  return (idx >= 0 && idx <= E2END) ? s_eeprom[idx] : 0xFF;
+}
+
+void EEPROMClass::write(const int idx, const uint8_t val) {
+  if (!s_eeprom_used) {
+    sim::eeprom_erase();
+  }
+  // Wait for the last write to finish.
+  if (s_eeprom_busy > s_now) {
+    sim::run_until(s_eeprom_busy);
+  }
+  if (idx >= 0 && idx <= E2END) {
+    s_eeprom[idx] = val;
+    ++s_eeprom_writes[idx];
+  }
+  s_eeprom_busy = s_now + EEPROM_WRITE_USEC;
+}
+
+bool eeprom_is_ready() {
+  return s_eeprom_busy <= s_now;
+}
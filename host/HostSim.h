@@ -0,0 +1,52 @@
+#ifndef _HOST_SIM__H_
+#define _HOST_SIM__H_
+
+// Discrete-event simulator behind the host Arduino stand-in.
+//
+// Time is virtual and only moves when run_until() (or delay()) is called,
+// so the sketch runs as fast as the CPU allows.  Simulated devices
+// schedule events on the clock and drive GPIO input levels; driving an
+// input pin that has an interrupt attached calls the ISR at that instant.
+
+#include <Arduino.h>
+
+namespace sim {
+
+  // Event callback: arg is the scheduling object, tag is caller-defined.
+  typedef void (*EventFunc)(void* arg, uint32_t tag);
+
+  // Restore power-on state: clock at zero, no pending events, all pins
+  // low and inputs, no interrupts attached, nothing on the I2C bus,
+  // Serial not begun.
+  void reset();
+
+  // Current simulated time (usec since reset).
+  uint64_t now_us();
+
+  // Queue fn(arg, tag) to run when the clock reaches at_us.
+  // Events due at the same time run in the order they were scheduled.
+  void schedule(uint64_t at_us, EventFunc fn, void* arg, uint32_t tag = 0);
+
+  // Advance the clock to t_us, running every event that falls due on the way.
+  void run_until(uint64_t t_us);
+
+  // Drive an input pin from outside the microcontroller, firing any
+  // interrupt attached to it.
+  void drive_pin(uint8_t pin, int level);
+
+  // Current level of a pin, as the sketch would read it.
+  int pin_level(uint8_t pin);
+
+  // Send Serial's output to a file instead of stdout (NULL for stdout).
+  void serial_output(FILE* f);
+
+  // Erase the whole EEPROM to 0xFF, which reset() leaves alone, as if
+  // the chip were new.
+  void eeprom_erase();
+
+  // Writes made to an EEPROM cell since it was erased.
+  uint32_t eeprom_writes(const int idx);
+
+}
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef _LIGHTSENSOR__H_
+#define _LIGHTSENSOR__H_
+
+// Empty host stand-in; the fake VL6180X lives in vl6180x_class.h.
+
+#endif
@@ -0,0 +1,309 @@
+#include "RangeTrace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <math.h>
+
+#include <algorithm>
+
+namespace {
+
+  // SplitMix64: small, fast and good enough for test traffic.
+  uint64_t mix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+  }
+
+  class Random {
+    uint64_t m_state;
+  public:
+    Random(uint64_t seed) : m_state(seed) {}
+    double uniform(double lo, double hi) {
+      m_state = mix(m_state);
+      return lo + (hi - lo) * (double) (m_state >> 11) / 9007199254740992.0;
+    }
+  };
+
+}
+
+// RecordedTrace
+
+RecordedTrace::RecordedTrace() : m_channels(0) {
+}
+
+bool RecordedTrace::load(const char* path) {
+  FILE* fp = fopen(path, "r");
+  if (fp == NULL) {
+    return false;
+  }
+  m_time.clear();
+  m_range.clear();
+  m_channels = 0;
+  char line[256];
+  bool ok = true;
+  while (ok && fgets(line, sizeof line, fp) != NULL) {
+    char* p = line;
+    while (*p == ' ' || *p == '\t') {
+      ++p;
+    }
+    if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') {
+      continue;
+    }
+    char* end;
+    double t_ms = strtod(p, &end);
+    if (end == p) {
+      ok = false;
+      break;
+    }
+    unsigned n = 0;
+    for (p = end; ; p = end) {
+      long r = strtol(p, &end, 10);
+      if (end == p) {
+        break;
+      }
+      m_range.push_back((uint8_t) (r < 0 ? 0 : (r > NO_TARGET_MM ? NO_TARGET_MM : r)));
+      ++n;
+    }
+    if (n == 0 || (m_channels != 0 && n != m_channels)) {
+      ok = false;
+      break;
+    }
+    m_channels = n;
+    m_time.push_back((uint64_t) (t_ms * 1000.0));
+  }
+  fclose(fp);
+  return ok && !m_time.empty();
+}
+
+unsigned RecordedTrace::channels() const {
+  return m_channels;
+}
+
+uint8_t RecordedTrace::range_mm(unsigned channel, uint64_t t_us) {
+  if (channel >= m_channels) {
+    return NO_TARGET_MM;
+  }
+  // Latest sample at or before t_us
+  std::vector<uint64_t>::const_iterator it =
+    std::upper_bound(m_time.begin(), m_time.end(), t_us);
+  if (it == m_time.begin()) {
+    return NO_TARGET_MM;
+  }
+  size_t i = (size_t) (it - m_time.begin()) - 1;
+  return m_range[i * m_channels + channel];
+}
+
+uint64_t RecordedTrace::duration_us() const {
+  return m_time.empty() ? 0 : m_time.back();
+}
+
+// SyntheticTrace
+
+SyntheticTrace::Params::Params() :
+  trains(100),
+  seed(1),
+  sensors(2),
+  spacing(127.0),
+  track_mm(33),
+  background_mm(NO_TARGET_MM),
+  beam(10.0),
+  noise_mm(2),
+  min_speed(28.0),      // about 10 scale mi/hr in N scale
+  max_speed(280.0),     // about 100 scale mi/hr in N scale
+  max_accel(0.0),
+  car_length(95.0),
+  car_gap(8.0),
+  nose(0.0),
+  nose_mm(60),
+  min_cars(1),
+  max_cars(12),
+  headway(5.0)
+{
+}
+
+SyntheticTrace::SyntheticTrace(const Params& params) :
+  m_params(params),
+  m_duration(0)
+{
+  Random rng(params.seed);
+  double t = params.headway;
+  for (unsigned i = 0; i < params.trains; ++i) {
+    TrainPass tp;
+    tp.speed = rng.uniform(params.min_speed, params.max_speed);
+    tp.accel = 0.0;
+    if (params.max_accel > 0.0) {
+      // No more than the train could slow by and still be moving.
+      double lim = std::min(params.max_accel, 0.75 * tp.speed * tp.speed / span());
+      tp.accel = rng.uniform(-lim, lim);
+    }
+    tp.direction = (rng.uniform(0.0, 1.0) < 0.5) ? 1 : -1;
+    tp.cars = params.min_cars +
+      (unsigned) rng.uniform(0.0, (double) (params.max_cars - params.min_cars + 1) - 1e-9);
+    tp.length = tp.cars * params.car_length + (tp.cars - 1) * params.car_gap;
+    tp.t_front_us = (uint64_t) (t * 1e6);
+    m_trains.push_back(tp);
+    double v_end = sqrt(tp.speed * tp.speed + tp.accel * span());
+    double t_span = (tp.accel == 0.0) ? span() / tp.speed
+      : (v_end - sqrt(tp.speed * tp.speed - tp.accel * span())) / tp.accel;
+    t += t_span + tp.length / v_end + params.headway;
+  }
+  m_duration = (uint64_t) (t * 1e6);
+}
+
+const std::vector<TrainPass>& SyntheticTrace::trains() const {
+  return m_trains;
+}
+
+// Distance from first sensor to last (mm).
+double SyntheticTrace::span() const {
+  return m_params.spacing * (m_params.sensors - 1);
+}
+
+// Distance a train's front has travelled dt sec after reaching the first
+// sensor it meets (mm).  Its speed at the middle of the span is tp.speed,
+// so it started at v0 where v0^2 = speed^2 - accel * span.  Before
+// then (dt < 0) it is taken to have run at v0.
+double SyntheticTrace::travel(const TrainPass& tp, double dt) const {
+  if (tp.accel == 0.0) {
+    return tp.speed * dt;
+  }
+  double v0 = sqrt(tp.speed * tp.speed - tp.accel * span());
+  double v_end = sqrt(tp.speed * tp.speed + tp.accel * span());
+  double t_span = (v_end - v0) / tp.accel;
+  if (dt < 0.0) {
+    return v0 * dt;
+  }
+  if (dt < t_span) {
+    return v0 * dt + 0.5 * tp.accel * dt * dt;
+  }
+  return span() + v_end * (dt - t_span);
+}
+
+// Distance back from the front of a train to sensor position x (mm,
+// channel 0 at 0) at time t_us, negative before the front reaches it.
+double SyntheticTrace::behind(const TrainPass& tp, double x, uint64_t t_us) const {
+  double moved = travel(tp, ((double) t_us - (double) tp.t_front_us) * 1e-6);
+  return (tp.direction > 0) ? (moved - x) : (moved - (span() - x));
+}
+
+// Fraction of the beam footprint centred on sensor position x
+// (mm, channel 0 at 0) which is filled by car bodies at time t_us.
+double SyntheticTrace::coverage(const TrainPass& tp, double x, uint64_t t_us) const {
+  double d = behind(tp, x, t_us);
+  double half = 0.5 * m_params.beam;
+  if (d + half < 0.0 || d - half > tp.length) {
+    return 0.0;
+  }
+  if (half <= 0.0) {
+    double pitch = m_params.car_length + m_params.car_gap;
+    return ((d - pitch * floor(d / pitch)) <= m_params.car_length) ? 1.0 : 0.0;
+  }
+  // Sum overlap of footprint [d - half, d + half] with each car body.
+  double pitch = m_params.car_length + m_params.car_gap;
+  double filled = 0.0;
+  int first = (int) floor((d - half) / pitch);
+  int last = (int) floor((d + half) / pitch);
+  for (int i = (first < 0 ? 0 : first); i <= last && i < (int) tp.cars; ++i) {
+    double lo = std::max(d - half, i * pitch);
+    double hi = std::min(d + half, i * pitch + m_params.car_length);
+    if (hi > lo) {
+      filled += hi - lo;
+    }
+  }
+  return filled / m_params.beam;
+}
+
+uint8_t SyntheticTrace::range_mm(unsigned channel, uint64_t t_us) {
+  if (channel >= m_params.sensors || m_trains.empty()) {
+    return m_params.background_mm;
+  }
+  double x = channel * m_params.spacing;
+  // Only the most recent train to arrive can be alongside the sensors,
+  // since trains are separated by the headway, except that the next
+  // train's front enters the first sensor's beam just before it arrives.
+  size_t lo = 0, hi = m_trains.size();
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (m_trains[mid].t_front_us <= t_us) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  const TrainPass* tp = (lo > 0) ? &m_trains[lo - 1] : NULL;
+  if (lo < m_trains.size() && coverage(m_trains[lo], x, t_us) > 0.0) {
+    tp = &m_trains[lo];
+  }
+  if (tp == NULL) {
+    return m_params.background_mm;
+  }
+  double p = coverage(*tp, x, t_us);
+  if (p <= 0.0) {
+    return m_params.background_mm;
+  }
+  int noise = 0;
+  if (m_params.noise_mm > 0) {
+    uint64_t h = mix((t_us << 4) ^ channel ^ ((uint64_t) m_params.seed << 40));
+    noise = (int) (h % (2u * m_params.noise_mm + 1)) - m_params.noise_mm;
+  }
+  // A sloping nose is further from the sensor at its tip.
+  double body = m_params.track_mm;
+  if (m_params.nose > 0.0) {
+    double d = behind(*tp, x, t_us);
+    if (d < m_params.nose) {
+      double f = d < 0.0 ? 0.0 : d / m_params.nose;
+      body = m_params.nose_mm + f * (m_params.track_mm - m_params.nose_mm);
+    }
+  }
+  // A partly filled beam sees a blend of train and background.
+  int r = (int) (body + (1.0 - p) * (m_params.background_mm - body) + 0.5) + noise;
+  return (uint8_t) (r < 0 ? 0 : (r > 0xFF ? 0xFF : r));
+}
+
+uint64_t SyntheticTrace::duration_us() const {
+  return m_duration;
+}
+
+// MultiTrackTrace
+
+MultiTrackTrace::MultiTrackTrace(const SyntheticTrace::Params& params, unsigned tracks) :
+  m_sensors(params.sensors)
+{
+  for (unsigned t = 0; t < tracks; ++t) {
+    SyntheticTrace::Params p = params;
+    p.seed = params.seed + 7919 * t;
+    m_tracks.push_back(new SyntheticTrace(p));
+  }
+}
+
+MultiTrackTrace::~MultiTrackTrace() {
+  for (size_t t = 0; t < m_tracks.size(); ++t) {
+    delete m_tracks[t];
+  }
+}
+
+unsigned MultiTrackTrace::tracks() const {
+  return (unsigned) m_tracks.size();
+}
+
+const SyntheticTrace& MultiTrackTrace::track(unsigned t) const {
+  return *m_tracks[t];
+}
+
+uint8_t MultiTrackTrace::range_mm(unsigned channel, uint64_t t_us) {
+  if (channel / m_sensors >= m_tracks.size()) {
+    return NO_TARGET_MM;
+  }
+  return m_tracks[channel / m_sensors]->range_mm(channel % m_sensors, t_us);
+}
+
+uint64_t MultiTrackTrace::duration_us() const {
+  uint64_t d = 0;
+  for (size_t t = 0; t < m_tracks.size(); ++t) {
+    d = std::max(d, m_tracks[t]->duration_us());
+  }
+  return d;
+}
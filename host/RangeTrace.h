@@ -0,0 +1,125 @@
+#ifndef _RANGE_TRACE__H_
+#define _RANGE_TRACE__H_
+
+// Range traces which feed the fake VL6180X devices in host builds.
+// A channel is one sensor; channel numbers are assigned by the wiring
+// passed to VL6180X::connect().
+
+#include <stdint.h>
+
+#include <vector>
+
+// Range reported when nothing is in front of the sensor (mm)
+#define NO_TARGET_MM 255
+
+class RangeSource {
+
+  public:
+    virtual ~RangeSource() {}
+    // Range seen by a channel at a given time (mm).
+    virtual uint8_t range_mm(unsigned channel, uint64_t t_us) = 0;
+    // Length of the trace (usec).
+    virtual uint64_t duration_us() const = 0;
+
+};
+
+// Trace recorded from real sensors, as a text file with one line per
+// sample time:
+//   t_msec range0 range1 ...
+// Each range holds until the next line.  Blank lines and lines starting
+// with '#' are ignored.
+class RecordedTrace : public RangeSource {
+
+  private:
+    unsigned m_channels;          // ranges per line
+    std::vector<uint64_t> m_time; // sample times (usec)
+    std::vector<uint8_t> m_range; // m_channels ranges per sample time
+
+  public:
+    RecordedTrace();
+    bool load(const char* path);
+    unsigned channels() const;
+    virtual uint8_t range_mm(unsigned channel, uint64_t t_us);
+    virtual uint64_t duration_us() const;
+
+};
+
+// Ground truth for one synthetic train.
+struct TrainPass {
+  uint64_t t_front_us;  // time front of train reaches first sensor (usec)
+  double speed;         // real speed as front passes middle of span (mm/sec)
+  double accel;         // acceleration until front reaches last sensor (mm/sec^2)
+  int direction;        // +1 runs from channel 0 up, -1 from last channel down
+  unsigned cars;        // number of cars
+  double length;        // overall length (mm)
+};
+
+// Trace of trains passing a row of sensors (channels 0, 1, ...) with gaps
+// between cars and a little range noise.  A train may speed up or slow
+// down steadily until its front reaches the last sensor it meets, and
+// keeps its speed from then on.
+// While a car end is within the beam footprint, the range is a blend
+// of train and background in proportion to the part of the beam filled.
+// Every run with the same parameters produces the same trace.
+class SyntheticTrace : public RangeSource {
+
+  public:
+    struct Params {
+      unsigned trains;        // number of trains
+      uint32_t seed;          // random seed
+      unsigned sensors;       // sensors in the row
+      double spacing;         // spacing of neighbouring sensors (mm)
+      uint8_t track_mm;       // range to side of passing train (mm)
+      uint8_t background_mm;  // range with no train (mm)
+      double beam;            // width of beam footprint along track (mm)
+      uint8_t noise_mm;       // peak range noise (mm)
+      double min_speed;       // slowest train (mm/sec)
+      double max_speed;       // fastest train (mm/sec)
+      double max_accel;       // largest acceleration either way (mm/sec^2)
+      double car_length;      // length of one car (mm)
+      double car_gap;         // gap between cars (mm)
+      double nose;            // length of sloping nose on first car (mm, 0 for square)
+      uint8_t nose_mm;        // range to tip of nose (mm)
+      unsigned min_cars;      // shortest train (cars)
+      unsigned max_cars;      // longest train (cars)
+      double headway;         // quiet time between trains (sec)
+      Params();
+    };
+
+  private:
+    const Params m_params;
+    std::vector<TrainPass> m_trains;
+    uint64_t m_duration;
+
+    double span() const;
+    double travel(const TrainPass& tp, double dt) const;
+    double behind(const TrainPass& tp, double x, uint64_t t_us) const;
+    double coverage(const TrainPass& tp, double x, uint64_t t_us) const;
+
+  public:
+    SyntheticTrace(const Params& params);
+    const std::vector<TrainPass>& trains() const;
+    virtual uint8_t range_mm(unsigned channel, uint64_t t_us);
+    virtual uint64_t duration_us() const;
+
+};
+
+// Independent synthetic traffic on several tracks, with channels Kt to
+// Kt + K - 1 being the K sensors along track t.
+class MultiTrackTrace : public RangeSource {
+
+  private:
+    std::vector<SyntheticTrace*> m_tracks;
+    unsigned m_sensors;           // sensors along each track
+
+  public:
+    MultiTrackTrace(const SyntheticTrace::Params& params, unsigned tracks);
+    virtual ~MultiTrackTrace();
+    unsigned tracks() const;
+    const SyntheticTrace& track(unsigned t) const;
+    virtual uint8_t range_mm(unsigned channel, uint64_t t_us);
+    virtual uint64_t duration_us() const;
+
+};
+
+#endif
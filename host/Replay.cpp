@@ -0,0 +1,349 @@
+#include "Replay.h"
+
+#include "HostSim.h"
+#include "FakeTWI.h"
+#include "FakeHT16K33.h"
+
+#include <algorithm>
+#include <chrono>
+
+#define MI_PER_KM (0.62137119224)
+
+ReplayConfig::ReplayConfig() :
+  scale(Speedometer::eJP),
+  metric(true),
+  center(33),
+  hwidth(12),
+  hysteresis(7),
+  loop_usec(100),
+  loop_jitter_usec(0),
+  measure_usec(3000),
+  continuous(true),
+  sampling(Speedometer::eTicked),
+  idle_msec(SAMPLE_IDLE_MSEC),
+  tracks(1),
+  sensors(2),
+  spacing(SPACING_MM),
+  async_i2c(true),
+  telemetry_out(NULL),
+  display(false),
+  calibrate(false),
+  pass_log(false),
+  correlate(false),
+  fault_usec(0),
+  fault_all(false),
+  tune(false),
+  conv_usec(0),
+  conv2_usec(0)
+{
+}
+
+// Draw a speed as the sketch does, such as " 123KPH ", or "1 123KPH"
+// with more than one track.
+static void show(AlphaDisplay& display, char* text, uint8_t tracks, uint8_t t,
+                 uint16_t speed, bool metric) {
+  uint8_t pos = 0;
+  if (tracks > 1) {
+    display.printNumber(0, 1, t + 1);
+    pos = 1;
+  } else {
+    display.putChar(DISPLAY_CHARS - 1, ' ');
+  }
+  display.printNumber(pos, 4, speed);
+  display.printText(pos + 4, metric ? "KPH" : "MPH");
+  // Digits the display has room for, so the text is bounded as it is
+  unsigned track = (unsigned) ((t + 1) % 10);
+  unsigned digits = (unsigned) (speed % 10000);
+  if (tracks > 1) {
+    snprintf(text, DISPLAY_CHARS + 1, "%1u%4u%s", track, digits, metric ? "KPH" : "MPH");
+  } else {
+    snprintf(text, DISPLAY_CHARS + 1, "%4u%s ", digits, metric ? "KPH" : "MPH");
+  }
+}
+
+// Constructor
+Replay::Replay(const ReplayConfig& config) : m_config(config) {
+  memset(&m_stats, 0, sizeof m_stats);
+}
+
+void Replay::run(RangeSource& src, uint64_t duration_us, std::vector<PassResult>& passes,
+                 std::vector<SummaryResult>* summaries) {
+
+  sim::reset();
+  VL6180X::disconnect_all();
+  // Channel Kt + j is sensor j along track t, as wired.
+  for (uint8_t i = 0; i < m_config.tracks * m_config.sensors; ++i) {
+    const Speedometer::SensorPins& sp = Speedometer::sensorPins(i);
+    VL6180X::connect(sp.ena, i, sp.intr);
+  }
+  VL6180X::set_source(&src);
+  VL6180X::set_measure_usec(m_config.measure_usec);
+  VL6180X::set_convergence_usec(m_config.conv_usec);
+  FakeHT16K33 chip0(0x70), chip1(0x71);
+  AlphaDisplay display;
+  if (m_config.display) {
+    twi_sim::attach(&chip0);
+    twi_sim::attach(&chip1);
+  }
+
+  // Same start-up sequence as the sketch's setup().
+  RangeWindow<uint8_t> window(m_config.center, m_config.hwidth, m_config.hysteresis);
+  Speedometer meter(m_config.scale, m_config.tracks, m_config.sensors);
+  meter.setMetric(m_config.metric);
+  meter.setSampling(m_config.sampling, m_config.idle_msec);
+  meter.setCorrelation(m_config.correlate);
+  if (m_config.spacing != SPACING_MM) {
+    uint16_t mm[MAX_TRACK_SENSORS - 1];
+    for (uint8_t j = 0; j < MAX_TRACK_SENSORS - 1; ++j) {
+      mm[j] = m_config.spacing;
+    }
+    meter.setSpacings(mm);
+  }
+  meter.setWindow(&window);
+  i2c_queue = I2CQueue();
+#if PROFILE
+  profile.reset();
+#endif
+#if TELEMETRY
+  telemetry = Telemetry();
+  if (m_config.telemetry_out != NULL) {
+    sim::serial_output(m_config.telemetry_out);
+    Serial.begin(115200);
+  }
+#endif
+  bool shown = false;
+  if (m_config.display) {
+    shown = display.begin(0);
+  }
+  if (m_config.calibrate || m_config.pass_log) {
+    sim::eeprom_erase();
+  }
+  Calibrator cal(0);
+  if (m_config.calibrate) {
+    cal.begin(m_config.sensors);
+    meter.setCalibrator(&cal);
+  }
+  PassLog log;
+  std::vector<PassResult> logged;   // pass results queued to the log
+  if (m_config.pass_log) {
+    log.begin();
+  }
+  meter.begin(m_config.continuous, m_config.async_i2c);
+  meter.setTuning(m_config.tune);
+
+  memset(&m_stats, 0, sizeof m_stats);
+  uint64_t bus_start = twi_sim::busy_usec();
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  uint64_t now = sim::now_us();
+  uint64_t pass = now;          // time the last pass of loop() began
+  uint32_t rng = 1;
+  uint64_t fault_us = now + m_config.fault_usec;  // time next fault is injected
+  unsigned nsens = m_config.tracks * m_config.sensors;
+  unsigned nfault = 0;
+  bool darkened = false;        // convergence time changed halfway
+  while (now < duration_us) {
+    // A pass takes loop_usec, update() included, unless update() blocked
+    // for longer; so passes fall on the same times whatever came before.
+    pass += m_config.loop_usec;
+    if (m_config.loop_jitter_usec != 0) {
+      // Stall the loop at random, as blocking I2C or Serial calls would.
+      rng = rng * 1103515245u + 12345u;
+      pass += (rng >> 8) % (m_config.loop_jitter_usec + 1);
+    }
+    if (pass < now) {
+      pass = now;
+    }
+    now = pass;
+    sim::run_until(now);
+    if (m_config.fault_usec != 0 && now >= fault_us) {
+      // Each sensor in turn hangs, then next time round stops answering;
+      // with fault_all, every sensor at once.  One still out of service
+      // from the last fault is passed over.
+      unsigned first = m_config.fault_all ? 0 : nfault % nsens;
+      unsigned count = m_config.fault_all ? nsens : 1;
+      unsigned round = m_config.fault_all ? nfault : nfault / nsens;
+      VL6180X::E_Fault kind = (round & 1) ? VL6180X::eMute : VL6180X::eHang;
+      for (unsigned i = first; i < first + count; ++i) {
+        if (VL6180X::inject(i, kind)) {
+          ++m_stats.injected;
+        }
+      }
+      ++nfault;
+      fault_us += m_config.fault_usec;
+    }
+    if (m_config.conv2_usec != 0 && !darkened && now >= duration_us / 2) {
+      // Darker or shinier stock from here on
+      VL6180X::set_convergence_usec(m_config.conv2_usec);
+      darkened = true;
+    }
+    ++m_stats.loops;
+    bool ticked = meter.update();
+    // Blocking I2C moves the clock on inside update().
+    uint32_t dt = (uint32_t) (sim::now_us() - now);
+    now = sim::now_us();
+    m_stats.update_usec += dt;
+    if (dt > m_stats.update_max_usec) {
+      m_stats.update_max_usec = dt;
+    }
+#if TELEMETRY
+    if (!ticked && m_config.telemetry_out != NULL) {
+      telemetry.drain();
+    }
+#endif
+    if (!ticked && shown) {
+      display.update();
+    }
+    if (!ticked && m_config.pass_log) {
+      log.update();
+    }
+    if (!ticked && m_config.calibrate && cal.update()) {
+      // As the sketch does, move the window to the nearest track found.
+      CalWindow w = cal.window(0);
+      window.set(w.center, w.hwidth, w.hysteresis);
+      m_stats.cal_found = true;
+      m_stats.cal_us = now;
+      m_stats.cal_passes = cal.passes();
+      m_stats.cal_windows = cal.windows();
+      m_stats.cal_window = w;
+    }
+    if (ticked) {
+      ++m_stats.ticks;
+      for (uint8_t t = 0; t < m_config.tracks; ++t) {
+        if (meter.isUpdated(t)) {
+          if (shown) {
+            show(display, m_stats.display_text, m_config.tracks, t,
+                 (meter.getSpeedFixed(t) + SPEED_FRAC / 2) / SPEED_FRAC, m_config.metric);
+            ++m_stats.display_shown;
+          }
+          PassResult pr = { t, now, meter.getSpeed(t), meter.getProfile(t) };
+          passes.push_back(pr);
+        }
+        if (meter.isResult(t)) {
+          // As the sketch does, show the mean of both speeds and log it.
+          const Speedometer::SpeedResult& res = meter.getResult(t);
+          if (shown) {
+            show(display, m_stats.display_text, m_config.tracks, t,
+                 (res.mean + SPEED_FRAC / 2) / SPEED_FRAC, m_config.metric);
+            ++m_stats.display_shown;
+          }
+          if (m_config.pass_log && log.add(t, res.direction, res.mean)) {
+            PassResult pr = { t, now, meter.getSpeed(t), meter.getProfile(t) };
+            logged.push_back(pr);
+          }
+        }
+        if (meter.isSummarized(t) && summaries != NULL) {
+          SummaryResult sr = { t, now, meter.getSummary(t), meter.getResult(t) };
+          summaries->push_back(sr);
+        }
+      }
+    }
+  }
+  std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+  m_stats.wall_sec = wall.count();
+  m_stats.sim_us = now;
+  for (unsigned i = 0; i < MAX_SENSORS; ++i) {
+    m_stats.samples[i] = VL6180X::samples(i);
+  }
+  m_stats.bus_usec = twi_sim::busy_usec() - bus_start;
+  m_stats.queue_max = i2c_queue.maxDepth();
+  m_stats.transfers = i2c_queue.completed();
+  m_stats.failed = i2c_queue.failed();
+  m_stats.collisions = VL6180X::collisions();
+  for (unsigned i = 0; i < nsens; ++i) {
+    m_stats.health[i] = meter.getHealth(i / m_config.sensors, i % m_config.sensors);
+    const ConvergenceTuner& tuner = meter.getTuner(i / m_config.sensors, i % m_config.sensors);
+    m_stats.conv_msec[i] = tuner.msec();
+    m_stats.conv_tunes[i] = tuner.tunes();
+    m_stats.conv_lost[i] = tuner.lost();
+  }
+  if (shown) {
+    // Let the last speed out, then read back what the chips show.
+    display.flush();
+    m_stats.display_writes = chip0.writes() + chip1.writes();
+    m_stats.display_bytes = chip0.bytes() + chip1.bytes();
+    m_stats.display_ok = chip0.on() && chip1.on();
+    for (uint8_t i = 0; i < DISPLAY_CHARS && m_stats.display_shown > 0; ++i) {
+      const FakeHT16K33& chip = (i < 4) ? chip0 : chip1;
+      m_stats.display_ok = m_stats.display_ok
+        && chip.segments(i % 4) == AlphaDisplay::glyph(m_stats.display_text[i]);
+    }
+  }
+  if (m_stats.cal_found) {
+    // Let the windows be saved, then load them as the sketch would at boot.
+    while (cal.active()) {
+      sim::run_until(sim::now_us() + 1000);
+      cal.update();
+    }
+    Calibrator boot(0);
+    m_stats.cal_saved = boot.load() && boot.windows() == cal.windows();
+    for (uint8_t i = 0; i < boot.windows() && m_stats.cal_saved; ++i) {
+      CalWindow a = boot.window(i);
+      CalWindow b = cal.window(i);
+      m_stats.cal_saved = a.center == b.center && a.hwidth == b.hwidth
+        && a.hysteresis == b.hysteresis;
+    }
+  }
+  if (m_config.pass_log) {
+    // Let the last passes be written, then power-cycle and read them back.
+    while (log.pending() > 0) {
+      sim::run_until(sim::now_us() + 1000);
+      log.update();
+    }
+    m_stats.log_added = logged.size();
+    m_stats.log_lost = log.lost();
+    PassLog boot;
+    boot.begin();
+    m_stats.log_records = boot.records();
+    checkLog(boot, logged);
+    for (int a = LOG_EEPROM_ADDR; a <= E2END; ++a) {
+      m_stats.log_wear = std::max(m_stats.log_wear, sim::eeprom_writes(a));
+    }
+  }
+  meter.setCalibrator(NULL);
+#if TELEMETRY
+  if (m_config.telemetry_out != NULL) {
+    // Let the last records out.
+    while (telemetry.pending() > 0) {
+      sim::run_until(sim::now_us() + 1000);
+      telemetry.drain();
+    }
+    sim::serial_output(NULL);
+  }
+  m_stats.telemetry_dropped = telemetry.dropped();
+#endif
+
+  VL6180X::set_source(NULL);
+
+}
+
+// Private method
+// Check the records read back from the pass log are the last pass
+// results queued, logged[k] being the k-th queued.  Each record's time is
+// the whole seconds elapsed since the pass before, or since power-up for
+// the first.
+void Replay::checkLog(const PassLog& log, const std::vector<PassResult>& logged) {
+  size_t n = log.records();
+  m_stats.log_ok = n == std::min(logged.size(), (size_t) LOG_RECORDS);
+  for (size_t i = 0; i < n && m_stats.log_ok; ++i) {
+    size_t k = logged.size() - n + i;
+    const PassResult& pr = logged[k];
+    PassRecord rec = log.record((uint16_t) i);
+    uint16_t speed = (uint16_t) std::min((int) (pr.speed * SPEED_FRAC), LOG_MAX_SPEED);
+    uint64_t secs = pr.t_us / 1000000;
+    if (k > 0) {
+      secs -= logged[k - 1].t_us / 1000000;
+    }
+    m_stats.log_ok = rec.boot == (k == 0) && rec.track == pr.track
+      && rec.direction == pr.profile.direction && rec.speed == speed
+      && rec.secs == std::min(secs, (uint64_t) LOG_MAX_SECS);
+  }
+}
+
+const ReplayStats& Replay::stats() const {
+  return m_stats;
+}
+
+double Replay::scale_speed(double mm_per_sec) const {
+  double km_per_hr = mm_per_sec * 1e-3 * (double) m_config.scale * 3.6;
+  return km_per_hr * (m_config.metric ? 1.0 : MI_PER_KM);
+}
@@ -0,0 +1,118 @@
+#ifndef _REPLAY__H_
+#define _REPLAY__H_
+
+// Runs the sketch's Speedometer against a RangeSource in simulated time,
+// as fast as the host CPU allows.
+
+#include "Speedometer.h"
+#include "AlphaDisplay.h"
+#include "PassLog.h"
+
+#include "RangeTrace.h"
+
+#include <vector>
+
+struct ReplayConfig {
+  Speedometer::E_Scale scale;   // model scale
+  bool metric;                  // km/hr (true) or mi/hr (false)
+  uint8_t center;               // RangeWindow center (mm)
+  uint8_t hwidth;               // RangeWindow half-width (mm)
+  uint8_t hysteresis;           // RangeWindow hysteresis (mm)
+  uint32_t loop_usec;           // simulated time taken by one pass of loop()
+  uint32_t loop_jitter_usec;    // extra random time per pass, up to this
+  uint32_t measure_usec;        // VL6180X measurement time
+  bool continuous;              // continuous ranging instead of single-shot
+  Speedometer::E_Sampling sampling;   // single-shot sampling policy
+  uint16_t idle_msec;           // idle period under eAdaptive (msec)
+  uint8_t tracks;               // number of tracks
+  uint8_t sensors;              // sensors along each track
+  uint16_t spacing;             // spacing of neighbouring sensors (mm)
+  bool async_i2c;               // post I2C transfers to queue instead of blocking
+  FILE* telemetry_out;          // file to capture telemetry in, or NULL
+  bool display;                 // show speeds on a simulated AlphaDisplay
+  bool calibrate;               // calibrate track 0's window as trains pass
+  bool pass_log;                // log every speed in EEPROM (PassLog.h)
+  bool correlate;               // refine speeds by matching profiles (Correlator.h)
+  uint32_t fault_usec;          // time between sensor faults injected, or 0
+  bool fault_all;               // each fault hits every sensor at once
+  bool tune;                    // tune max convergence times (ConvergenceTuner.h)
+  uint32_t conv_usec;           // convergence time at 50 mm (usec), or 0 for none
+  uint32_t conv2_usec;          // convergence time from halfway through, or 0 for no change
+  ReplayConfig();
+};
+
+// One speed reported by the Speedometer
+struct PassResult {
+  uint8_t track;      // track the speed was measured on
+  uint64_t t_us;      // simulated time the speed was reported (usec)
+  double speed;       // reported speed (scale km/hr or mi/hr)
+  Speedometer::SpeedProfile profile;  // profile of the same pass
+};
+
+// One pass summary reported by the Speedometer
+struct SummaryResult {
+  uint8_t track;      // track the pass was on
+  uint64_t t_us;      // simulated time the summary was reported (usec)
+  Speedometer::PassSummary summary;
+  Speedometer::SpeedResult result;  // speeds of the same pass
+};
+
+struct ReplayStats {
+  uint64_t loops;     // passes through loop()
+  uint64_t ticks;     // Speedometer::update() calls that returned true
+  uint64_t sim_us;    // simulated time covered (usec)
+  double wall_sec;    // host time taken (sec)
+  uint64_t samples[MAX_SENSORS];      // measurements made by each sensor
+  uint64_t update_usec;         // simulated time spent in Speedometer::update()
+  uint32_t update_max_usec;     // longest single call of Speedometer::update()
+  uint64_t bus_usec;            // time the I2C bus was busy
+  uint8_t queue_max;            // deepest the I2C transfer queue got
+  uint32_t transfers;           // I2C transfers completed through the queue
+  uint32_t failed;              // I2C transfers failed
+  uint32_t telemetry_dropped;   // telemetry records dropped for want of room
+  uint32_t display_shown;       // speeds drawn on the display
+  uint32_t display_writes;      // I2C writes to the display chips
+  uint32_t display_bytes;       // display RAM bytes written
+  char display_text[DISPLAY_CHARS + 1];   // text drawn last
+  bool display_ok;              // chips show the text drawn last
+  bool cal_found;               // calibration found a window
+  uint64_t cal_us;              // simulated time it was found (usec)
+  uint16_t cal_passes;          // passes each sensor had seen by then
+  uint8_t cal_windows;          // windows found
+  CalWindow cal_window;         // nearest window found, applied to every track
+  bool cal_saved;               // windows read back from EEPROM match
+  uint32_t log_added;           // passes queued to the pass log
+  uint16_t log_lost;            // passes lost to a full queue
+  uint16_t log_records;         // records read back after a power cycle
+  bool log_ok;                  // records read back match the last passes queued
+  uint32_t log_wear;            // most writes made to any cell of the log
+  uint32_t injected;            // sensor faults injected
+  uint32_t collisions;          // sensors given another's I2C address
+  SensorHealth health[MAX_SENSORS];   // each sensor's faults and recoveries
+  uint8_t conv_msec[MAX_SENSORS];     // each sensor's max convergence time at the end (msec)
+  uint16_t conv_tunes[MAX_SENSORS];   // times each sensor was tuned
+  uint16_t conv_lost[MAX_SENSORS];    // targets each sensor lost to convergence errors
+};
+
+class Replay {
+
+  private:
+    const ReplayConfig m_config;
+    ReplayStats m_stats;
+
+    void checkLog(const PassLog& log, const std::vector<PassResult>& logged);
+
+  public:
+    Replay(const ReplayConfig& config);
+    // Replay src from time zero for duration_us, appending every
+    // reported speed to passes, and every pass summary to summaries
+    // if given.
+    void run(RangeSource& src, uint64_t duration_us, std::vector<PassResult>& passes,
+             std::vector<SummaryResult>* summaries = NULL);
+    const ReplayStats& stats() const;
+    // Scale speed in configured units for a real speed (mm/sec).
+    double scale_speed(double mm_per_sec) const;
+
+};
+
+#endif
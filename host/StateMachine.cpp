@@ -0,0 +1,19 @@
+#include "StateMachine.h"
+
+// Constructor
+StateMachine::StateMachine(const uint32_t period, const bool realtime) :
+  m_next(millis() + period),
+  m_period(period),
+  m_realtime(realtime)
+{
+}
+
+// Return true if it's time for the state machine to update.
+bool StateMachine::update() {
+  uint32_t now = millis();
+  if ((int32_t) (now - m_next) >= 0) {
+    m_next = (m_realtime ? m_next : now) + m_period;
+    return true;
+  }
+  return false;
+}
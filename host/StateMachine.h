@@ -0,0 +1,25 @@
+#ifndef _STATE_MACHINE__H_
+#define _STATE_MACHINE__H_
+
+// Host stand-in for the StateMachine library
+// (github.com/twrackers/StateMachine-library).
+// update() returns true once every m_period msec of simulated time.
+// In real-time mode the next due time advances by exactly one period,
+// so late calls do not accumulate drift.
+
+#include <Arduino.h>
+
+class StateMachine {
+
+  private:
+    uint32_t m_next;        // time (msec) at which next update is due
+    const uint32_t m_period; // update period (msec)
+    const bool m_realtime;  // true to keep fixed phase, false to restart period
+
+  public:
+    StateMachine(const uint32_t period, const bool realtime);
+    virtual bool update();
+
+};
+
+#endif
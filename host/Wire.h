@@ -0,0 +1,25 @@
+#ifndef _WIRE__H_
+#define _WIRE__H_
+
+// Host stand-in for the Arduino Wire library.  The fake VL6180X driver
+// models its Wire transfers itself, so only the bit rate set here, in the
+// fake TWI's registers, matters.
+
+#include <Arduino.h>
+
+#include <util/twi.h>
+
+class TwoWire {
+
+  public:
+    void begin() { setClock(100000); }
+    void setClock(uint32_t clock) {
+      TWSR &= ~3;
+      TWBR = ((F_CPU / clock) - 16) / 2;
+    }
+
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,468 @@
+// Analyse a binary capture of range samples (Capture.h) through the
+// sketch's Speedometer on every CPU, and report every measured speed in
+// capture order, as replay does for a text trace.
+//
+// The capture is memory-mapped and split into chunks at quiet stretches,
+// where no channel has seen anything nearer than ARM_MM for long enough
+// that every track's state machine is certainly eClear.  Each chunk is
+// replayed by a worker process from power-on, starting WARMUP_USEC
+// before the chunk so that its filters are full, and keeps only the
+// results from the chunk itself; the parent merges them in order.
+// Chunks start on a whole number of sensor periods and loop() passes, so
+// a worker samples the capture at the same instants as one replay of the
+// whole capture would, and reports the same speeds at the same times.
+//
+// Workers are processes rather than threads because the host Arduino
+// stand-in (clock, pins, I2C bus and devices) is global.
+//
+// Usage: analyze [options] capture.bin
+//   -j workers  worker processes (default one per CPU)
+//   -c          replay the whole capture as one chunk in this process, the
+//               single-threaded run the split replay must match
+//   -s scale    uk, jp or us (default jp)
+//   -i          imperial units (mi/hr) instead of metric (km/hr)
+//   -w center   RangeWindow center (mm, default 33)
+//   -t tracks   number of tracks (default 1)
+//   -k sensors  sensors along each track, 2 to 4 (default 2)
+//   -d mm       spacing of neighbouring sensors (default 127)
+//   -1          trigger single-shot measurements from the 5 msec tick
+//               instead of continuous ranging
+//   -S          print pass summaries (length, cars, gaps) instead of speeds
+//   -q          quiet: print only the summary
+
+#include "Replay.h"
+#include "Capture.h"
+
+#include <getopt.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <vector>
+
+// Time after the last range nearer than ARM_MM by which a track is
+// certainly eClear, beyond the Speedometer's wait for a second sensor:
+// its 1.5 sec clearing timeout and the settling of its filters, with
+// room to spare (usec)
+#define CLEAR_USEC 3000000
+
+// Replay of a chunk from power-on before its results count (usec)
+#define WARMUP_USEC 1000000
+
+// Chunks start on a multiple of this: the 10 msec continuous ranging
+// period, which is also two 5 msec ticks and 100 loop() passes (usec)
+#define ALIGN_USEC 10000
+
+// Part of the capture replayed by one worker
+struct Chunk {
+  uint64_t start_us;    // capture time replay starts from power-on
+  uint64_t from_us;     // capture time results start counting
+  uint64_t to_us;       // capture time the next chunk's results start
+};
+
+// Result passed from a worker to the parent
+struct Message {
+  enum E_Kind {
+    eSpeed,             // a speed reported
+    eSummary,           // a pass summary reported
+    eDone               // chunk finished; sim_us holds its length
+  };
+  uint32_t chunk;       // chunk the result came from
+  uint8_t kind;         // E_Kind
+  uint64_t sim_us;      // simulated time replayed, for eDone
+  PassResult pass;      // for eSpeed, time in capture time
+  SummaryResult summary;  // for eSummary, time in capture time
+};
+
+// Results of one chunk
+struct ChunkResults {
+  std::vector<PassResult> passes;
+  std::vector<SummaryResult> summaries;
+  uint64_t sim_us;
+  bool done;
+};
+
+static void usage() {
+  fprintf(stderr, "usage: analyze [-j workers] [-c] [-s uk|jp|us] [-i] [-w center] [-t tracks] [-k sensors] [-d mm] [-1] [-S] [-q] capture.bin\n");
+}
+
+// Longest wait of the configured Speedometer for a second sensor (usec).
+static uint32_t timeout_usec(const ReplayConfig& config) {
+  Speedometer meter(config.scale, config.tracks, config.sensors);
+  meter.setMetric(config.metric);
+  if (config.spacing != SPACING_MM) {
+    uint16_t mm[MAX_TRACK_SENSORS - 1];
+    for (uint8_t j = 0; j < MAX_TRACK_SENSORS - 1; ++j) {
+      mm[j] = config.spacing;
+    }
+    meter.setSpacings(mm);
+  }
+  return meter.getTimeout();
+}
+
+// Split a capture into chunks at quiet stretches long enough to hold
+// settle_us of quiet, then a warm-up, before the next sample nearer than
+// ARM_MM on any of the first channels.
+static void split(const MappedCapture& cap, unsigned channels, uint64_t settle_us,
+                  std::vector<Chunk>& chunks) {
+  Chunk first = { 0, 0, UINT64_MAX };
+  chunks.push_back(first);
+  bool quiet = false;
+  uint64_t quiet_us = 0;        // time quiet stretch began
+  for (size_t i = 0; i < cap.records(); ++i) {
+    bool q = true;
+    for (unsigned c = 0; c < channels && q; ++c) {
+      q = cap.range_mm(i, c) >= ARM_MM;
+    }
+    if (q && !quiet) {
+      quiet_us = cap.time_us(i);
+    } else if (!q && quiet) {
+      uint64_t start = (quiet_us + settle_us + ALIGN_USEC - 1) / ALIGN_USEC * ALIGN_USEC;
+      Chunk ch = { start, start + WARMUP_USEC, UINT64_MAX };
+      if (ch.from_us <= cap.time_us(i) && start > chunks.back().from_us) {
+        chunks.back().to_us = ch.from_us;
+        chunks.push_back(ch);
+      }
+    }
+    quiet = q;
+  }
+}
+
+// Replay one chunk, keeping the results from its own part of the capture.
+static void run_chunk(const MappedCapture& cap, const ReplayConfig& config, const Chunk& ch,
+                      ChunkResults& res) {
+  uint64_t duration = (ch.to_us == UINT64_MAX) ? cap.duration_us() - ch.start_us
+                                               : ch.to_us - ch.start_us;
+  CaptureTrace trace(cap, ch.start_us, duration);
+  Replay replay(config);
+  std::vector<PassResult> passes;
+  std::vector<SummaryResult> summaries;
+  replay.run(trace, duration, passes, &summaries);
+  for (size_t i = 0; i < passes.size(); ++i) {
+    PassResult pr = passes[i];
+    pr.t_us += ch.start_us;
+    if (pr.t_us >= ch.from_us && pr.t_us < ch.to_us) {
+      res.passes.push_back(pr);
+    }
+  }
+  for (size_t i = 0; i < summaries.size(); ++i) {
+    SummaryResult sr = summaries[i];
+    sr.t_us += ch.start_us;
+    if (sr.t_us >= ch.from_us && sr.t_us < ch.to_us) {
+      res.summaries.push_back(sr);
+    }
+  }
+  res.sim_us = replay.stats().sim_us;
+  res.done = true;
+}
+
+// Write all of a message to a pipe.
+static bool send(int fd, const Message& msg) {
+  const uint8_t* p = (const uint8_t*) &msg;
+  size_t left = sizeof msg;
+  while (left > 0) {
+    ssize_t n = write(fd, p, left);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    left -= (size_t) n;
+  }
+  return true;
+}
+
+// Body of a worker process: replay chunks, taking the next one not yet
+// taken by any worker, until there are none left.
+static void work(const MappedCapture& cap, const ReplayConfig& config,
+                 const std::vector<Chunk>& chunks, uint32_t* next, int fd) {
+  for (;;) {
+    uint32_t c = __sync_fetch_and_add(next, 1);
+    if (c >= chunks.size()) {
+      break;
+    }
+    ChunkResults res;
+    run_chunk(cap, config, chunks[c], res);
+    Message msg;
+    memset(&msg, 0, sizeof msg);
+    msg.chunk = c;
+    msg.kind = Message::eSpeed;
+    for (size_t i = 0; i < res.passes.size(); ++i) {
+      msg.pass = res.passes[i];
+      send(fd, msg);
+    }
+    msg.kind = Message::eSummary;
+    for (size_t i = 0; i < res.summaries.size(); ++i) {
+      msg.summary = res.summaries[i];
+      send(fd, msg);
+    }
+    msg.kind = Message::eDone;
+    msg.sim_us = res.sim_us;
+    send(fd, msg);
+  }
+}
+
+// Fork workers over the chunks, and gather their results by chunk.
+// Returns false if a worker could not be started or died.
+static bool run_workers(const MappedCapture& cap, const ReplayConfig& config,
+                        const std::vector<Chunk>& chunks, unsigned workers,
+                        std::vector<ChunkResults>& results) {
+  // Index of the next chunk to take, shared by all workers
+  uint32_t* next = (uint32_t*) mmap(NULL, sizeof(uint32_t), PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (next == MAP_FAILED) {
+    return false;
+  }
+  *next = 0;
+  fflush(NULL);
+
+  std::vector<pid_t> pids;
+  std::vector<struct pollfd> fds;
+  for (unsigned w = 0; w < workers; ++w) {
+    int pfd[2];
+    if (pipe(pfd) != 0) {
+      break;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(pfd[0]);
+      for (size_t k = 0; k < fds.size(); ++k) {
+        close(fds[k].fd);
+      }
+      work(cap, config, chunks, next, pfd[1]);
+      close(pfd[1]);
+      _exit(0);
+    }
+    close(pfd[1]);
+    if (pid < 0) {
+      close(pfd[0]);
+      break;
+    }
+    pids.push_back(pid);
+    struct pollfd p = { pfd[0], POLLIN, 0 };
+    fds.push_back(p);
+  }
+
+  // Read whole messages from every worker until all have finished.
+  std::vector<std::vector<uint8_t> > partial(fds.size());
+  size_t open = fds.size();
+  while (open > 0) {
+    if (poll(&fds[0], fds.size(), -1) < 0) {
+      break;
+    }
+    for (size_t k = 0; k < fds.size(); ++k) {
+      if (fds[k].fd < 0 || fds[k].revents == 0) {
+        continue;
+      }
+      uint8_t buf[64 * sizeof(Message)];
+      ssize_t n = read(fds[k].fd, buf, sizeof buf);
+      if (n <= 0) {
+        close(fds[k].fd);
+        fds[k].fd = -1;
+        --open;
+        continue;
+      }
+      std::vector<uint8_t>& part = partial[k];
+      part.insert(part.end(), buf, buf + n);
+      size_t used = 0;
+      for ( ; part.size() - used >= sizeof(Message); used += sizeof(Message)) {
+        Message msg;
+        memcpy(&msg, &part[used], sizeof msg);
+        ChunkResults& res = results[msg.chunk];
+        if (msg.kind == Message::eSpeed) {
+          res.passes.push_back(msg.pass);
+        } else if (msg.kind == Message::eSummary) {
+          res.summaries.push_back(msg.summary);
+        } else {
+          res.sim_us = msg.sim_us;
+          res.done = true;
+        }
+      }
+      part.erase(part.begin(), part.begin() + used);
+    }
+  }
+
+  bool ok = !pids.empty();
+  for (size_t k = 0; k < pids.size(); ++k) {
+    int status;
+    ok = ok && waitpid(pids[k], &status, 0) == pids[k]
+      && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  }
+  munmap(next, sizeof(uint32_t));
+  for (size_t c = 0; c < results.size(); ++c) {
+    ok = ok && results[c].done;
+  }
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+
+  ReplayConfig config;
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned workers = ncpu > 0 ? (unsigned) ncpu : 1;
+  bool whole = false;
+  bool quiet = false;
+  bool print_summaries = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "j:cs:iw:t:k:d:1Sq")) != -1) {
+    switch (opt) {
+      case 'j':
+        workers = (unsigned) atoi(optarg);
+        if (workers == 0) {
+          usage();
+          return 2;
+        }
+        break;
+      case 'c':
+        whole = true;
+        break;
+      case 's':
+        if (strcmp(optarg, "uk") == 0) {
+          config.scale = Speedometer::eUK;
+        } else if (strcmp(optarg, "us") == 0) {
+          config.scale = Speedometer::eUS;
+        } else if (strcmp(optarg, "jp") == 0) {
+          config.scale = Speedometer::eJP;
+        } else {
+          usage();
+          return 2;
+        }
+        break;
+      case 'i':
+        config.metric = false;
+        break;
+      case 'w':
+        config.center = (uint8_t) atoi(optarg);
+        break;
+      case 't':
+        config.tracks = (uint8_t) atoi(optarg);
+        if (config.tracks < 1 || config.tracks > MAX_TRACKS) {
+          usage();
+          return 2;
+        }
+        break;
+      case 'k':
+        config.sensors = (uint8_t) atoi(optarg);
+        if (config.sensors < 2 || config.sensors > MAX_TRACK_SENSORS) {
+          usage();
+          return 2;
+        }
+        break;
+      case 'd':
+        config.spacing = (uint16_t) atoi(optarg);
+        if (config.spacing == 0) {
+          usage();
+          return 2;
+        }
+        break;
+      case '1':
+        config.continuous = false;
+        break;
+      case 'S':
+        print_summaries = true;
+        break;
+      case 'q':
+        quiet = true;
+        break;
+      default:
+        usage();
+        return 2;
+    }
+  }
+  if (optind + 1 != argc) {
+    usage();
+    return 2;
+  }
+  if (config.tracks * config.sensors > MAX_SENSORS
+      || config.spacing * (config.sensors - 1) > MAX_SPAN_MM) {
+    fprintf(stderr, "analyze: more sensors or a longer span than the Speedometer takes\n");
+    return 2;
+  }
+
+  MappedCapture cap;
+  if (!cap.open(argv[optind])) {
+    fprintf(stderr, "analyze: cannot map capture %s\n", argv[optind]);
+    return 1;
+  }
+  unsigned channels = config.tracks * config.sensors;
+  if (cap.channels() < channels) {
+    fprintf(stderr, "analyze: capture has %u channels, %u wanted\n", cap.channels(), channels);
+    return 1;
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::vector<Chunk> chunks;
+  if (whole) {
+    Chunk ch = { 0, 0, UINT64_MAX };
+    chunks.push_back(ch);
+  } else {
+    split(cap, channels, timeout_usec(config) + CLEAR_USEC, chunks);
+  }
+  std::vector<ChunkResults> results(chunks.size());
+  for (size_t c = 0; c < results.size(); ++c) {
+    results[c].sim_us = 0;
+    results[c].done = false;
+  }
+  if (whole) {
+    workers = 1;
+    run_chunk(cap, config, chunks[0], results[0]);
+  } else {
+    if (workers > chunks.size()) {
+      workers = (unsigned) chunks.size();
+    }
+    if (!run_workers(cap, config, chunks, workers, results)) {
+      fprintf(stderr, "analyze: a worker failed\n");
+      return 1;
+    }
+  }
+  std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+
+  // Results in capture order, chunk by chunk.
+  size_t npasses = 0, nsummaries = 0;
+  uint64_t sim_us = 0;
+  if (!quiet) {
+    printf(print_summaries
+           ? "track,time_ms,length_mm,scale_length,cars,occupied_ms,gap_min_ms,gap_mean_ms,gap_max_ms,"
+             "direction,lead,trail,mean,agree\n"
+           : "track,time_ms,speed,fit_speed,accel\n");
+  }
+  for (size_t c = 0; c < results.size(); ++c) {
+    const ChunkResults& res = results[c];
+    npasses += res.passes.size();
+    nsummaries += res.summaries.size();
+    sim_us += res.sim_us;
+    if (quiet) {
+      continue;
+    }
+    if (print_summaries) {
+      for (size_t i = 0; i < res.summaries.size(); ++i) {
+        const SummaryResult& sr = res.summaries[i];
+        const Speedometer::PassSummary& ps = sr.summary;
+        const Speedometer::SpeedResult& sp = sr.result;
+        printf("%u,%.1f,%u,%.1f,%u,%.1f,%.1f,%.1f,%.1f,%d,%.1f,%.1f,%.1f,%d\n", sr.track,
+               sr.t_us * 1e-3, ps.length_mm, ps.length, ps.cars, ps.occupied_usec * 1e-3,
+               ps.gap_min_usec * 1e-3, ps.gap_mean_usec * 1e-3, ps.gap_max_usec * 1e-3,
+               sp.direction, sp.lead / (double) SPEED_FRAC, sp.trail / (double) SPEED_FRAC,
+               sp.mean / (double) SPEED_FRAC, sp.agree ? 1 : 0);
+      }
+    } else {
+      for (size_t i = 0; i < res.passes.size(); ++i) {
+        const PassResult& pr = res.passes[i];
+        printf("%u,%.1f,%.2f,%.2f,%.2f\n", pr.track, pr.t_us * 1e-3, pr.speed,
+               pr.profile.speed, pr.profile.accel);
+      }
+    }
+  }
+
+  double capture_sec = cap.duration_us() * 1e-6;
+  fprintf(stderr, "capture: %zu records, %u channels, %.1f h\n", cap.records(),
+          cap.channels(), capture_sec / 3600.0);
+  fprintf(stderr, "passes: %zu, summaries: %zu\n", npasses, nsummaries);
+  fprintf(stderr, "chunks: %zu on %u worker%s, %.1f s simulated in %.3f s (%.0fx real time)\n",
+          chunks.size(), workers, workers == 1 ? "" : "s", sim_us * 1e-6, wall.count(),
+          wall.count() > 0.0 ? capture_sec / wall.count() : 0.0);
+  return 0;
+
+}
@@ -0,0 +1,290 @@
+// Benchmark suite for the sketch's hot path, with results in JSON so that
+// runs on different commits can be diffed.
+//
+// Micro-benchmarks time Filter<T>::filter, RangeWindow<T>::within,
+// SchmittTrigger<T>::f and the speed calculations over a fixed
+// pseudo-random input; each is run several times and the median kept.
+// Macro-benchmarks replay a synthetic trace through Speedometer::update()
+// in simulated time until the sensors have delivered the requested number
+// of samples.  Every result carries a checksum of what was computed, so
+// a change in behaviour shows up as well as a change in speed.
+//
+// Usage: bench [-n ops] [-s samples] [-r reps] [-l label] [-o out.json]
+//   -n ops      input size of each micro-benchmark (default 10000000)
+//   -s samples  sensor samples per macro-benchmark (default 1000000)
+//   -r reps     runs of each micro-benchmark, median kept (default 5)
+//   -l label    label recorded in the output, such as a commit id
+//   -o file     write JSON to file instead of standard output
+
+#include <Arduino.h>
+
+#include "HostSim.h"
+#include "Replay.h"
+
+#include "Filter.h"
+#include "RangeWindow.h"
+#include "SchmittTrigger.h"
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+static std::vector<uint8_t> s_range;    // ranges (mm), trains and background
+static std::vector<uint32_t> s_dt;      // elapsed times for speeds (usec)
+static unsigned s_reps = 5;
+
+// One line of output
+struct BenchResult {
+  std::string name;
+  const char* unit;       // unit of value
+  double value;           // median time per operation
+  uint64_t ops;           // operations per run
+  uint64_t checksum;      // of results computed, identical between runs
+  std::string extra;      // further JSON members, each preceded by ", "
+};
+
+static std::vector<BenchResult> s_results;
+
+// Time reps runs of body(), which returns a checksum, and record the
+// median nsec per operation.
+template<typename F>
+static void micro(const char* name, uint64_t ops, F body) {
+  std::vector<double> ns;
+  uint64_t checksum = 0;
+  for (unsigned r = 0; r < s_reps; ++r) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    checksum = body();
+    std::chrono::duration<double> dt = std::chrono::steady_clock::now() - start;
+    ns.push_back(dt.count() * 1e9 / (double) ops);
+  }
+  std::sort(ns.begin(), ns.end());
+  BenchResult br = { name, "ns/op", ns[ns.size() / 2], ops, checksum, "" };
+  s_results.push_back(br);
+}
+
+static void bench_filter() {
+  micro("Filter<uint32_t>(10)::filter", s_range.size(), [] {
+    Filter<uint32_t, 16> f(10);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < s_range.size(); ++i) {
+      sum += f.filter(s_range[i]);
+    }
+    return sum;
+  });
+  micro("FixedFilter<uint32_t,10>::filter", s_range.size(), [] {
+    FixedFilter<uint32_t, 10> f;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < s_range.size(); ++i) {
+      sum += f.filter(s_range[i]);
+    }
+    return sum;
+  });
+}
+
+static void bench_window() {
+  // Window of the sketch's near track.
+  micro("SchmittTrigger<uint8_t>::f", s_range.size(), [] {
+    SchmittTrigger<uint8_t> st(21, 7);
+    uint64_t n = 0;
+    for (size_t i = 0; i < s_range.size(); ++i) {
+      n = n * 3 + st.f(s_range[i]);
+    }
+    return n;
+  });
+  micro("RangeWindow<uint8_t>::within(val)", s_range.size(), [] {
+    RangeWindow<uint8_t> win(33, 12, 7);
+    uint64_t n = 0;
+    for (size_t i = 0; i < s_range.size(); ++i) {
+      n = n * 3 + win.within(s_range[i]);
+    }
+    return n;
+  });
+  micro("RangeWindow<uint8_t>::within(val,state)", s_range.size(), [] {
+    RangeWindow<uint8_t> win(33, 12, 7);
+    uint8_t state = 0;
+    uint64_t n = 0;
+    for (size_t i = 0; i < s_range.size(); ++i) {
+      n = n * 3 + win.within(s_range[i], state);
+    }
+    return n;
+  });
+}
+
+static void bench_speed() {
+  sim::reset();
+  Speedometer meter(Speedometer::eUS);
+  meter.setMetric(false);
+  micro("Speedometer::calcScaleSpeed", s_dt.size(), [&] {
+    double sum = 0.0;
+    for (size_t i = 0; i < s_dt.size(); ++i) {
+      sum += meter.calcScaleSpeed(s_dt[i]);
+    }
+    return (uint64_t) sum;
+  });
+  micro("Speedometer::calcScaleSpeedFixed", s_dt.size(), [&] {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < s_dt.size(); ++i) {
+      sum += meter.calcScaleSpeedFixed(s_dt[i]);
+    }
+    return sum;
+  });
+}
+
+// Replay synthetic trains until the sensors have delivered about
+// nsamples samples, once.
+static void bench_replay(const char* name, bool continuous, uint64_t nsamples) {
+  ReplayConfig config;
+  config.scale = Speedometer::eUS;
+  config.metric = false;
+  config.continuous = continuous;
+  // Continuous ranging gives each sensor 100 samples/s, as does
+  // single-shot with one track.
+  uint64_t duration_us = nsamples * 1000000ULL / 200;
+  SyntheticTrace::Params params;
+  params.track_mm = config.center;
+  params.trains = (unsigned) (nsamples / 2000) + 1;
+  SyntheticTrace trace(params);
+  if (trace.duration_us() < duration_us) {
+    duration_us = trace.duration_us();
+  }
+
+  Replay replay(config);
+  std::vector<PassResult> passes;
+  replay.run(trace, duration_us, passes);
+  const ReplayStats& st = replay.stats();
+
+  // Checksum of speeds reported, in hundredths, and error against truth.
+  uint64_t checksum = 0;
+  double sum_err = 0.0;
+  const std::vector<TrainPass>& trains = trace.trains();
+  size_t k = 0;
+  for (size_t i = 0; i < passes.size(); ++i) {
+    checksum = checksum * 31 + (uint64_t) llround(passes[i].speed * 100.0);
+    while (k < trains.size() && trains[k].t_front_us <= passes[i].t_us) {
+      ++k;
+    }
+    if (k > 0) {
+      sum_err += fabs(passes[i].speed - replay.scale_speed(trains[k - 1].speed));
+    }
+  }
+  uint64_t samples = 0;
+  for (unsigned i = 0; i < MAX_SENSORS; ++i) {
+    samples += st.samples[i];
+  }
+  char extra[256];
+  snprintf(extra, sizeof extra,
+           ", \"samples\": %llu, \"loops\": %llu, \"sim_sec\": %.1f, \"wall_sec\": %.3f"
+           ", \"passes\": %zu, \"mean_abs_error\": %.4f",
+           (unsigned long long) samples, (unsigned long long) st.loops,
+           st.sim_us * 1e-6, st.wall_sec, passes.size(),
+           passes.empty() ? 0.0 : sum_err / passes.size());
+  BenchResult br = { name, "ns/sample", samples ? st.wall_sec * 1e9 / samples : 0.0,
+                     samples, checksum, extra };
+  s_results.push_back(br);
+}
+
+// Write a string as a JSON string.
+static void put_string(FILE* f, const std::string& s) {
+  fputc('"', f);
+  for (size_t i = 0; i < s.size(); ++i) {
+    if (s[i] == '"' || s[i] == '\\') {
+      fputc('\\', f);
+    }
+    fputc(s[i], f);
+  }
+  fputc('"', f);
+}
+
+// One result per line, so results diff line by line.
+static void write_json(FILE* f, const std::string& label) {
+  fprintf(f, "{\n  \"suite\": \"TrainSpeedometer\",\n  \"label\": ");
+  put_string(f, label);
+  fprintf(f, ",\n  \"compiler\": ");
+  put_string(f, __VERSION__);
+  fprintf(f, ",\n  \"results\": [\n");
+  for (size_t i = 0; i < s_results.size(); ++i) {
+    const BenchResult& br = s_results[i];
+    fprintf(f, "    {\"name\": ");
+    put_string(f, br.name);
+    fprintf(f, ", \"unit\": \"%s\", \"value\": %.3f, \"ops\": %llu, \"checksum\": \"%016llx\"%s}%s\n",
+            br.unit, br.value, (unsigned long long) br.ops,
+            (unsigned long long) br.checksum, br.extra.c_str(),
+            (i + 1 < s_results.size()) ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+}
+
+static void usage() {
+  fprintf(stderr, "usage: bench [-n ops] [-s samples] [-r reps] [-l label] [-o out.json]\n");
+}
+
+int main(int argc, char* argv[]) {
+
+  size_t nops = 10000000;
+  uint64_t nsamples = 1000000;
+  std::string label;
+  const char* out_path = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:s:r:l:o:")) != -1) {
+    switch (opt) {
+      case 'n':
+        nops = (size_t) atol(optarg);
+        break;
+      case 's':
+        nsamples = (uint64_t) atoll(optarg);
+        break;
+      case 'r':
+        s_reps = (unsigned) atoi(optarg);
+        break;
+      case 'l':
+        label = optarg;
+        break;
+      case 'o':
+        out_path = optarg;
+        break;
+      default:
+        usage();
+        return 2;
+    }
+  }
+  if (nops == 0 || s_reps == 0) {
+    usage();
+    return 2;
+  }
+
+  // Ranges in a VL6180X-like pattern: background with occasional trains,
+  // some on the near track and some on the far one.
+  s_range.resize(nops);
+  s_dt.resize(nops);
+  const double timeout = Speedometer::speedConstant(Speedometer::eUS, false) / SPEED_FRAC;
+  uint32_t x = 12345;
+  for (size_t i = 0; i < nops; ++i) {
+    x = x * 1103515245u + 12345u;
+    unsigned phase = (i / 500) % 8;
+    uint8_t base = (phase == 0) ? 30 : ((phase == 4) ? 64 : 255);
+    s_range[i] = (base == 255) ? 255 : base + (x >> 16) % 9;
+    // Elapsed times for speeds spread evenly in log between 1 and 500.
+    s_dt[i] = (uint32_t) (timeout / exp(log(500.0) * (double) (x >> 8) / 16777216.0));
+  }
+
+  bench_filter();
+  bench_window();
+  bench_speed();
+  bench_replay("Speedometer::update continuous", true, nsamples);
+  bench_replay("Speedometer::update single-shot", false, nsamples);
+
+  FILE* f = stdout;
+  if (out_path != NULL && (f = fopen(out_path, "w")) == NULL) {
+    fprintf(stderr, "bench: cannot create %s\n", out_path);
+    return 1;
+  }
+  write_json(f, label);
+  if (f != stdout) {
+    fclose(f);
+  }
+  return 0;
+
+}
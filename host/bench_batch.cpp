@@ -0,0 +1,160 @@
+// Benchmark of the batch filter and window functions in Batch.h, scalar
+// against SIMD, over one long trace of distances.
+//
+// Before timing, both forms are run over short pseudo-random inputs for
+// every window length and for windows whose levels lie at and beyond the
+// ends of uint32_t, and must agree; then the trace is filtered and the
+// filtered distances tested against both of the sketch's windows, and
+// the outputs of the two forms compared.
+//
+// Usage: bench_batch [-n samples] [-r reps]
+//   -n samples  length of the trace (default 100000000)
+//   -r reps     runs of each form, fastest kept (default 3)
+
+#include <Arduino.h>
+
+#include "Batch.h"
+
+#include <getopt.h>
+
+#include <chrono>
+#include <vector>
+
+// Window of the moving average, as a Sensor's
+#define FILTER_SAMPLES 10
+
+static unsigned s_reps = 3;
+
+// Time reps runs of body(), returning the fastest in nsec per sample.
+template<typename F>
+static double timed(size_t n, F body) {
+  double best = 0.0;
+  for (unsigned r = 0; r < s_reps; ++r) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    body();
+    std::chrono::duration<double> dt = std::chrono::steady_clock::now() - start;
+    double ns = dt.count() * 1e9 / (double) n;
+    if (r == 0 || ns < best) {
+      best = ns;
+    }
+  }
+  return best;
+}
+
+// Run both forms over short inputs, returning false if they ever differ.
+static bool check() {
+  const size_t n = 1000;
+  std::vector<uint32_t> in(n), out_s(n), out_v(n);
+  std::vector<uint64_t> bits_s(batch::bitmap_words(n)), bits_v(batch::bitmap_words(n));
+  uint32_t x = 54321;
+  // Windows: the sketch's, one straddling zero, and one at the top of range.
+  const uint32_t windows[][3] = {
+    { 33, 12, 7 }, { 66, 12, 7 }, { 5, 12, 3 }, { UINT32_MAX - 4, 8, 2 }, { 1000, 0, 0 }
+  };
+  for (unsigned round = 0; round < 4; ++round) {
+    for (size_t i = 0; i < n; ++i) {
+      x = x * 1103515245u + 12345u;
+      // Small ranges, then full 32-bit values.
+      in[i] = (round < 2) ? (x >> 16) % 128 : (x ^ (x << 13));
+    }
+    for (size_t ns = 0; ns <= BATCH_MAX_SAMPLES + 1; ++ns) {
+      // Every length up to n, so that each tail is exercised.
+      size_t len = n - ns * 37 % 64;
+      batch::filter_scalar(&in[0], &out_s[0], len, ns);
+      batch::filter(&in[0], &out_v[0], len, ns);
+      for (size_t i = 0; i < len; ++i) {
+        if (out_s[i] != out_v[i]) {
+          fprintf(stderr, "filter: %zu samples, sample %zu differs\n", ns, i);
+          return false;
+        }
+      }
+    }
+    for (size_t w = 0; w < sizeof windows / sizeof windows[0]; ++w) {
+      RangeWindow<uint32_t> win(windows[w][0], windows[w][1], windows[w][2]);
+      for (uint8_t start = 0; start < 4; ++start) {
+        size_t len = n - 13 * start - round;
+        uint8_t st_s = start, st_v = start;
+        batch::within_scalar(win, &in[0], len, st_s, &bits_s[0]);
+        batch::within(win, &in[0], len, st_v, &bits_v[0]);
+        if (st_s != st_v || bits_s != bits_v) {
+          fprintf(stderr, "within: window %zu, state %u differs\n", w, start);
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+static void usage() {
+  fprintf(stderr, "usage: bench_batch [-n samples] [-r reps]\n");
+}
+
+int main(int argc, char* argv[]) {
+
+  size_t n = 100000000;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+    switch (opt) {
+      case 'n':
+        n = (size_t) atol(optarg);
+        break;
+      case 'r':
+        s_reps = (unsigned) atoi(optarg);
+        break;
+      default:
+        usage();
+        return 2;
+    }
+  }
+  if (n == 0 || s_reps == 0) {
+    usage();
+    return 2;
+  }
+
+  printf("batch: %s\n", batch::simd());
+  bool ok = check();
+  printf("short inputs: %s\n", ok ? "ok" : "MISMATCH");
+
+  // Ranges in a VL6180X-like pattern: background with occasional trains,
+  // some on the near track and some on the far one.
+  std::vector<uint32_t> in(n), out_s(n), out_v(n);
+  uint32_t x = 12345;
+  for (size_t i = 0; i < n; ++i) {
+    x = x * 1103515245u + 12345u;
+    unsigned phase = (i / 500) % 8;
+    uint32_t base = (phase == 0) ? 30 : ((phase == 4) ? 64 : 255);
+    in[i] = (base == 255) ? 255 : base + (x >> 16) % 9;
+  }
+  printf("%zu samples, nsec per sample\n", n);
+  printf("%-24s %10s %10s %9s\n", "", "scalar", batch::simd(), "speedup");
+
+  double t_s = timed(n, [&] { batch::filter_scalar(&in[0], &out_s[0], n, FILTER_SAMPLES); });
+  double t_v = timed(n, [&] { batch::filter(&in[0], &out_v[0], n, FILTER_SAMPLES); });
+  bool same = (out_s == out_v);
+  ok = ok && same;
+  printf("%-24s %10.3f %10.3f %8.1fx %s\n", "filter", t_s, t_v, t_s / t_v,
+         same ? "ok" : "MISMATCH");
+
+  // Windows of the sketch's near and far tracks.
+  const uint32_t windows[2][3] = { { 33, 12, 7 }, { 66, 12, 7 } };
+  std::vector<uint64_t> bits_s(batch::bitmap_words(n)), bits_v(batch::bitmap_words(n));
+  for (unsigned w = 0; w < 2; ++w) {
+    RangeWindow<uint32_t> win(windows[w][0], windows[w][1], windows[w][2]);
+    uint8_t st_s = 0, st_v = 0;
+    t_s = timed(n, [&] { st_s = 0; batch::within_scalar(win, &out_s[0], n, st_s, &bits_s[0]); });
+    t_v = timed(n, [&] { st_v = 0; batch::within(win, &out_v[0], n, st_v, &bits_v[0]); });
+    size_t count = 0;
+    for (size_t k = 0; k < bits_v.size(); ++k) {
+      count += __builtin_popcountll(bits_v[k]);
+    }
+    same = (st_s == st_v && bits_s == bits_v);
+    ok = ok && same;
+    char name[32];
+    snprintf(name, sizeof name, "within(%u,%u,%u)", windows[w][0], windows[w][1], windows[w][2]);
+    printf("%-24s %10.3f %10.3f %8.1fx %s, %zu within\n", name, t_s, t_v, t_s / t_v,
+           same ? "ok" : "MISMATCH", count);
+  }
+  return ok ? 0 : 1;
+
+}
@@ -0,0 +1,93 @@
+// Micro-benchmark of the moving-average filters against the original
+// shift-and-resum implementation, for windows of 4 to 64 samples.
+//
+// Usage: bench_filter [samples]
+
+#include <Arduino.h>
+
+#include "Filter.h"
+
+#include <chrono>
+#include <vector>
+
+// Original Filter<T>::filter(): moves every sample down one slot and
+// re-sums the whole buffer.
+template<typename T>
+class ShiftFilter {
+
+  private:
+    const size_t m_nsamps;
+    T* m_buffer;
+
+  public:
+    ShiftFilter(const size_t nsamps) : m_nsamps(nsamps), m_buffer(new T[nsamps]) {
+      for (size_t i = 0; i < nsamps; ++i) {
+        m_buffer[i] = (T) 0;
+      }
+    }
+    ~ShiftFilter() {
+      delete[] m_buffer;
+    }
+    T filter(const T samp) {
+      T* sptr = m_buffer + 1;
+      T* dptr = m_buffer;
+      size_t n = m_nsamps;
+      T sum = (T) 0;
+      while (n--) {
+        *dptr = (n == 0) ? samp : *sptr++;
+        sum += *dptr++;
+      }
+      return (sum / m_nsamps);
+    }
+
+};
+
+static std::vector<uint32_t> s_input;
+
+// Run filter over the input, returning nsec per sample and a checksum
+// of the outputs.
+template<typename F>
+static double time_filter(F& f, uint64_t& checksum) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  uint64_t sum = 0;
+  for (size_t i = 0; i < s_input.size(); ++i) {
+    sum += f.filter(s_input[i]);
+  }
+  std::chrono::duration<double> dt = std::chrono::steady_clock::now() - start;
+  checksum = sum;
+  return dt.count() * 1e9 / (double) s_input.size();
+}
+
+template<size_t N>
+static void bench() {
+  ShiftFilter<uint32_t> shift(N);
+  Filter<uint32_t, N> ring(N);
+  FixedFilter<uint32_t, N> fixed;
+  uint64_t c_shift, c_ring, c_fixed;
+  double t_shift = time_filter(shift, c_shift);
+  double t_ring = time_filter(ring, c_ring);
+  double t_fixed = time_filter(fixed, c_fixed);
+  printf("%6zu %10.2f %10.2f %10.2f %8.1fx %s\n", N, t_shift, t_ring, t_fixed,
+         t_shift / t_fixed, (c_shift == c_ring && c_ring == c_fixed) ? "ok" : "MISMATCH");
+}
+
+int main(int argc, char* argv[]) {
+  size_t n = (argc > 1) ? (size_t) atol(argv[1]) : 10000000;
+  // Ranges in a VL6180X-like pattern: background with occasional trains.
+  s_input.resize(n);
+  uint32_t x = 12345;
+  for (size_t i = 0; i < n; ++i) {
+    x = x * 1103515245u + 12345u;
+    bool train = ((i / 500) % 4) == 0;
+    s_input[i] = train ? 30 + ((x >> 16) % 7) : 255;
+  }
+  printf("%zu samples, nsec per sample\n", n);
+  printf("%6s %10s %10s %10s %9s\n", "window", "shift", "ring", "fixed", "speedup");
+  bench<4>();
+  bench<8>();
+  bench<10>();
+  bench<16>();
+  bench<32>();
+  bench<64>();
+  return 0;
+}
@@ -0,0 +1,95 @@
+// Micro-benchmark and accuracy check of the fixed-point speed and timeout
+// against the original floating-point calculations, for every scale and
+// choice of units.
+//
+// Usage: bench_speed [samples]
+
+#include <Arduino.h>
+
+#include "HostSim.h"
+#include "Speedometer.h"
+
+#include <chrono>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES "cycles"
+static inline uint64_t ticks() { return __rdtsc(); }
+#else
+#define CYCLES "nsec"
+static inline uint64_t ticks() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+static std::vector<uint32_t> s_dt;
+
+// Run f over every elapsed time, returning cycles (or nsec) per call.
+template<typename F>
+static double time_calls(F f) {
+  volatile double sink = 0.0;
+  uint64_t start = ticks();
+  for (size_t i = 0; i < s_dt.size(); ++i) {
+    sink = sink + f(s_dt[i]);
+  }
+  uint64_t end = ticks();
+  (void) sink;
+  return (double) (end - start) / (double) s_dt.size();
+}
+
+static void bench(Speedometer::E_Scale scale, bool metric) {
+
+  Speedometer meter(scale);
+  meter.setMetric(metric);
+
+  // Elapsed times for speeds spread evenly in log between 1 and 500 units.
+  uint32_t x = 12345;
+  for (size_t i = 0; i < s_dt.size(); ++i) {
+    x = x * 1103515245u + 12345u;
+    double speed = exp(log(500.0) * (double) (x >> 8) / 16777216.0);
+    s_dt[i] = (uint32_t) ((double) meter.getTimeout() / speed);
+  }
+
+  double t_float = time_calls([&](uint32_t dt) { return meter.calcScaleSpeed(dt); });
+  double t_fixed = time_calls([&](uint32_t dt) { return (double) meter.calcScaleSpeedFixed(dt); });
+
+  // Largest and mean difference, and how often the whole number shown
+  // on the display would differ.
+  double max_err = 0.0, sum_err = 0.0;
+  size_t shown = 0;
+  for (size_t i = 0; i < s_dt.size(); ++i) {
+    double f = meter.calcScaleSpeed(s_dt[i]);
+    uint16_t q = meter.calcScaleSpeedFixed(s_dt[i]);
+    double err = fabs(((double) q + 0.5) / SPEED_FRAC - f);
+    sum_err += err;
+    max_err = err > max_err ? err : max_err;
+    shown += ((int) round(f) != (q + SPEED_FRAC / 2) / SPEED_FRAC) ? 1 : 0;
+  }
+
+  double t_timeout_float = time_calls([&](uint32_t) { return meter.calcTimeout(); });
+  double t_timeout_fixed = time_calls([&](uint32_t) { return (double) meter.getTimeout(); });
+  double timeout_err = fabs(meter.calcTimeout() - (double) meter.getTimeout());
+
+  printf("1:%d %-3s %8.1f %8.1f %10.4f %10.4f %8zu %9.1f %9.1f %8.2f\n",
+         (int) scale, metric ? "km" : "mi", t_float, t_fixed,
+         sum_err / s_dt.size(), max_err, shown,
+         t_timeout_float, t_timeout_fixed, timeout_err);
+
+}
+
+int main(int argc, char* argv[]) {
+  size_t n = (argc > 1) ? (size_t) atol(argv[1]) : 10000000;
+  s_dt.resize(n);
+  sim::reset();
+  printf("%zu speeds from 1 to 500 scale units, " CYCLES " per call\n", n);
+  printf("%-9s %8s %8s %10s %10s %8s %9s %9s %8s\n", "scale", "float", "fixed",
+         "mean err", "max err", "shown", "tmo float", "tmo fixed", "tmo err");
+  const Speedometer::E_Scale scales[] = { Speedometer::eUK, Speedometer::eJP, Speedometer::eUS };
+  for (size_t s = 0; s < 3; ++s) {
+    bench(scales[s], false);
+    bench(scales[s], true);
+  }
+  return 0;
+}
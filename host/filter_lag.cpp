@@ -0,0 +1,234 @@
+// Edge lag and outlier rejection of the Sensor filter policies in
+// Filter.h, over one sensor of a synthetic trace.
+//
+// The sensor is sampled every period, as continuous ranging would, and
+// each policy's output is tested against the sketch's near-track window
+// with the crossing time interpolated by an EdgeEstimator, just as a
+// Sensor and the Speedometer do.  For each train:
+//   lead lag   the interpolated time the window was entered, less the
+//              time the noise-free range first crossed the same level
+//   trail lag  the time the window was left for the last time, less the
+//              time the noise-free range last rose past the exit level
+// The spread of the lead lag, not its mean, is what costs speed
+// accuracy, as the same mean lag at both sensors cancels.
+//
+// The run is then repeated with a fraction of the samples replaced by
+// bad readings, half of them "no target" (255) and half random ranges,
+// and the window entries they add to the clean run's, the trains they
+// hide, and the lead lag spread they leave are reported.
+//
+// Usage: filter_lag [-n trains] [-r seed] [-p usec] [-o fraction]
+//   -n trains    number of synthetic trains (default 200)
+//   -r seed      random seed (default 1)
+//   -p usec      sample period (default 10000)
+//   -o fraction  fraction of samples replaced by bad readings (default 0.01)
+
+#include <Arduino.h>
+
+#include "Filter.h"
+#include "RangeWindow.h"
+#include "EdgeEstimator.h"
+#include "RangeTrace.h"
+
+#include <getopt.h>
+
+#include <vector>
+
+// The sketch's near-track window (mm)
+#define CENTER 33
+#define HWIDTH 12
+#define HYSTERESIS 7
+
+// Step of the noise-free trace searched for the true edges (usec)
+#define TRUTH_STEP_USEC 50
+
+// Noise-free edges of one train
+struct Truth {
+  uint64_t start_us;    // train reaches first sensor
+  uint64_t end_us;      // next train reaches first sensor
+  uint64_t lead_us;     // range first at or below the entry level
+  uint64_t trail_us;    // range last at or below the exit level
+};
+
+// One sample as read
+struct Sample {
+  uint64_t t_us;
+  uint32_t range;
+};
+
+// Results of one policy over one run
+struct Result {
+  unsigned entries;     // times the window was entered
+  unsigned missed;      // trains for which it never was
+  double lead_mean;     // lead lag (msec)
+  double lead_sd;
+  double trail_mean;    // trail lag (msec)
+};
+
+static std::vector<Truth> s_truth;
+
+// Find each train's edges from the noise-free trace.
+static void find_truth(const SyntheticTrace::Params& params, const RangeWindow<uint32_t>& win) {
+  SyntheticTrace::Params p = params;
+  p.noise_mm = 0;
+  SyntheticTrace clean(p);
+  const std::vector<TrainPass>& trains = clean.trains();
+  uint32_t entry = win.entry_hi();
+  uint32_t exit = win.trigger_hi().upper();
+  for (size_t k = 0; k < trains.size(); ++k) {
+    Truth tr;
+    tr.start_us = trains[k].t_front_us;
+    tr.end_us = (k + 1 < trains.size()) ? trains[k + 1].t_front_us : clean.duration_us();
+    tr.lead_us = 0;
+    tr.trail_us = 0;
+    for (uint64_t t = tr.start_us; t < tr.end_us; t += TRUTH_STEP_USEC) {
+      uint8_t r = clean.range_mm(0, t);
+      if (r <= entry && tr.lead_us == 0) {
+        tr.lead_us = t;
+      }
+      if (r <= exit) {
+        tr.trail_us = t + TRUTH_STEP_USEC;
+      }
+    }
+    s_truth.push_back(tr);
+  }
+}
+
+// Sample the noisy trace every period_us, replacing the given fraction
+// of samples with bad readings.
+static std::vector<Sample> sample(SyntheticTrace& trace, uint32_t period_us, double outliers,
+                                  uint32_t seed) {
+  std::vector<Sample> out;
+  uint32_t x = seed * 2654435761u + 1;
+  for (uint64_t t = period_us / 3; t < trace.duration_us(); t += period_us) {
+    Sample s = { t, trace.range_mm(0, t) };
+    x = x * 1103515245u + 12345u;
+    if ((x >> 8) % 1000000 < (uint32_t) (outliers * 1000000.0)) {
+      x = x * 1103515245u + 12345u;
+      s.range = ((x >> 16) & 1) ? NO_TARGET_MM : (x >> 17) % NO_TARGET_MM;
+    }
+    out.push_back(s);
+  }
+  return out;
+}
+
+// Run the samples through filter policy F and the window.
+template<class F>
+static Result run(const std::vector<Sample>& samples, const RangeWindow<uint32_t>& win) {
+  F filter;
+  EdgeEstimator<uint32_t> edge;
+  uint8_t state = 0;
+  bool in = false;
+  size_t k = 0;                 // train whose interval holds the sample
+  std::vector<uint64_t> lead(s_truth.size(), 0), trail(s_truth.size(), 0);
+  Result res = { 0, 0, 0.0, 0.0, 0.0 };
+  for (size_t i = 0; i < samples.size(); ++i) {
+    const Sample& s = samples[i];
+    if (i == 0) {
+      filter.fill(s.range);
+    }
+    uint32_t d = filter.filter(s.range);
+    edge.add(d, (uint32_t) s.t_us);
+    bool now = win.within(d, state);
+    while (k + 1 < s_truth.size() && s.t_us >= s_truth[k + 1].start_us) {
+      ++k;
+    }
+    if (now && !in) {
+      ++res.entries;
+      if (s.t_us >= s_truth[k].start_us && lead[k] == 0) {
+        // Times are kept in 32 bits, as on the board.
+        uint32_t back = (uint32_t) s.t_us - edge.crossing(win.entry_lo(), win.entry_hi());
+        lead[k] = s.t_us - back;
+      }
+    } else if (!now && in && s.t_us >= s_truth[k].start_us) {
+      trail[k] = s.t_us;
+    }
+    in = now;
+  }
+  double sum = 0.0, sum2 = 0.0, tsum = 0.0;
+  unsigned n = 0;
+  for (size_t j = 0; j < s_truth.size(); ++j) {
+    if (lead[j] == 0 || trail[j] == 0) {
+      ++res.missed;
+      continue;
+    }
+    double lag = ((double) lead[j] - (double) s_truth[j].lead_us) * 1e-3;
+    sum += lag;
+    sum2 += lag * lag;
+    tsum += ((double) trail[j] - (double) s_truth[j].trail_us) * 1e-3;
+    ++n;
+  }
+  if (n > 0) {
+    res.lead_mean = sum / n;
+    res.lead_sd = sqrt(std::max(0.0, sum2 / n - res.lead_mean * res.lead_mean));
+    res.trail_mean = tsum / n;
+  }
+  return res;
+}
+
+// Run policy F over the clean and bad samples and print a line.
+template<class F>
+static void report(const char* name, const std::vector<Sample>& clean,
+                   const std::vector<Sample>& bad, const RangeWindow<uint32_t>& win) {
+  Result c = run<F>(clean, win);
+  Result b = run<F>(bad, win);
+  printf("%-14s %6zu %8.1f %7.1f %8.1f %9d %7u %7.1f\n", name, sizeof (F), c.lead_mean,
+         c.lead_sd, c.trail_mean, (int) b.entries - (int) c.entries, b.missed, b.lead_sd);
+}
+
+static void usage() {
+  fprintf(stderr, "usage: filter_lag [-n trains] [-r seed] [-p usec] [-o fraction]\n");
+}
+
+int main(int argc, char* argv[]) {
+
+  SyntheticTrace::Params params;
+  params.trains = 200;
+  uint32_t period_us = 10000;
+  double outliers = 0.01;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:r:p:o:")) != -1) {
+    switch (opt) {
+      case 'n':
+        params.trains = (unsigned) atoi(optarg);
+        break;
+      case 'r':
+        params.seed = (uint32_t) atoi(optarg);
+        break;
+      case 'p':
+        period_us = (uint32_t) atoi(optarg);
+        break;
+      case 'o':
+        outliers = atof(optarg);
+        break;
+      default:
+        usage();
+        return 2;
+    }
+  }
+  if (params.trains == 0 || period_us == 0 || outliers < 0.0 || outliers > 1.0) {
+    usage();
+    return 2;
+  }
+
+  RangeWindow<uint32_t> win(CENTER, HWIDTH, HYSTERESIS);
+  find_truth(params, win);
+  SyntheticTrace trace(params);
+  std::vector<Sample> clean = sample(trace, period_us, 0.0, params.seed);
+  std::vector<Sample> bad = sample(trace, period_us, outliers, params.seed);
+
+  printf("%u trains, %.1f msec sample period, %.1f%% bad readings; lags in msec\n",
+         params.trains, period_us * 1e-3, outliers * 100.0);
+  printf("%-14s %6s %8s %7s %8s %9s %7s %7s\n", "", "", "clean", "", "", "bad", "", "");
+  printf("%-14s %6s %8s %7s %8s %9s %7s %7s\n", "policy", "bytes", "lead", "sd",
+         "trail", "+entries", "missed", "sd");
+  report<FixedFilter<uint32_t, 10> >("mean 10", clean, bad, win);
+  report<FixedFilter<uint32_t, 4> >("mean 4", clean, bad, win);
+  report<EmaFilter<uint32_t, 2> >("ema 1/4", clean, bad, win);
+  report<EmaFilter<uint32_t, 3> >("ema 1/8", clean, bad, win);
+  report<MedianFilter<uint32_t, 3> >("median 3", clean, bad, win);
+  report<MedianFilter<uint32_t, 5> >("median 5", clean, bad, win);
+  report<MedianFilter<uint32_t, 9> >("median 9", clean, bad, win);
+  return 0;
+
+}
@@ -0,0 +1,8 @@
+#ifndef _NEW__H_
+#define _NEW__H_
+
+// Host stand-in for the Arduino core's new.h, for placement new.
+
+#include <new>
+
+#endif
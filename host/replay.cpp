@@ -0,0 +1,491 @@
+// Replay recorded or synthetic range traces through the sketch's
+// Speedometer, faster than real time, and report every measured speed.
+//
+// Usage: replay [options] [trace.txt]
+//   -n trains   number of synthetic trains (default 100, used if no trace file)
+//   -r seed     random seed for synthetic trains (default 1)
+//   -s scale    uk, jp or us (default jp)
+//   -i          imperial units (mi/hr) instead of metric (km/hr)
+//   -w center   RangeWindow center (mm, default 33)
+//   -l usec     simulated time taken by each loop() pass (default 100)
+//   -j usec     stall each loop() pass by a random time up to usec
+//   -t tracks   number of tracks (default 1)
+//   -k sensors  sensors along each track, 2 to 4 (default 2)
+//   -d mm       spacing of neighbouring sensors (default 127)
+//   -a accel    largest synthetic train acceleration either way
+//               (mm/sec^2, default 0)
+//   -g sec      quiet time between synthetic trains (default 5)
+//   -N mm       give each synthetic train a sloping nose mm long
+//   -1          trigger single-shot measurements from the 5 msec tick
+//               instead of continuous ranging
+//   -p policy   single-shot sampling policy: tick (default), fast or
+//               adaptive; implies -1
+//   -I msec     idle sampling period of the adaptive policy (default 20)
+//   -b          block in the driver's Wire calls instead of queueing
+//               I2C transfers
+//   -T file     capture the binary telemetry stream in file (needs a
+//               build with -DTELEMETRY=1; decode it with telemetry_csv)
+//   -D          show each speed on a simulated HT16K33 display, as the
+//               sketch does, and report the display's bus traffic
+//   -C center   start the Speedometer's window at center (mm) instead of
+//               the track's distance, and calibrate it from the passing
+//               trains (Calibrator.h), saving the result to EEPROM
+//   -L          log every speed in simulated EEPROM (PassLog.h), then
+//               power-cycle and check the log reads back
+//   -F sec      make a sensor fail every sec seconds, each in turn, first
+//               by hanging and then by going quiet on the bus, and report
+//               how each recovered
+//   -G          with -F, make every sensor fail at once, as a glitch on
+//               the shared bus would
+//   -M usec[:usec]
+//               model each sensor's return signal: a target at 50 mm
+//               takes usec to converge, growing with the square of its
+//               range, and nothing in range the max convergence time;
+//               the second value, if given, from halfway through the run
+//   -V          tune each sensor's max convergence time to the trains
+//               (ConvergenceTuner.h), and report the times found
+//   -X          refine each speed by matching the first and last sensors'
+//               whole range profiles (Correlator.h), and report the
+//               errors of the edge and matched speeds
+//   -W file     write the trace to file as a binary capture (Capture.h),
+//               sampled every msec, instead of replaying it
+//   -S          print pass summaries (length, cars, gaps) instead of speeds
+//   -P          print the Speedometer's hot-path counters (Profile.h)
+//               after the run
+//   -q          quiet: print only the summary
+
+#include "Replay.h"
+#include "Capture.h"
+
+#include <getopt.h>
+
+#include <string.h>
+
+#include <algorithm>
+
+static void usage() {
+  fprintf(stderr, "usage: replay [-n trains] [-r seed] [-s uk|jp|us] [-i] [-w center] [-l usec] [-j usec] [-t tracks] [-k sensors] [-d mm] [-a accel] [-g sec] [-1] [-p tick|fast|adaptive] [-I msec] [-b] [-T file] [-D] [-C center] [-L] [-F sec] [-G] [-M usec[:usec]] [-V] [-X] [-N mm] [-W file] [-S] [-P] [-q] [trace.txt]\n");
+}
+
+int main(int argc, char* argv[]) {
+
+  ReplayConfig config;
+  SyntheticTrace::Params params;
+  bool quiet = false;
+  bool dump_profile = false;
+  int cal_center = 0;
+  bool print_summaries = false;
+  const char* capture_path = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:r:s:iw:l:j:t:k:d:a:g:1p:I:bT:DC:LF:GM:VXN:W:SPq")) != -1) {
+    switch (opt) {
+      case 'n':
+        params.trains = (unsigned) atoi(optarg);
+        break;
+      case 'r':
+        params.seed = (uint32_t) atoi(optarg);
+        break;
+      case 's':
+        if (strcmp(optarg, "uk") == 0) {
+          config.scale = Speedometer::eUK;
+        } else if (strcmp(optarg, "us") == 0) {
+          config.scale = Speedometer::eUS;
+        } else if (strcmp(optarg, "jp") == 0) {
+          config.scale = Speedometer::eJP;
+        } else {
+          usage();
+          return 2;
+        }
+        break;
+      case 'i':
+        config.metric = false;
+        break;
+      case 'w':
+        config.center = (uint8_t) atoi(optarg);
+        break;
+      case 'l':
+        config.loop_usec = (uint32_t) atoi(optarg);
+        break;
+      case 'j':
+        config.loop_jitter_usec = (uint32_t) atoi(optarg);
+        break;
+      case 't':
+        config.tracks = (uint8_t) atoi(optarg);
+        if (config.tracks < 1 || config.tracks > MAX_TRACKS) {
+          usage();
+          return 2;
+        }
+        break;
+      case 'k':
+        config.sensors = (uint8_t) atoi(optarg);
+        if (config.sensors < 2 || config.sensors > MAX_TRACK_SENSORS) {
+          usage();
+          return 2;
+        }
+        break;
+      case 'd':
+        config.spacing = (uint16_t) atoi(optarg);
+        if (config.spacing == 0) {
+          usage();
+          return 2;
+        }
+        break;
+      case 'a':
+        params.max_accel = atof(optarg);
+        break;
+      case 'g':
+        params.headway = atof(optarg);
+        break;
+      case '1':
+        config.continuous = false;
+        break;
+      case 'p':
+        config.continuous = false;
+        if (strcmp(optarg, "tick") == 0) {
+          config.sampling = Speedometer::eTicked;
+        } else if (strcmp(optarg, "fast") == 0) {
+          config.sampling = Speedometer::eFastest;
+        } else if (strcmp(optarg, "adaptive") == 0) {
+          config.sampling = Speedometer::eAdaptive;
+        } else {
+          usage();
+          return 2;
+        }
+        break;
+      case 'I':
+        config.idle_msec = (uint16_t) atoi(optarg);
+        break;
+      case 'b':
+        config.async_i2c = false;
+        break;
+      case 'T':
+#if TELEMETRY
+        config.telemetry_out = fopen(optarg, "wb");
+        if (config.telemetry_out == NULL) {
+          fprintf(stderr, "replay: cannot create %s\n", optarg);
+          return 1;
+        }
+#else
+        fprintf(stderr, "replay: built without -DTELEMETRY=1\n");
+        return 2;
+#endif
+        break;
+      case 'D':
+        config.display = true;
+        break;
+      case 'C':
+        config.calibrate = true;
+        cal_center = atoi(optarg);
+        break;
+      case 'L':
+        config.pass_log = true;
+        break;
+      case 'F':
+        config.fault_usec = (uint32_t) (atof(optarg) * 1e6);
+        break;
+      case 'G':
+        config.fault_all = true;
+        break;
+      case 'M': {
+        const char* colon = strchr(optarg, ':');
+        config.conv_usec = (uint32_t) atoi(optarg);
+        config.conv2_usec = colon ? (uint32_t) atoi(colon + 1) : 0;
+        if (config.conv_usec == 0) {
+          usage();
+          return 2;
+        }
+        break;
+      }
+      case 'V':
+        config.tune = true;
+        break;
+      case 'X':
+        config.correlate = true;
+        break;
+      case 'N':
+        params.nose = atof(optarg);
+        break;
+      case 'W':
+        capture_path = optarg;
+        break;
+      case 'S':
+        print_summaries = true;
+        break;
+      case 'P':
+        dump_profile = true;
+        break;
+      case 'q':
+        quiet = true;
+        break;
+      default:
+        usage();
+        return 2;
+    }
+  }
+
+  if (config.tracks * config.sensors > MAX_SENSORS
+      || config.spacing * (config.sensors - 1) > MAX_SPAN_MM) {
+    fprintf(stderr, "replay: more sensors or a longer span than the Speedometer takes\n");
+    return 2;
+  }
+
+  RecordedTrace recorded;
+  MultiTrackTrace* synthetic = NULL;
+  RangeSource* src;
+  if (optind < argc) {
+    if (!recorded.load(argv[optind])) {
+      fprintf(stderr, "replay: cannot load trace %s\n", argv[optind]);
+      return 1;
+    }
+    src = &recorded;
+  } else {
+    params.track_mm = config.center;
+    params.sensors = config.sensors;
+    params.spacing = config.spacing;
+    synthetic = new MultiTrackTrace(params, config.tracks);
+    src = synthetic;
+  }
+  if (config.calibrate) {
+    config.center = (uint8_t) cal_center;
+  }
+
+  if (capture_path != NULL) {
+    unsigned channels = config.tracks * config.sensors;
+    if (!write_capture(capture_path, *src, channels)) {
+      fprintf(stderr, "replay: cannot write capture %s\n", capture_path);
+      return 1;
+    }
+    fprintf(stderr, "capture: %u channels, %.1f s\n", channels, src->duration_us() * 1e-6);
+    delete synthetic;
+    return 0;
+  }
+
+  Replay replay(config);
+  std::vector<PassResult> passes;
+  std::vector<SummaryResult> summaries;
+  replay.run(*src, src->duration_us(), passes, &summaries);
+
+  // Match each reported speed to the train that produced it.
+  unsigned matched = 0, spurious = 0, fitted = 0;
+  double sum_err = 0.0, max_err = 0.0;
+  double sum_fit_err = 0.0, sum_accel_err = 0.0;
+  unsigned correlated = 0;
+  double sum_edge_err = 0.0, max_edge_err = 0.0;
+  bool print_passes = !quiet && !print_summaries;
+  if (print_passes) {
+    printf(synthetic ? "track,time_ms,speed,true_speed,error,fit_speed,accel,true_accel\n"
+           : "track,time_ms,speed,fit_speed,accel\n");
+  }
+  for (size_t i = 0; i < passes.size(); ++i) {
+    const PassResult& pr = passes[i];
+    if (synthetic == NULL) {
+      if (print_passes) {
+        printf("%u,%.1f,%.2f,%.2f,%.2f\n", pr.track, pr.t_us * 1e-3, pr.speed,
+               pr.profile.speed, pr.profile.accel);
+      }
+      continue;
+    }
+    const std::vector<TrainPass>& trains = synthetic->track(pr.track).trains();
+    size_t k = 0;
+    while (k < trains.size() && trains[k].t_front_us <= pr.t_us) {
+      ++k;
+    }
+    if (k == 0) {
+      ++spurious;
+      continue;
+    }
+    double truth = replay.scale_speed(trains[k - 1].speed);
+    double true_accel = replay.scale_speed(trains[k - 1].accel);
+    double err = pr.speed - truth;
+    ++matched;
+    sum_err += fabs(err);
+    max_err = std::max(max_err, fabs(err));
+    double edge_err = fabs(((double) pr.profile.edge_speed + 0.5) / SPEED_FRAC - truth);
+    sum_edge_err += edge_err;
+    max_edge_err = std::max(max_edge_err, edge_err);
+    correlated += (pr.profile.xc_speed != 0);
+    if (pr.profile.crossings >= 3) {
+      ++fitted;
+      sum_fit_err += fabs(pr.profile.speed - truth);
+      sum_accel_err += fabs(pr.profile.accel - true_accel);
+    }
+    if (print_passes) {
+      printf("%u,%.1f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n", pr.track, pr.t_us * 1e-3, pr.speed,
+             truth, err, pr.profile.speed, pr.profile.accel, true_accel);
+    }
+  }
+
+  // Match each pass summary to its train likewise.
+  unsigned summed = 0, cars_right = 0;
+  double sum_len_err = 0.0;
+  unsigned trailed = 0, agreed = 0, dir_right = 0;
+  double sum_trail_err = 0.0, sum_mean_err = 0.0, sum_agreed_err = 0.0;
+  if (print_summaries) {
+    printf(synthetic ? "track,time_ms,length_mm,true_length_mm,scale_length,cars,true_cars,"
+           "occupied_ms,gap_min_ms,gap_mean_ms,gap_max_ms,direction,lead,trail,mean,agree,true_speed\n"
+           : "track,time_ms,length_mm,scale_length,cars,occupied_ms,gap_min_ms,gap_mean_ms,gap_max_ms,"
+           "direction,lead,trail,mean,agree\n");
+  }
+  for (size_t i = 0; i < summaries.size(); ++i) {
+    const SummaryResult& sr = summaries[i];
+    const Speedometer::PassSummary& ps = sr.summary;
+    const TrainPass* tp = NULL;
+    if (synthetic != NULL) {
+      const std::vector<TrainPass>& trains = synthetic->track(sr.track).trains();
+      size_t k = 0;
+      while (k < trains.size() && trains[k].t_front_us <= sr.t_us) {
+        ++k;
+      }
+      if (k > 0) {
+        tp = &trains[k - 1];
+        ++summed;
+        sum_len_err += fabs(ps.length_mm - tp->length);
+        cars_right += (ps.cars == tp->cars);
+        const Speedometer::SpeedResult& res = sr.result;
+        double truth = replay.scale_speed(tp->speed);
+        dir_right += (res.direction == tp->direction);
+        if (res.trail != 0) {
+          ++trailed;
+          sum_trail_err += fabs((res.trail + 0.5) / SPEED_FRAC - truth);
+          sum_mean_err += fabs((res.mean + 0.5) / SPEED_FRAC - truth);
+          if (res.agree) {
+            ++agreed;
+            sum_agreed_err += fabs((res.mean + 0.5) / SPEED_FRAC - truth);
+          }
+        }
+      }
+    }
+    if (print_summaries) {
+      printf("%u,%.1f,%u,", sr.track, sr.t_us * 1e-3, ps.length_mm);
+      if (synthetic != NULL) {
+        printf("%.0f,", tp ? tp->length : 0.0);
+      }
+      printf("%.1f,%u,", ps.length, ps.cars);
+      if (synthetic != NULL) {
+        printf("%u,", tp ? tp->cars : 0);
+      }
+      printf("%.1f,%.1f,%.1f,%.1f,", ps.occupied_usec * 1e-3, ps.gap_min_usec * 1e-3,
+             ps.gap_mean_usec * 1e-3, ps.gap_max_usec * 1e-3);
+      const Speedometer::SpeedResult& res = sr.result;
+      printf("%d,%.1f,%.1f,%.1f,%d", res.direction, res.lead / (double) SPEED_FRAC,
+             res.trail / (double) SPEED_FRAC, res.mean / (double) SPEED_FRAC, res.agree ? 1 : 0);
+      if (synthetic != NULL) {
+        printf(",%.2f", tp ? replay.scale_speed(tp->speed) : 0.0);
+      }
+      printf("\n");
+    }
+  }
+
+  const ReplayStats& st = replay.stats();
+  double sim_sec = st.sim_us * 1e-6;
+  fprintf(stderr, "passes: %zu", passes.size());
+  if (synthetic) {
+    size_t trains = 0;
+    for (unsigned t = 0; t < synthetic->tracks(); ++t) {
+      trains += synthetic->track(t).trains().size();
+    }
+    fprintf(stderr, " of %zu trains, spurious %u, mean |error| %.2f, max |error| %.2f",
+            trains, spurious, matched ? sum_err / matched : 0.0, max_err);
+    if (fitted > 0) {
+      fprintf(stderr, "\nfitted: %u passes, mean |speed error| %.2f, mean |accel error| %.2f per sec",
+              fitted, sum_fit_err / fitted, sum_accel_err / fitted);
+    }
+    if (config.correlate && matched > 0) {
+      fprintf(stderr, "\nmatched: %u of %u passes, edge speeds mean |error| %.2f, "
+              "max |error| %.2f", correlated, matched, sum_edge_err / matched, max_edge_err);
+    }
+    if (summed > 0) {
+      fprintf(stderr, "\nsummaries: %u, mean |length error| %.1f mm, car count right %.1f%%, "
+              "direction right %.1f%%", summed, sum_len_err / summed, 100.0 * cars_right / summed,
+              100.0 * dir_right / summed);
+    }
+    if (trailed > 0) {
+      fprintf(stderr, "\ntrailing edges: %u passes, mean |error| %.2f; mean of both %.2f; "
+              "%u agree, mean |error| %.2f", trailed, sum_trail_err / trailed,
+              sum_mean_err / trailed, agreed, agreed ? sum_agreed_err / agreed : 0.0);
+    }
+  }
+  fprintf(stderr, "\nsimulated %.1f s in %.3f s (%.0fx real time)\n",
+          sim_sec, st.wall_sec, st.wall_sec > 0.0 ? sim_sec / st.wall_sec : 0.0);
+  fprintf(stderr, "ticks: %llu, %.0f ticks/s; loops: %llu\n",
+          (unsigned long long) st.ticks, st.wall_sec > 0.0 ? st.ticks / st.wall_sec : 0.0,
+          (unsigned long long) st.loops);
+  fprintf(stderr, "update(): mean %.1f usec, max %u usec; I2C bus %.1f%% busy",
+          st.loops ? (double) st.update_usec / st.loops : 0.0, st.update_max_usec,
+          st.sim_us ? 100.0 * st.bus_usec / st.sim_us : 0.0);
+  if (config.async_i2c) {
+    fprintf(stderr, ", %u transfers, %u failed, queue depth max %u",
+            st.transfers, st.failed, st.queue_max);
+  }
+  fprintf(stderr, "\n");
+  if (config.telemetry_out != NULL) {
+    fprintf(stderr, "telemetry: %ld bytes, %u records dropped\n",
+            ftell(config.telemetry_out), st.telemetry_dropped);
+    fclose(config.telemetry_out);
+  }
+  if (config.display) {
+    fprintf(stderr, "display: %u speeds shown, %u writes, %u RAM bytes (%.1f per speed), "
+            "last \"%s\" %s\n", st.display_shown, st.display_writes, st.display_bytes,
+            st.display_shown ? (double) st.display_bytes / st.display_shown : 0.0,
+            st.display_text, st.display_ok ? "shown" : "NOT shown");
+  }
+  if (config.calibrate) {
+    if (st.cal_found) {
+      fprintf(stderr, "calibration: after %.1f s and %u passes, %u window%s, nearest center %u "
+              "hwidth %u hysteresis %u, %s\n", st.cal_us * 1e-6, st.cal_passes, st.cal_windows,
+              st.cal_windows == 1 ? "" : "s", st.cal_window.center, st.cal_window.hwidth,
+              st.cal_window.hysteresis, st.cal_saved ? "saved" : "NOT saved");
+    } else {
+      fprintf(stderr, "calibration: no window found\n");
+    }
+  }
+  if (config.pass_log) {
+    fprintf(stderr, "pass log: %u passes queued, %u lost, %u of %u records read back after "
+            "power cycle, %s; most writes to a cell %u\n", st.log_added, st.log_lost,
+            st.log_records, (unsigned) LOG_RECORDS, st.log_ok ? "match" : "DO NOT match",
+            st.log_wear);
+  }
+  if (config.fault_usec != 0) {
+    fprintf(stderr, "faults: %u injected, %u sensors given another's address\n",
+            st.injected, st.collisions);
+    for (unsigned i = 0; i < config.tracks * config.sensors; ++i) {
+      const SensorHealth& h = st.health[i];
+      fprintf(stderr, "sensor %u: %u faults (%u reads failed, %u timeouts), %u resets, "
+              "%u failed; %u recovered, mean %.1f msec, max %.1f msec; down %.2f%%\n", i,
+              h.faults, h.failures, h.timeouts, h.resets, h.failed_resets, h.recoveries,
+              h.recoveries ? h.down_usec * 1e-3 / h.recoveries : 0.0, h.recover_max_usec * 1e-3,
+              h.down_usec * 100.0 / st.sim_us);
+    }
+  }
+  if (config.tune) {
+    for (unsigned i = 0; i < config.tracks * config.sensors; ++i) {
+      fprintf(stderr, "sensor %u: max convergence %u msec, tuned %u times, %u targets lost\n",
+              i, st.conv_msec[i], st.conv_tunes[i], st.conv_lost[i]);
+    }
+  }
+  for (unsigned t = 0; t < config.tracks; ++t) {
+    // Samples the sensors measured, and those read and taken by the
+    // Speedometer; the difference was dropped, most often as stale.
+    fprintf(stderr, "track %u:", t);
+    for (unsigned j = 0; j < config.sensors; ++j) {
+      fprintf(stderr, "%s %.1f", j ? " +" : "", st.health[t * config.sensors + j].samples / sim_sec);
+    }
+    fprintf(stderr, " samples/s taken of");
+    for (unsigned j = 0; j < config.sensors; ++j) {
+      fprintf(stderr, "%s %.1f", j ? " +" : "", st.samples[t * config.sensors + j] / sim_sec);
+    }
+    fprintf(stderr, " measured\n");
+  }
+
+  if (dump_profile) {
+#if PROFILE
+    profile.dump();
+#else
+    fprintf(stderr, "replay: built with PROFILE 0\n");
+#endif
+  }
+
+  delete synthetic;
+  return 0;
+
+}
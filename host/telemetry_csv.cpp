@@ -0,0 +1,89 @@
+// Decode a capture of the Speedometer's binary telemetry stream (see
+// Telemetry.h) into CSV, one line per record.
+//
+// Usage: telemetry_csv [capture.bin]
+//   Reads standard input if no file is given.  Bytes which do not start
+//   a valid record (text printed before the stream began, or what is
+//   left of a damaged record) are skipped and counted.
+
+#include "Telemetry.h"
+#include "Speedometer.h"
+
+#include <vector>
+
+// Names of Speedometer states, in E_State order
+static const char* const STATES[] = {
+  "clear", "senseA", "senseB", "updated", "active", "clearing"
+};
+
+// Names of record kinds, in TelemetryRecord::E_Kind order
+static const char* const KINDS[] = { "sample", "state", "dropped" };
+
+// True if the record starting at p is intact.
+static bool valid(const uint8_t* p) {
+  if (p[0] != TELEMETRY_SYNC) {
+    return false;
+  }
+  uint8_t x = 0;
+  for (size_t i = 0; i < sizeof(TelemetryRecord); ++i) {
+    x ^= p[i];
+  }
+  const TelemetryRecord* rec = (const TelemetryRecord*) p;
+  return x == 0
+    && (rec->info & TELEMETRY_KIND_MASK) <= TelemetryRecord::eDropped
+    && rec->state < sizeof STATES / sizeof STATES[0];
+}
+
+int main(int argc, char* argv[]) {
+
+  FILE* in = stdin;
+  if (argc > 2) {
+    fprintf(stderr, "usage: telemetry_csv [capture.bin]\n");
+    return 2;
+  }
+  if (argc == 2 && (in = fopen(argv[1], "rb")) == NULL) {
+    fprintf(stderr, "telemetry_csv: cannot open %s\n", argv[1]);
+    return 1;
+  }
+  std::vector<uint8_t> buf;
+  uint8_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof chunk, in)) > 0) {
+    buf.insert(buf.end(), chunk, chunk + n);
+  }
+  if (in != stdin) {
+    fclose(in);
+  }
+
+  printf("t_usec,track,kind,state,detA,detB,freshA,freshB,distA,distB,speed,aux\n");
+  unsigned long records = 0, skipped = 0, dropped = 0;
+  size_t i = 0;
+  while (i + sizeof(TelemetryRecord) <= buf.size()) {
+    if (!valid(&buf[i])) {
+      ++i;
+      ++skipped;
+      continue;
+    }
+    TelemetryRecord rec;
+    memcpy(&rec, &buf[i], sizeof rec);
+    i += sizeof rec;
+    ++records;
+    uint8_t kind = rec.info & TELEMETRY_KIND_MASK;
+    if (kind == TelemetryRecord::eDropped) {
+      dropped += rec.aux;
+    }
+    printf("%lu,%u,%s,%s,%d,%d,%d,%d,%u,%u,%.1f,%lu\n",
+           (unsigned long) rec.t_usec,
+           (rec.info >> TELEMETRY_TRACK_SHIFT) & (MAX_TRACKS - 1),
+           KINDS[kind], STATES[rec.state],
+           (rec.info & TELEMETRY_DET_A) != 0, (rec.info & TELEMETRY_DET_B) != 0,
+           (rec.info & TELEMETRY_FRESH_A) != 0, (rec.info & TELEMETRY_FRESH_B) != 0,
+           rec.distA, rec.distB, (double) rec.speed / SPEED_FRAC,
+           (unsigned long) rec.aux);
+  }
+  skipped += buf.size() - i;
+  fprintf(stderr, "%lu records, %lu bytes skipped, %lu records reported dropped\n",
+          records, skipped, dropped);
+  return 0;
+
+}
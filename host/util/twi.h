@@ -0,0 +1,59 @@
+#ifndef _UTIL_TWI__H_
+#define _UTIL_TWI__H_
+
+// Host stand-in for avr-libc's <util/twi.h>, plus the ATmega's two-wire
+// interface (TWI) registers, which the AVR build gets from <avr/io.h>.
+//
+// The registers belong to a fake TWI peripheral (FakeTWI.h): writing TWCR
+// starts a bus operation which completes in simulated time, at the bit
+// rate set by TWBR, and then sets TWINT and a status code in TWSR just as
+// the hardware does.  Reading TWCR while an operation is under way takes
+// a microsecond of simulated time, so code spinning on it makes progress.
+
+#include <Arduino.h>
+
+// TWCR bits
+#define TWIE  0
+#define TWEN  2
+#define TWWC  3
+#define TWSTO 4
+#define TWSTA 5
+#define TWEA  6
+#define TWINT 7
+
+// Status codes, as TW_STATUS
+#define TW_START            0x08
+#define TW_REP_START        0x10
+#define TW_MT_SLA_ACK       0x18
+#define TW_MT_SLA_NACK      0x20
+#define TW_MT_DATA_ACK      0x28
+#define TW_MT_DATA_NACK     0x30
+#define TW_MT_ARB_LOST      0x38
+#define TW_MR_SLA_ACK       0x40
+#define TW_MR_SLA_NACK      0x48
+#define TW_MR_DATA_ACK      0x50
+#define TW_MR_DATA_NACK     0x58
+#define TW_NO_INFO          0xF8
+#define TW_BUS_ERROR        0x00
+
+#define TW_STATUS_MASK      0xF8
+#define TW_STATUS           (TWSR & TW_STATUS_MASK)
+
+#define TW_READ             1
+#define TW_WRITE            0
+
+// Control register: writing it with TWINT set starts the next operation.
+class TwiControl {
+
+  public:
+    TwiControl& operator=(uint8_t val);
+    operator uint8_t() const;
+
+};
+
+extern TwiControl TWCR;
+extern uint8_t TWSR;
+extern uint8_t TWDR;
+extern uint8_t TWBR;
+
+#endif
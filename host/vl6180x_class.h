@@ -0,0 +1,128 @@
+#ifndef _VL6180X_CLASS__H_
+#define _VL6180X_CLASS__H_
+
+// Fake VL6180X for host builds.
+//
+// Offers the same member functions the sketch calls on the STM32duino
+// VL6180X class.  Instead of talking I2C, each device reads its range
+// from a RangeSource at the instant a measurement completes, then asserts
+// its GPIO1 interrupt line until the measurement is collected.
+// As on the real part, GPIO1 is low while the device is off and idles
+// high (active-low polarity) once it boots, until SetupGPIO1() selects
+// another polarity.
+// Devices are tied to a source channel and an interrupt pin by their
+// enable (GPIO0) pin, using connect() before the sketch calls begin().
+//
+// Driver calls stand for blocking Wire transfers, and take the bus time
+// those transfers would.  Each device is also on the fake TWI bus, where
+// it answers register reads and writes at its I2C address.
+//
+// set_convergence_usec() models the return signal: a measurement then
+// takes its convergence time as well as the fixed time, and one which
+// does not converge by the max convergence time reports an error.
+//
+// inject() makes a device fail, as a loose connector or a latched-up part
+// would, until it is next switched off by its enable pin.
+//
+// Every device comes out of reset at the same address, and InitSensor()
+// moves all those powered up there at once, as the real address write
+// would; collisions() counts the devices moved by another's.
+
+#include <Wire.h>
+
+#include "vl6180x_def.h"
+
+#include "FakeTWI.h"
+
+class RangeSource;
+
+class VL6180X : public I2CDevice {
+
+  public:
+    // Faults inject() can make
+    enum E_Fault {
+      eNoFault,
+      eHang,                  // measurements never complete
+      eMute                   // no answer on the bus
+    };
+
+  private:
+    const int m_ena;          // enable (GPIO0) pin
+    int m_gpio1;              // interrupt (GPIO1) pin, -1 if not wired
+    unsigned m_channel;       // channel of RangeSource
+    uint8_t m_addr;           // I2C address
+    uint8_t m_conv_ms;        // max convergence time (msec)
+    bool m_powered;           // GPIO0 high
+    bool m_active_high;       // GPIO1 interrupt polarity
+    bool m_busy;              // measurement in progress
+    bool m_ready;             // measurement waiting to be collected
+    bool m_continuous;        // continuous ranging started
+    uint32_t m_period_us;     // continuous ranging period
+    uint32_t m_seq;           // invalidates stale completion events
+    uint16_t m_reg;           // register index for bus transfers
+    uint8_t m_nreg;           // index bytes received in this write
+    uint8_t m_fault;          // E_Fault
+    uint32_t m_conv_us;       // convergence time of measurement under way
+    uint8_t m_conv_error;     // its error code, if it does not converge
+    VL6180x_RangeData_t m_data;
+
+    static void complete(void* arg, uint32_t tag);
+    void set_line(bool asserted);
+    int start(bool continuous);
+    uint32_t measure_usec();
+    void clear();
+    void write_reg(uint16_t reg, uint8_t val);
+    uint8_t read_reg(uint16_t reg) const;
+
+  public:
+    VL6180X(TwoWire* i2c, int pin);
+
+    // Subset of driver API used by Sensor
+    int begin();
+    void VL6180x_On();
+    void VL6180x_Off();
+    int InitSensor(uint8_t addr);
+    int Present();
+    int Prepare();
+    int SetupGPIO1(uint8_t mode, int polarity);
+    int RangeConfigInterrupt(uint8_t config);
+    int RangeSetMaxConvergenceTime(uint8_t ms);
+    int FilterSetState(int state);
+    int DMaxSetState(int state);
+    int RangeStartSingleShot();
+    int RangeSetInterMeasPeriod(uint32_t period_msec);
+    int RangeStartContinuousMode();
+    int RangeGetMeasurementIfReady(VL6180x_RangeData_t* data);
+
+    // Bus interface
+    virtual bool i2c_address(uint8_t addr) const;
+    virtual bool i2c_start(bool read);
+    virtual bool i2c_write(uint8_t b);
+    virtual uint8_t i2c_read();
+
+    // Simulation hooks
+
+    // Wire the device enabled by ena_pin to a source channel and
+    // interrupt pin.
+    static void connect(int ena_pin, unsigned channel, int gpio1_pin);
+    // Forget all wiring.
+    static void disconnect_all();
+    // Source of ranges for all devices.
+    static void set_source(RangeSource* src);
+    // Time from start of measurement to sample ready (usec).
+    static void set_measure_usec(uint32_t usec);
+    // Convergence time of the return signal from a target at 50 mm,
+    // growing with the square of its range (usec); 0 to model none, each
+    // measurement then taking the same time.
+    static void set_convergence_usec(uint32_t usec);
+    // Number of measurements completed on a channel since disconnect_all().
+    static uint64_t samples(unsigned channel);
+    // Make the device on a channel fail now.  Returns false if no device
+    // has been set up on the channel.
+    static bool inject(unsigned channel, E_Fault kind);
+    // Number of devices given another's address since disconnect_all().
+    static uint32_t collisions();
+
+};
+
+#endif
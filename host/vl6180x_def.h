@@ -0,0 +1,35 @@
+#ifndef _VL6180X_DEF__H_
+#define _VL6180X_DEF__H_
+
+// Host stand-in for the subset of the VL6180X API definitions used
+// by the sketch.
+
+#include <stdint.h>
+
+// Status codes returned by API calls
+#define NOT_READY -2
+
+// GPIO1 and interrupt configuration
+#define GPIOx_SELECT_GPIO_INTERRUPT_OUTPUT 0x08
+#define CONFIG_GPIO_INTERRUPT_NEW_SAMPLE_READY 0x04
+
+// Values reported in VL6180x_RangeData_t::errorStatus
+#define RANGE_NO_ERROR 0
+#define RANGE_MAX_CONVERGENCE 7
+#define RANGE_NO_TARGET 11
+
+// Range measurement data
+typedef struct {
+  int32_t range_mm;         // range distance (mm)
+  int32_t signalRate_mcps;  // return signal rate (MCPS), 9.7 fixed point
+  uint32_t errorStatus;     // error status of current measurement
+  uint32_t rtnRate;         // return signal rate
+  uint32_t refRate;         // reference return signal rate
+  uint32_t rtnAmbRate;      // return ambient rate
+  uint32_t refAmbRate;      // reference ambient rate
+  uint32_t rtnConvTime;     // return convergence time (usec)
+  uint32_t refConvTime;     // reference convergence time (usec)
+  uint32_t DMax;            // DMax (mm)
+} VL6180x_RangeData_t;
+
+#endif